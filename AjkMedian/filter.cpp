@@ -14,8 +14,38 @@
 // Includes
 #include "avisynth.h"
 #include <vector>
+#include <thread>
+#include <algorithm>
 #include <stdint.h>
 #include "median.h"
+#include "replay.h"
+
+//////////////////////////////////////////////////////////////////////////////
+// Plane modes y, u and v: 3 = process, 2 = copy from the first clip,
+// 1 = leave. chroma=false means u=v=2 unless those are given. Interleaved
+// formats only know chroma, other modes are an error there.
+//////////////////////////////////////////////////////////////////////////////
+static void plane_modes(const VideoInfo& vi, const AVSValue& y, const AVSValue& u, const AVSValue& v, bool chroma, int modes[3], IScriptEnvironment* env)
+{
+  const int defaults[3] = { PLANE_PROCESS, chroma ? PLANE_PROCESS : PLANE_COPY, chroma ? PLANE_PROCESS : PLANE_COPY };
+
+  modes[0] = y.AsInt(defaults[0]);
+  modes[1] = u.AsInt(defaults[1]);
+  modes[2] = v.AsInt(defaults[2]);
+
+  for (int i = 0; i < 3; i++)
+  {
+    if (modes[i] < PLANE_SKIP || modes[i] > PLANE_PROCESS)
+      env->ThrowError(ERROR_PREFIX "Y, u and v need to be 1 (leave), 2 (copy) or 3 (process).");
+  }
+
+  for (int i = 0; i < 3; i++)
+  {
+    if (!vi.IsPlanar() && modes[i] != defaults[i])
+      env->ThrowError(ERROR_PREFIX "Y, u and v modes need a planar format.");
+  }
+}
+
 
 //////////////////////////////////////////////////////////////////////////////
 // Create Median filter
@@ -25,8 +55,8 @@ AVSValue __cdecl Create_Median(AVSValue args, void* user_data, IScriptEnvironmen
   AVSValue array = args[0];
   int n = array.ArraySize();
 
-  if (n < 3 || n > 25 || n % 2 == 0)
-    env->ThrowError(ERROR_PREFIX "Need an odd number of clips between 3 and 25.");
+  if (n < 3 || n > (int)MAX_DEPTH || n % 2 == 0)
+    env->ThrowError(ERROR_PREFIX "Need an odd number of clips between 3 and %u.", (MAX_DEPTH - 1) | 1);
 
   std::vector<PClip> clips;
 
@@ -38,6 +68,21 @@ AVSValue __cdecl Create_Median(AVSValue args, void* user_data, IScriptEnvironmen
   int sync = args[2].AsInt(0);
   int samples = args[3].AsInt(4096U);
   bool debug = args[4].AsBool(false);
+  const char* synccache = args[5].AsString("");
+  int threads = args[6].AsInt(1);
+  bool tune = args[7].AsBool(false);
+  bool identical = args[8].AsBool(false);
+  int lazy = args[9].AsInt(0);
+  double agreement = args[10].AsFloat(98.0f);
+  double adaptive = args[11].AsFloat(0.0f);
+  double exclude = args[12].AsFloat(0.0f);
+
+  int modes[3];
+  plane_modes(clips[0]->GetVideoInfo(), args[13], args[14], args[15], chroma, modes, env);
+  bool argmedian = args[16].AsBool(false);
+  bool map = args[17].AsBool(false);
+  int chromaclips = args[18].AsInt(n);
+  bool fields = args[19].AsBool(false);
 
   // Validation
   if (sync < 0)
@@ -46,10 +91,37 @@ AVSValue __cdecl Create_Median(AVSValue args, void* user_data, IScriptEnvironmen
   if (samples < 0)
     env->ThrowError(ERROR_PREFIX "Samples needs to be a positive value.");
 
+  if (threads < 0)
+    env->ThrowError(ERROR_PREFIX "Threads needs to be a positive value.");
+
+  if (threads == 0)
+    threads = (int)std::max(1U, std::thread::hardware_concurrency());
+
+  if (lazy != 0 && (lazy < 3 || lazy >= n || lazy % 2 == 0))
+    env->ThrowError(ERROR_PREFIX "Lazy needs to be 0 or an odd number of clips from 3 to %d.", n - 2);
+
+  if (agreement < 0.0 || agreement > 100.0)
+    env->ThrowError(ERROR_PREFIX "Agreement needs to be between 0 and 100.");
+
+  if (adaptive < 0.0)
+    env->ThrowError(ERROR_PREFIX "Adaptive needs to be a positive value.");
+
+  if (exclude < 0.0)
+    env->ThrowError(ERROR_PREFIX "Exclude needs to be a positive value.");
+
+  if (chromaclips < 3 || chromaclips > n || chromaclips % 2 == 0)
+    env->ThrowError(ERROR_PREFIX "Chromaclips needs to be an odd number of clips from 3 to %d.", n);
+
   // Set low and high so that a regular median function is achieved
   unsigned int limit = (n - 1) / 2;
 
-  return new Median(clips[0], clips, limit, limit, false, chroma, sync, samples, debug, env);
+  // Chroma of all clips is the regular case
+  unsigned int chromalimit = (chromaclips - 1) / 2;
+
+  if (chromaclips == n)
+    chromaclips = 0;
+
+  return new Median(clips[0], clips, limit, limit, false, modes, argmedian, map, chromaclips, chromalimit, chromalimit, fields, sync, samples, synccache, threads, lazy, agreement, adaptive, exclude, tune, identical, debug, env);
 }
 
 
@@ -65,12 +137,25 @@ AVSValue __cdecl Create_TemporalMedian(AVSValue args, void* user_data, IScriptEn
   int radius = args[1].AsInt(1);
   bool chroma = args[2].AsBool(true);
   bool debug = args[3].AsBool(false);
+  bool tune = args[4].AsBool(false);
+  bool identical = args[5].AsBool(false);
+
+  int modes[3];
+  plane_modes(clips[0]->GetVideoInfo(), args[6], args[7], args[8], chroma, modes, env);
+  bool argmedian = args[9].AsBool(false);
+  int chromaradius = args[10].AsInt(radius);
 
   // Validation
-  if (radius < 1 || radius > 12)
-    env->ThrowError(ERROR_PREFIX "Radius needs to be between 1 and 12.");
+  if (radius < 1 || radius > (int)(MAX_DEPTH - 1) / 2)
+    env->ThrowError(ERROR_PREFIX "Radius needs to be between 1 and %u.", (MAX_DEPTH - 1) / 2);
+
+  if (chromaradius < 1 || chromaradius > radius)
+    env->ThrowError(ERROR_PREFIX "Chromaradius needs to be between 1 and radius.");
 
-  return new Median(clips[0], clips, radius, radius, true, chroma, 0, 0, debug, env);
+  // Chroma of the nearest frames, none of that for the whole radius
+  unsigned int chromaclips = chromaradius < radius ? 2 * chromaradius + 1 : 0;
+
+  return new Median(clips[0], clips, radius, radius, true, modes, argmedian, false, chromaclips, chromaradius, chromaradius, false, 0, 0, nullptr, 1, 0, 0.0, 0.0, 0.0, tune, identical, debug, env);
 }
 
 
@@ -82,8 +167,8 @@ AVSValue __cdecl Create_MedianBlend(AVSValue args, void* user_data, IScriptEnvir
   AVSValue array = args[0];
   int n = array.ArraySize();
 
-  if (n < 3 || n > 25)
-    env->ThrowError(ERROR_PREFIX "Need 3-25 clips.");
+  if (n < 3 || n > (int)MAX_DEPTH)
+    env->ThrowError(ERROR_PREFIX "Need 3-%u clips.", MAX_DEPTH);
 
   std::vector<PClip> clips;
 
@@ -97,18 +182,75 @@ AVSValue __cdecl Create_MedianBlend(AVSValue args, void* user_data, IScriptEnvir
   int sync = args[4].AsInt(0);
   int samples = args[5].AsInt(4096U);
   bool debug = args[6].AsBool(false);
+  const char* synccache = args[7].AsString("");
+  int threads = args[8].AsInt(1);
+  bool tune = args[9].AsBool(false);
+  bool identical = args[10].AsBool(false);
+
+  int modes[3];
+  plane_modes(clips[0]->GetVideoInfo(), args[11], args[12], args[13], chroma, modes, env);
+  int chromaclips = args[14].AsInt(n);
+  int chromalow = args[15].AsInt(low);
+  int chromahigh = args[16].AsInt(high);
+  bool fields = args[17].AsBool(false);
 
   // Validation
   if (low < 0 || high < 0 || low >= n || high >= n || low + high >= n)
     env->ThrowError(ERROR_PREFIX "Invalid values supplied for low and/or high limits.");
 
+  if (chromaclips < 3 || chromaclips > n)
+    env->ThrowError(ERROR_PREFIX "Chromaclips needs to be between 3 and %d.", n);
+
+  if (chromalow < 0 || chromahigh < 0 || chromalow + chromahigh >= chromaclips)
+    env->ThrowError(ERROR_PREFIX "Invalid values supplied for chroma low and/or high limits.");
+
+  // Chroma with the luma ranks of all clips is the regular case
+  if (chromaclips == n && chromalow == low && chromahigh == high)
+    chromaclips = 0;
+
   if (sync < 0)
     env->ThrowError(ERROR_PREFIX "Sync needs to be a positive value.");
 
   if (samples < 0)
     env->ThrowError(ERROR_PREFIX "Samples needs to be a positive value.");
 
-  return new Median(clips[0], clips, low, high, false, chroma, sync, samples, debug, env);
+  if (threads < 0)
+    env->ThrowError(ERROR_PREFIX "Threads needs to be a positive value.");
+
+  if (threads == 0)
+    threads = (int)std::max(1U, std::thread::hardware_concurrency());
+
+  return new Median(clips[0], clips, low, high, false, modes, false, false, chromaclips, chromalow, chromahigh, fields, sync, samples, synccache, threads, 0, 0.0, 0.0, 0.0, tune, identical, debug, env);
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Create MedianReplay filter
+//////////////////////////////////////////////////////////////////////////////
+AVSValue __cdecl Create_MedianReplay(AVSValue args, void* user_data, IScriptEnvironment* env)
+{
+  AVSValue array = args[0];
+  int n = array.ArraySize();
+
+  if (n < 3 || n > (int)MAX_DEPTH)
+    env->ThrowError(ERROR_PREFIX "Need 3-%u clips.", MAX_DEPTH);
+
+  std::vector<PClip> clips;
+
+  for (int i = 0; i < n; i++)
+    clips.push_back(array[i].AsClip());
+
+  // Parameters
+  if (!args[1].IsClip())
+    env->ThrowError(ERROR_PREFIX "Replay needs a map clip from Median(map=true).");
+
+  PClip map = args[1].AsClip();
+  const char* synccache = args[2].AsString("");
+
+  int modes[3];
+  plane_modes(clips[0]->GetVideoInfo(), args[3], args[4], args[5], true, modes, env);
+
+  return new MedianReplay(clips[0], clips, map, modes, synccache, env);
 }
 
 
@@ -121,9 +263,10 @@ extern "C" __declspec(dllexport) const char* __stdcall AvisynthPluginInit3(IScri
 {
   AVS_linkage = AVS_linkage_arg;
 
-  env->AddFunction("Median", "c+[CHROMA]b[SYNC]i[SAMPLES]i[DEBUG]b", Create_Median, 0);
-  env->AddFunction("TemporalMedian", "c[RADIUS]i[CHROMA]b[DEBUG]b", Create_TemporalMedian, 0);
-  env->AddFunction("MedianBlend", "c+[LOW]i[HIGH]i[CHROMA]b[SYNC]i[SAMPLES]i[DEBUG]b", Create_MedianBlend, 0);
+  env->AddFunction("Median", "c+[CHROMA]b[SYNC]i[SAMPLES]i[DEBUG]b[SYNCCACHE]s[THREADS]i[TUNE]b[IDENTICAL]b[LAZY]i[AGREEMENT]f[ADAPTIVE]f[EXCLUDE]f[Y]i[U]i[V]i[ARGMEDIAN]b[MAP]b[CHROMACLIPS]i[FIELDS]b", Create_Median, 0);
+  env->AddFunction("TemporalMedian", "c[RADIUS]i[CHROMA]b[DEBUG]b[TUNE]b[IDENTICAL]b[Y]i[U]i[V]i[ARGMEDIAN]b[CHROMARADIUS]i", Create_TemporalMedian, 0);
+  env->AddFunction("MedianReplay", "c+[MAP]c[SYNCCACHE]s[Y]i[U]i[V]i", Create_MedianReplay, 0);
+  env->AddFunction("MedianBlend", "c+[LOW]i[HIGH]i[CHROMA]b[SYNC]i[SAMPLES]i[DEBUG]b[SYNCCACHE]s[THREADS]i[TUNE]b[IDENTICAL]b[Y]i[U]i[V]i[CHROMACLIPS]i[CHROMALOW]i[CHROMAHIGH]i[FIELDS]b", Create_MedianBlend, 0);
 
   return "Median of clips filter";
 }
@@ -2,10 +2,13 @@
 #include "avisynth.h"
 #include "print.h"
 #include "median.h"
-#include "opt_med.h"
+#include "sync.h"
 #include <vector>
+#include <algorithm>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
+#include <math.h>
 
 #ifdef _WIN32
 #include <Windows.h>
@@ -14,39 +17,27 @@
 //////////////////////////////////////////////////////////////////////////////
 // Constructor
 //////////////////////////////////////////////////////////////////////////////
-Median::Median(PClip _child, std::vector<PClip> _clips, unsigned int _low, unsigned int _high, bool _temporal, bool _processchroma, unsigned int _sync, unsigned int _samples, bool _debug, IScriptEnvironment* env) :
-  GenericVideoFilter(_child), clips(_clips), low(_low), high(_high), temporal(_temporal), processchroma(_processchroma), sync(_sync), samples(_samples), debug(_debug)
+Median::Median(PClip _child, std::vector<PClip> _clips, unsigned int _low, unsigned int _high, bool _temporal, const int _modes[3], bool _argmedian, bool _map, unsigned int _chromaclips, unsigned int _chromalow, unsigned int _chromahigh, bool _fields, unsigned int _sync, unsigned int _samples, const char* _synccache, unsigned int _threads, unsigned int _lazy, double _agreement, double _adaptive, double _exclude, bool _tune, bool _identical, bool _debug, IScriptEnvironment* env) :
+  GenericVideoFilter(_child), clips(_clips), low(_low), high(_high), temporal(_temporal), argmedian(_argmedian), map(_map), chromaclips(_chromaclips), fields(_fields), sync(_sync), samples(_samples), threads(_threads), lazy(_lazy), agreement(_agreement), exclude(_exclude), identical(_identical), debug(_debug),
+  processor(_temporal ? 2 * _low + 1 : (unsigned int)_clips.size(), _low, _high) // temporal: low == high == radius and we only have one source clip
 {
   // Check frame property support
   has_at_least_v8 = true;
   try { env->CheckVersion(8); }
   catch (const AvisynthError&) { has_at_least_v8 = false; }
 
-  if (temporal)
-    depth = 2 * low + 1; // In this case low == high == radius and we only have one source clip
-  else
-    depth = (int)clips.size();
+  depth = processor.GetDepth();
 
-  blend = depth - low - high;
+  for (int i = 0; i < 3; i++)
+    modes[i] = _modes[i];
 
-  if (blend == 1 && low == high && depth <= MAX_OPT)
-    fastprocess = true;
-  else
-    fastprocess = false;
+  processchroma = modes[1] == PLANE_PROCESS && modes[2] == PLANE_PROCESS;
 
 #ifdef _WIN32
-  debugf("depth: %d, blend: %d, low: %d, high: %d, fast: %d, temporal: %d, sync: %d, samples: %d",
-    depth, blend, low, high, (int)fastprocess, (int)temporal, (int)sync, (int)samples);
+  debugf("depth: %d, blend: %d, low: %d, high: %d, fast: %d, temporal: %d, sync: %d, samples: %d, threads: %d, lazy: %d",
+    depth, processor.GetBlend(), low, high, (int)processor.IsFast(), (int)temporal, (int)sync, (int)samples, (int)threads, (int)lazy);
 #endif
 
-  switch (depth)
-  {
-  case 3: fastmedian = opt_med3; break;
-  case 5: fastmedian = opt_med5; break;
-  case 7: fastmedian = opt_med7; break;
-  case 9: fastmedian = opt_med9; break;
-  }
-
   if (temporal)
   {
     info.push_back(clips[0]->GetVideoInfo());
@@ -68,6 +59,132 @@ Median::Median(PClip _child, std::vector<PClip> _clips, unsigned int _low, unsig
         env->ThrowError(ERROR_PREFIX "Dimensions of all clips must match.");
     }
   }
+
+  // Sample layout handed to the core
+  if (info[0].IsPlanar())
+  {
+    switch (info[0].ComponentSize())
+    {
+    case 1: format = MEDIAN_PLANE_8BIT; break;
+    case 2: format = MEDIAN_PLANE_16BIT; break;
+    default: format = MEDIAN_PLANE_FLOAT; break;
+    }
+  }
+  else if (info[0].IsYUY2())
+    format = MEDIAN_YUY2;
+  else if (info[0].IsRGB24())
+    format = MEDIAN_BGR24;
+  else if (info[0].IsRGB32())
+    format = MEDIAN_BGR32;
+  else if (info[0].pixel_type == VideoInfo::CS_BGR64)
+    format = MEDIAN_BGR64;
+  else
+    env->ThrowError(ERROR_PREFIX "Unsupported color format.");
+
+  if (argmedian && !info[0].IsPlanar())
+    env->ThrowError(ERROR_PREFIX "Argmedian needs a planar format.");
+
+  if (argmedian && modes[0] != PLANE_PROCESS)
+    env->ThrowError(ERROR_PREFIX "Argmedian needs the luma plane processed (y=3).");
+
+  if (map && !info[0].IsPlanar())
+    env->ThrowError(ERROR_PREFIX "Map needs a planar format.");
+
+  if (chromaclips > 0 && !info[0].IsPlanar())
+    env->ThrowError(ERROR_PREFIX "Chroma limits need a planar format.");
+
+  if (chromaclips > 0 && argmedian)
+    env->ThrowError(ERROR_PREFIX "Chroma limits can't be used with argmedian.");
+
+  if (fields && (lazy > 0 || exclude > 0.0 || map))
+    env->ThrowError(ERROR_PREFIX "Fields can't be used with lazy, exclude or map.");
+
+  // Frames decided by the first clips alone leave no offsets in the sync cache to replay
+  if (map && lazy > 0)
+    env->ThrowError(ERROR_PREFIX "Map can't be used with lazy.");
+
+  // Every plane splits into two fields of whole rows
+  const int rows = info[0].IsPlanar() && !info[0].IsY() ? 2 << info[0].GetPlaneHeightSubsampling(PLANAR_U) : 2;
+
+  if (fields && info[0].height % rows)
+    env->ThrowError(ERROR_PREFIX "Fields need a height divisible by %d.", rows);
+
+  // Greyscale has no chroma to pick
+  argmedian = argmedian && !info[0].IsY();
+
+  if (argmedian)
+    selection.resize((size_t)info[0].width * info[0].height);
+
+  // Chroma gets ranks of its own over fewer clips
+  if (chromaclips > 0 && !info[0].IsY())
+    chroma.reset(new MedianProcessor(chromaclips, _chromalow, _chromahigh));
+
+  // The output is the selection map, one byte per luma sample
+  if (map)
+    vi.pixel_type = VideoInfo::CS_Y8;
+
+  // Median of the first clips, used when they agree on their own
+  if (lazy > 0)
+    subset.reset(new MedianProcessor(lazy, (lazy - 1) / 2, (lazy - 1) / 2));
+
+  // Medians of the odd depths that remain when clips are left out
+  if (exclude > 0.0)
+  {
+    reduced.resize(depth);
+
+    for (unsigned int d = 3; d < depth; d += 2)
+      reduced[d].reset(new MedianProcessor(d, (d - 1) / 2, (d - 1) / 2));
+  }
+
+  std::vector<MedianProcessor*> processors = { &processor };
+
+  if (subset)
+    processors.push_back(subset.get());
+
+  if (chroma)
+    processors.push_back(chroma.get());
+
+  for (auto& reduction : reduced)
+  {
+    if (reduction)
+      processors.push_back(reduction.get());
+  }
+
+  for (MedianProcessor* p : processors)
+  {
+    // Median of 3 where the first clips are close, threshold given in 8 bit steps
+    if (_adaptive > 0.0)
+    {
+      const int bits = info[0].BitsPerComponent();
+      p->SetAdaptive(bits == 32 ? _adaptive / 255.0 : _adaptive * (1 << (bits - 8)));
+    }
+
+    // Pick the fastest kernel for this CPU instead of the fixed rule
+    if (_tune)
+      p->Tune(format);
+
+    // Count the blocks copied because all sources agreed, for the overlay
+    if (debug)
+      p->SetStats(&stats);
+  }
+
+#ifdef _WIN32
+  debugf("kernel: %s, cpu: %s", kernel_name(processor.GetKernel(format)), cpu_signature());
+#endif
+
+  // Offsets found by earlier runs are kept on disk, if requested
+  if (sync > 0 && _synccache && *_synccache)
+  {
+    std::string error;
+
+    // Fields keep an offset and score per clip for each of them
+    if (!synccache.Open(_synccache, fields ? 2 * depth : depth, vi.num_frames, sync, samples, fields, false, error))
+      env->ThrowError(ERROR_PREFIX "%s", error.c_str());
+  }
+
+  // Started once, the sync search of every frame only hands them comparisons
+  if (sync > 0 && threads > 1)
+    workers.reset(new WorkerPool(std::min(threads, depth - 1)));
 }
 
 
@@ -84,12 +201,14 @@ Median::~Median()
 //////////////////////////////////////////////////////////////////////////////
 PVideoFrame __stdcall Median::GetFrame(int n, IScriptEnvironment* env)
 {
-  // Sync statistics for this frame
-  double best[MAX_DEPTH] = { 0.0 };
-  int match[MAX_DEPTH] = { 0 };
+  // Sync statistics for this frame, with fields those of the second field
+  // follow at depth
+  double best[2 * MAX_DEPTH] = { 0.0 };
+  int match[2 * MAX_DEPTH] = { 0 };
 
   // Source
-  PVideoFrame src[MAX_DEPTH];
+  PVideoFrame src[2 * MAX_DEPTH];
+  unsigned int fetched = depth;
 
   if (temporal)
   {
@@ -99,43 +218,93 @@ PVideoFrame __stdcall Median::GetFrame(int n, IScriptEnvironment* env)
     for (unsigned int i = 0; i < depth; i++)
       src[i] = clips[0]->GetFrame(n - radius + i, env); // Grab an equal number of preceding and following frames
   }
-  else if (sync > 0)
+  else
   {
-    src[0] = clips[0]->GetFrame(n, env);
+    // Offsets are already known if cached, skip the search then
+    const bool cached = sync > 0 && synccache.Lookup(n, match, best);
 
-    for (unsigned int i = 1; i < depth; i++)
+    // Lazy: the first clips decide whether the others are needed at all
+    fetched = lazy > 0 ? lazy : depth;
+    FetchClips(n, 0, fetched, cached, src, best, match, env);
+
+    if (fetched < depth && !Consensus(src, best, fetched))
     {
-      int radius = sync;
+      FetchClips(n, fetched, depth, cached, src, best, match, env);
+      fetched = depth;
+    }
 
-      for (int j = -radius; j <= radius; j++)
-      {
-        double similarity = CompareFrames(PLANAR_Y, src[0], clips[i]->GetFrame(n + j, env), samples);
+    // Only complete searches are kept
+    if (sync > 0 && !cached && fetched == depth)
+      synccache.Store(n, match, best);
+  }
 
-        if (similarity > best[i])
-        {
-          best[i] = similarity;
-          match[i] = j;
-        }
-      }
+  // Blank or far off clips are left out of this frame
+  bool excluded[MAX_DEPTH] = { false };
+  unsigned int used = fetched;
 
-      src[i] = clips[i]->GetFrame(n + match[i], env);
-    }
+  if (exclude > 0.0 && fetched == depth)
+    used = ExcludeClips(src, excluded);
+
+  const MedianProcessor& active = fetched < depth ? *subset : used < depth ? *reduced[used] : processor;
+
+  const uint64_t blocks = stats.blocks;
+  const uint64_t skipped = stats.skipped;
+  const uint64_t pixels = stats.pixels;
+  const uint64_t escalated = stats.escalated;
+
+  // Output
+  PVideoFrame output;
+  // Float blends round their sums, the result of equal sources isn't always
+  // that value, so those are processed as the block skip does
+  const bool exact = active.SkipsEqual(format) && (!chroma || chroma->SkipsEqual(format));
+  const bool same = exact && !map && !fields && SameFrames(src, used);
+
+  if (same)
+  {
+    // Every source is the same picture, which is also the result. The
+    // overlay needs a copy of its own.
+    output = temporal ? src[low] : src[0];
+
+    if (debug)
+      env->MakeWritable(&output);
   }
+  else if (map)
+    output = SelectionMap(active, src, excluded, env);
   else
   {
-    for (unsigned int i = 0; i < depth; i++)
-      src[i] = clips[i]->GetFrame(n, env);
-  }
+    // A source frame nobody else holds takes the result in place, its frame
+    // properties stay. Its slot is cleared so the output is the only
+    // reference, the processing reads that source through the output.
+    PVideoFrame& first = temporal ? src[low] : src[0];
 
-  // Output
-  // w/ frame property copy source
-  PVideoFrame output = has_at_least_v8 ? env->NewVideoFrameP(vi, temporal ? &src[low] : &src[0]) : env->NewVideoFrame(vi);
+    // The second field's reference is the same frame, not another holder
+    if (fields)
+      src[depth] = nullptr;
 
-  // Select between planar and interleaved processing
-  if (info[0].IsPlanar())
-    ProcessPlanarFrame(src, output);
-  else
-    ProcessInterleavedFrame(src, output);
+    if (first->IsWritable())
+    {
+      output = first;
+      first = nullptr;
+    }
+    else
+      output = has_at_least_v8 ? env->NewVideoFrameP(vi, &first) : env->NewVideoFrame(vi); // w/ frame property copy source
+
+    if (fields)
+      src[depth] = src[0];
+
+    // Select between planar and interleaved processing, each field is every
+    // other row of the same buffers
+    for (int field = fields ? 0 : -1; field < (fields ? 2 : 0); field++)
+    {
+      PVideoFrame* view = src + (field > 0 ? depth : 0);
+      const double* scores = best + (field > 0 ? depth : 0);
+
+      if (info[0].IsPlanar())
+        ProcessPlanarFrame(active, view, scores, output, field, env);
+      else
+        ProcessInterleavedFrame(active, view, output, field);
+    }
+  }
 
   // Print debug information on output image
   if (debug)
@@ -144,13 +313,48 @@ PVideoFrame __stdcall Median::GetFrame(int n, IScriptEnvironment* env)
     textf(output, "FRAME: %d", n);
     textf(output, "CLIPS: %d", depth);
 
+    if (lazy > 0)
+      textf(output, "LAZY: %u OF %u CLIPS", fetched, depth);
+
+    if (exclude > 0.0)
+    {
+      std::string list;
+
+      for (unsigned int i = 0; i < depth; i++)
+      {
+        if (excluded[i])
+          list += " " + std::to_string(i + 1);
+      }
+
+      textf(output, "EXCLUDED:%s", list.empty() ? " NONE" : list.c_str());
+    }
+
+    textf(output, "KERNEL: %s", kernel_name(active.GetKernel(format)));
+
+    if (chroma && &active == &processor)
+      textf(output, "CHROMA: %u OF %u CLIPS, KERNEL: %s", chromaclips, depth, kernel_name(chroma->GetKernel(format)));
+
+    textf(output, "CPU: %s", cpu_signature());
+    textf(output, "SKIPPED: %llu OF %llu BLOCKS", (unsigned long long)(stats.skipped - skipped), (unsigned long long)(stats.blocks - blocks));
+
+    if (active.IsAdaptive(format))
+      textf(output, "ESCALATED: %llu OF %llu PIXELS", (unsigned long long)(stats.escalated - escalated), (unsigned long long)(stats.pixels - pixels));
+
+    if (same)
+      textf(output, "PASSTHROUGH: IDENTICAL SOURCES");
+
     if (sync > 0)
     {
       textf(output, "SYNC RADIUS: %d", sync);
-      textf(output, "SYNC METRICS:");
+      textf(output, fields ? "SYNC METRICS (TOP, BOTTOM FIELD):" : "SYNC METRICS:");
 
-      for (unsigned int i = 1; i < depth; i++)
-        textf(output, "%-2d %+-3d %-f", i + 1, match[i], best[i]);
+      for (unsigned int i = 1; i < fetched; i++)
+      {
+        if (fields)
+          textf(output, "%-2d %+-3d %-f %+-3d %-f", i + 1, match[i], best[i], match[depth + i], best[depth + i]);
+        else
+          textf(output, "%-2d %+-3d %-f", i + 1, match[i], best[i]);
+      }
     }
   }
 
@@ -159,286 +363,529 @@ PVideoFrame __stdcall Median::GetFrame(int n, IScriptEnvironment* env)
 
 
 //////////////////////////////////////////////////////////////////////////////
-// Compare two frames
-// 
-// returns 100.0 -> exact match, 0.0 -> completely different
+// Fetch clips first to last - 1 of frame n
+//
+// Offsets in match are used as they are when there is nothing to search:
+// sync is off (all zero) or they came from the sync cache. With fields the
+// second field of clip i is at i + depth, a frame both fields share is
+// fetched once.
 //////////////////////////////////////////////////////////////////////////////
-double Median::CompareFrames(int plane, PVideoFrame a, PVideoFrame b, unsigned int points)
+void Median::FetchClips(int n, unsigned int first, unsigned int last, bool cached, PVideoFrame src[2 * MAX_DEPTH], double best[2 * MAX_DEPTH], int match[2 * MAX_DEPTH], IScriptEnvironment* env)
 {
-  const unsigned char* aptr = a->GetReadPtr(plane);
-  const unsigned char* bptr = b->GetReadPtr(plane);
-
-  const unsigned int length = a->GetRowSize(plane) * a->GetHeight(plane);
+  if (sync == 0 || cached)
+  {
+    for (unsigned int i = first; i < last; i++)
+    {
+      src[i] = clips[i]->GetFrame(n + match[i], env);
 
-  if (points < 1 || points > length)
-    points = length;
+      if (fields)
+        src[depth + i] = match[depth + i] == match[i] ? src[i] : clips[i]->GetFrame(n + match[depth + i], env);
+    }
 
-  const unsigned int step = length / points;
+    return;
+  }
 
-  unsigned long sum = 0;
+  if (first == 0)
+  {
+    src[0] = clips[0]->GetFrame(n, env);
 
-  for (unsigned int i = 0; i < length; i = i + step)
-    sum = sum + abs((int)aptr[i] - (int)bptr[i]);
+    if (fields)
+      src[depth] = src[0];
 
-  double difference = (100.0 * sum) / (255.0 * points);
+    first = 1;
+  }
 
-  return 100.0 - difference;
+  if (workers && last - first > 1)
+    SyncParallel(n, first, last, src, best, match, env);
+  else
+  {
+    for (unsigned int i = first; i < last; i++)
+      SyncClip(i, n, src, best, match, env);
+  }
 }
 
 
 //////////////////////////////////////////////////////////////////////////////
-// Image processing for planar images
+// Lazy fetching: do the first count clips agree well enough on their own?
+//
+// Uses the sync scores when there are any, otherwise compares the luma of
+// each clip with the first one the same way the sync search does.
 //////////////////////////////////////////////////////////////////////////////
-void Median::ProcessPlanarFrame(PVideoFrame src[MAX_DEPTH], PVideoFrame& dst)
+bool Median::Consensus(PVideoFrame src[MAX_DEPTH], double best[MAX_DEPTH], unsigned int count)
 {
-  ProcessPlane(PLANAR_Y, src, dst);
-  ProcessPlane(PLANAR_U, src, dst);
-  ProcessPlane(PLANAR_V, src, dst);
+  for (unsigned int i = 1; i < count; i++)
+  {
+    if (sync == 0)
+      best[i] = CompareFrames(PLANAR_Y, src[0], src[i], samples, -1);
+
+    if (best[i] < agreement)
+      return false;
+  }
+
+  return true;
 }
 
 
 //////////////////////////////////////////////////////////////////////////////
-// Processing of a single plane
+// Leave out clips whose frame is blank or far off in brightness
+//
+// Luma mean and variance come from as many evenly spread samples as the sync
+// search uses. A clip is left out when its variance is below a sixteenth of
+// the median variance (lost signal, blank frame), or its mean is more than
+// exclude (8 bit steps) away from the median mean. Of an even number of
+// remaining clips the one furthest off goes as well. Fewer than 3 clips
+// left means no decision is possible, then all of them are used.
+//
+// The used frames are moved to the front of src, returns their count.
 //////////////////////////////////////////////////////////////////////////////
-void Median::ProcessPlane(int plane, PVideoFrame src[MAX_DEPTH], PVideoFrame& dst)
+unsigned int Median::ExcludeClips(PVideoFrame src[MAX_DEPTH], bool excluded[MAX_DEPTH])
 {
-  // Source
-  const unsigned char* srcp[MAX_DEPTH];
+  double mean[MAX_DEPTH];
+  double variance[MAX_DEPTH];
 
   for (unsigned int i = 0; i < depth; i++)
-    srcp[i] = src[i]->GetReadPtr(plane);
+    LumaStatistics(src[i], mean[i], variance[i]);
 
-  // Destination
-  unsigned char* dstp = dst->GetWritePtr(plane);
+  auto median_of = [&](const double* values)
+  {
+    std::vector<double> sorted(values, values + depth);
+    std::nth_element(sorted.begin(), sorted.begin() + depth / 2, sorted.end());
+    return sorted[depth / 2];
+  };
 
-  // Dimensions
-  const int width = src[0]->GetRowSize(plane);
-  const int height = src[0]->GetHeight(plane);
+  const double typical_mean = median_of(mean);
+  const double typical_variance = median_of(variance);
+
+  unsigned int count = depth;
 
-  // Process
-  for (int y = 0; y < height; ++y)
+  for (unsigned int i = 0; i < depth; i++)
   {
-    for (int x = 0; x < width; ++x)
-    {
-      unsigned char values[MAX_DEPTH];
+    excluded[i] = variance[i] < typical_variance / 16.0 || fabs(mean[i] - typical_mean) > exclude;
+    count -= excluded[i];
+  }
 
-      for (unsigned int i = 0; i < depth; i++)
-        values[i] = srcp[i][x];
+  if (count % 2 == 0 && count > 3)
+  {
+    unsigned int furthest = 0;
+    double distance = -1.0;
 
-      if (plane == PLANAR_Y || processchroma == true)
-        dstp[x] = ProcessPixel(values);
-      else
-        dstp[x] = values[0]; // Use values from first clip
+    for (unsigned int i = 0; i < depth; i++)
+    {
+      if (!excluded[i] && fabs(mean[i] - typical_mean) > distance)
+      {
+        furthest = i;
+        distance = fabs(mean[i] - typical_mean);
+      }
     }
 
-    for (unsigned int i = 0; i < depth; i++)
-      srcp[i] = srcp[i] + src[i]->GetPitch(plane);
+    excluded[furthest] = true;
+    count--;
+  }
+
+  if (count < 3)
+  {
+    std::fill(excluded, excluded + depth, false);
+    return depth;
+  }
+
+  unsigned int used = 0;
+
+  for (unsigned int i = 0; i < depth; i++)
+  {
+    if (!excluded[i])
+      src[used++] = src[i];
+  }
+
+  for (unsigned int i = used; i < depth; i++)
+    src[i] = nullptr;
+
+  return used;
+}
+
+// Mean and variance of the first plane in 8 bit steps: luma, or all channels
+// of interleaved formats
+void Median::LumaStatistics(PVideoFrame frame, double& mean, double& variance)
+{
+  const int component = info[0].pixel_type == VideoInfo::CS_BGR64 ? 2 : info[0].ComponentSize();
+  const int bits = info[0].pixel_type == VideoInfo::CS_BGR64 ? 16 : info[0].BitsPerComponent();
+  const double scale = bits == 32 ? 255.0 : 1.0 / (1 << (bits - 8));
+
+  const unsigned char* ptr = frame->GetReadPtr(PLANAR_Y);
+  const int pitch = frame->GetPitch(PLANAR_Y);
+  const int width = frame->GetRowSize(PLANAR_Y) / component;
+  const int height = frame->GetHeight(PLANAR_Y);
+
+  const uint64_t length = (uint64_t)width * height;
+  const uint64_t points = samples < 1 || samples > length ? length : samples;
+  const uint64_t step = length / points;
+
+  double sum = 0.0;
+  double squares = 0.0;
 
-    dstp = dstp + dst->GetPitch(plane);
+  for (uint64_t p = 0; p < points; p++)
+  {
+    const uint64_t index = p * step;
+    const unsigned char* sample = ptr + (index / width) * pitch + (index % width) * component;
+
+    double value;
+
+    if (bits == 32)
+      value = *reinterpret_cast<const float*>(sample);
+    else if (component == 2)
+      value = *reinterpret_cast<const uint16_t*>(sample);
+    else
+      value = *sample;
+
+    value *= scale;
+    sum += value;
+    squares += value * value;
   }
+
+  mean = sum / points;
+  variance = std::max(squares / points - mean * mean, 0.0);
 }
 
 
 //////////////////////////////////////////////////////////////////////////////
-// Image processing for interleaved images
+// Find the offset of a single clip relative to the first one
+//
+// Candidates are requested in ascending frame order and only a strictly
+// better score replaces the current best, so the earliest offset wins ties.
+// The winning candidate is kept instead of being fetched a second time.
+// With fields every candidate is scored for both fields, each against the
+// same field of the first clip, results of the second one go to i + depth.
 //////////////////////////////////////////////////////////////////////////////
-void Median::ProcessInterleavedFrame(PVideoFrame src[MAX_DEPTH], PVideoFrame& dst)
+void Median::SyncClip(unsigned int i, int n, PVideoFrame src[2 * MAX_DEPTH], double best[2 * MAX_DEPTH], int match[2 * MAX_DEPTH], IScriptEnvironment* env)
 {
-  // Source
-  const unsigned char* srcp[MAX_DEPTH];
-
-  for (unsigned int i = 0; i < depth; i++)
-    srcp[i] = src[i]->GetReadPtr();
+  int radius = sync;
 
-  // Destination
-  unsigned char* dstp = dst->GetWritePtr();
+  for (int j = -radius; j <= radius; j++)
+    ScoreCandidate(i, j, clips[i]->GetFrame(n + j, env), src, best, match);
 
-  // Dimensions
-  const int width = info[0].width;
-  const int height = info[0].height;
+  FetchBest(i, n, src, match, env);
+}
 
-  // Process
-  if (info[0].IsYUY2())
+void Median::ScoreCandidate(unsigned int i, int j, const PVideoFrame& candidate, PVideoFrame src[2 * MAX_DEPTH], double best[2 * MAX_DEPTH], int match[2 * MAX_DEPTH])
+{
+  for (int field = fields ? 0 : -1; field < (fields ? 2 : 0); field++)
   {
-    //////////////////////////////////////////////////////////////////////
-    // YUYV
-    //////////////////////////////////////////////////////////////////////
-    unsigned char luma[MAX_DEPTH];
-    unsigned char chroma[MAX_DEPTH];
-
-    for (int y = 0; y < height; ++y)
-    {
-      for (int x = 0; x < width; x++)
-      {
-        for (unsigned int i = 0; i < depth; i++)
-        {
-          luma[i] = srcp[i][x * 2];
-          chroma[i] = srcp[i][x * 2 + 1];
-        }
-
-        dstp[x * 2] = ProcessPixel(luma);
-        dstp[x * 2 + 1] = processchroma ? ProcessPixel(chroma) : chroma[0];
-      }
+    const unsigned int k = field > 0 ? depth + i : i;
 
-      for (unsigned int i = 0; i < depth; i++)
-        srcp[i] = srcp[i] + src[i]->GetPitch();
+    double similarity = CompareFrames(PLANAR_Y, src[0], candidate, samples, field);
 
-      dstp = dstp + dst->GetPitch();
+    if (similarity > best[k])
+    {
+      best[k] = similarity;
+      match[k] = j;
+      src[k] = candidate;
     }
   }
-  else if (info[0].IsRGB24())
+}
+
+// No candidate scored above zero
+void Median::FetchBest(unsigned int i, int n, PVideoFrame src[2 * MAX_DEPTH], const int match[2 * MAX_DEPTH], IScriptEnvironment* env)
+{
+  for (unsigned int k = i; k < (fields ? 2 * depth : depth); k += depth)
   {
-    //////////////////////////////////////////////////////////////////////
-    // BGR
-    //////////////////////////////////////////////////////////////////////
-    unsigned char b[MAX_DEPTH];
-    unsigned char g[MAX_DEPTH];
-    unsigned char r[MAX_DEPTH];
+    if (!src[k])
+      src[k] = clips[i]->GetFrame(n + match[k], env);
+  }
+}
 
-    for (int y = 0; y < height; ++y)
-    {
-      for (int x = 0; x < width; x++)
-      {
-        for (unsigned int i = 0; i < depth; i++)
-        {
-          b[i] = srcp[i][x * 3];
-          g[i] = srcp[i][x * 3 + 1];
-          r[i] = srcp[i][x * 3 + 2];
-        }
-
-        dstp[x * 3] = ProcessPixel(b);
-        dstp[x * 3 + 1] = ProcessPixel(g);
-        dstp[x * 3 + 2] = ProcessPixel(r);
-      }
 
-      for (unsigned int i = 0; i < depth; i++)
-        srcp[i] = srcp[i] + src[i]->GetPitch();
+//////////////////////////////////////////////////////////////////////////////
+// Sync search of all clips with the comparisons on the worker pool
+//
+// Frames are only requested on the calling thread, one offset of all clips
+// at a time and in ascending order per clip as in SyncClip. The workers only
+// score them, every clip writes its own slots, so the results don't depend
+// on scheduling.
+//////////////////////////////////////////////////////////////////////////////
+void Median::SyncParallel(int n, unsigned int first, unsigned int last, PVideoFrame src[2 * MAX_DEPTH], double best[2 * MAX_DEPTH], int match[2 * MAX_DEPTH], IScriptEnvironment* env)
+{
+  int radius = sync;
+  PVideoFrame candidate[MAX_DEPTH];
 
-      dstp = dstp + dst->GetPitch();
-    }
+  for (int j = -radius; j <= radius; j++)
+  {
+    for (unsigned int i = first; i < last; i++)
+      candidate[i] = clips[i]->GetFrame(n + j, env);
+
+    workers->Run(last - first, [&](unsigned int t)
+    {
+      ScoreCandidate(first + t, j, candidate[first + t], src, best, match);
+    });
   }
-  else if (info[0].IsRGB32())
+
+  for (unsigned int i = first; i < last; i++)
+    FetchBest(i, n, src, match, env);
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Compare two frames
+// 
+// returns 100.0 -> exact match, 0.0 -> completely different
+// field 0/1 compares the top/bottom field only, -1 the whole frame
+//////////////////////////////////////////////////////////////////////////////
+double Median::CompareFrames(int plane, const PVideoFrame& a, const PVideoFrame& b, unsigned int points, int field)
+{
+  const unsigned char* aptr = a->GetReadPtr(plane);
+  const unsigned char* bptr = b->GetReadPtr(plane);
+
+  if (field >= 0)
   {
-    //////////////////////////////////////////////////////////////////////
-    // BGRA
-    //////////////////////////////////////////////////////////////////////
-    unsigned char b[MAX_DEPTH];
-    unsigned char g[MAX_DEPTH];
-    unsigned char r[MAX_DEPTH];
-    unsigned char a[MAX_DEPTH];
+    const int a_pitch = a->GetPitch(plane);
+    const int b_pitch = b->GetPitch(plane);
+
+    return compare_rows(aptr + field * a_pitch, 2 * a_pitch, bptr + field * b_pitch, 2 * b_pitch, a->GetRowSize(plane), a->GetHeight(plane) / 2, points);
+  }
+
+  const unsigned int length = a->GetRowSize(plane) * a->GetHeight(plane);
+
+  return compare_samples(aptr, bptr, length, points);
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Check whether all sources are the same picture
+//
+// Frames that share their buffer always are (duplicate clips, repeats of a
+// freeze frame). With identical=true the contents are compared as well,
+// frames that differ mostly do so within the first rows.
+//////////////////////////////////////////////////////////////////////////////
+bool Median::SameFrames(PVideoFrame src[MAX_DEPTH], unsigned int count)
+{
+  static const int planes[] = { PLANAR_Y, PLANAR_U, PLANAR_V };
+  const int planecount = info[0].IsPlanar() && !info[0].IsY() ? 3 : 1;
 
-    for (int y = 0; y < height; ++y)
+  for (unsigned int i = 1; i < count; i++)
+  {
+    for (int p = 0; p < planecount; p++)
     {
-      for (int x = 0; x < width; x++)
+      const int plane = planes[p];
+
+      const unsigned char* a = src[0]->GetReadPtr(plane);
+      const unsigned char* b = src[i]->GetReadPtr(plane);
+      const int a_pitch = src[0]->GetPitch(plane);
+      const int b_pitch = src[i]->GetPitch(plane);
+
+      if (a == b && a_pitch == b_pitch)
+        continue;
+
+      if (!identical)
+        return false;
+
+      const int rowsize = src[0]->GetRowSize(plane);
+      const int height = src[0]->GetHeight(plane);
+
+      for (int y = 0; y < height; y++)
       {
-        for (unsigned int i = 0; i < depth; i++)
-        {
-          b[i] = srcp[i][x * 4];
-          g[i] = srcp[i][x * 4 + 1];
-          r[i] = srcp[i][x * 4 + 2];
-          a[i] = srcp[i][x * 4 + 3];
-        }
-
-        dstp[x * 4] = ProcessPixel(b);
-        dstp[x * 4 + 1] = ProcessPixel(g);
-        dstp[x * 4 + 2] = ProcessPixel(r);
-        dstp[x * 4 + 3] = processchroma ? ProcessPixel(a) : a[0];
+        if (memcmp(a, b, rowsize))
+          return false;
+
+        a += a_pitch;
+        b += b_pitch;
       }
+    }
+  }
 
-      for (unsigned int i = 0; i < depth; i++)
-        srcp[i] = srcp[i] + src[i]->GetPitch();
+  return true;
+}
 
-      dstp = dstp + dst->GetPitch();
-    }
+
+//////////////////////////////////////////////////////////////////////////////
+// Image processing for planar images
+//////////////////////////////////////////////////////////////////////////////
+void Median::ProcessPlanarFrame(const MedianProcessor& active, PVideoFrame src[MAX_DEPTH], const double best[MAX_DEPTH], PVideoFrame& dst, int field, IScriptEnvironment* env)
+{
+  // Argmedian: which clip the luma median came from, per luma sample
+  unsigned char* index = argmedian ? selection.data() : nullptr;
+
+  ProcessPlane(active, PLANAR_Y, modes[0], src, dst, index, field, env);
+
+  // Chroma ranks apply when the frame has all clips, lazy and exclude leave
+  // fewer clips to all planes alike
+  if (chroma && &active == &processor)
+  {
+    PVideoFrame nearest[MAX_DEPTH];
+    ChromaClips(src, best, nearest);
+
+    ProcessPlane(*chroma, PLANAR_U, modes[1], modes[1] == PLANE_PROCESS ? nearest : src, dst, nullptr, field, env);
+    ProcessPlane(*chroma, PLANAR_V, modes[2], modes[2] == PLANE_PROCESS ? nearest : src, dst, nullptr, field, env);
   }
-  else if (info[0].pixel_type == VideoInfo::CS_BGR64)
+  else
   {
-    //////////////////////////////////////////////////////////////////////
-    // BGRA
-    //////////////////////////////////////////////////////////////////////
-    uint16_t b_16bit[MAX_DEPTH];
-    uint16_t g_16bit[MAX_DEPTH];
-    uint16_t r_16bit[MAX_DEPTH];
-    uint16_t a_16bit[MAX_DEPTH];
+    ProcessPlane(active, PLANAR_U, modes[1], src, dst, index, field, env);
+    ProcessPlane(active, PLANAR_V, modes[2], src, dst, index, field, env);
+  }
+}
 
-    for (int y = 0; y < height; ++y)
-    {
-      for (int x = 0; x < width; x++)
-      {
-        for (unsigned int i = 0; i < depth; i++)
-        {
-          b_16bit[i] = srcp[i][x * 8 + 0] | (srcp[i][x * 8 + 1] << 8);
-          g_16bit[i] = srcp[i][x * 8 + 2] | (srcp[i][x * 8 + 3] << 8);
-          r_16bit[i] = srcp[i][x * 8 + 4] | (srcp[i][x * 8 + 5] << 8);
-          a_16bit[i] = srcp[i][x * 8 + 6] | (srcp[i][x * 8 + 7] << 8);
-        }
-
-        uint16_t median_b = ProcessPixel_16bit(b_16bit);
-        uint16_t median_g = ProcessPixel_16bit(g_16bit);
-        uint16_t median_r = ProcessPixel_16bit(r_16bit);
-        uint16_t median_a = ProcessPixel_16bit(a_16bit);
-
-        dstp[x * 8] = static_cast<BYTE>(median_b);
-        dstp[x * 8 + 1] = static_cast<BYTE>(median_b >> 8);
-        dstp[x * 8 + 2] = static_cast<BYTE>(median_g);
-        dstp[x * 8 + 3] = static_cast<BYTE>(median_g >> 8);
-        dstp[x * 8 + 4] = static_cast<BYTE>(median_r);
-        dstp[x * 8 + 5] = static_cast<BYTE>(median_r >> 8);
-        dstp[x * 8 + 6] = static_cast<BYTE>(processchroma ? median_a : a_16bit[0]);
-        dstp[x * 8 + 7] = static_cast<BYTE>(processchroma ? median_a >> 8 : a_16bit[0] >> 8);
-      }
 
-      for (unsigned int i = 0; i < depth; i++)
-        srcp[i] = srcp[i] + src[i]->GetPitch();
+//////////////////////////////////////////////////////////////////////////////
+// Source frames of the chroma planes
+//
+// TemporalMedian: the frames nearest to the center. Otherwise the first clip
+// and the others with the best sync scores, ties (no sync) keep the clip
+// order. Slots of a frame written in place stay empty.
+//////////////////////////////////////////////////////////////////////////////
+void Median::ChromaClips(PVideoFrame src[MAX_DEPTH], const double best[MAX_DEPTH], PVideoFrame nearest[MAX_DEPTH])
+{
+  if (temporal)
+  {
+    const unsigned int radius = (chromaclips - 1) / 2;
 
-      dstp = dstp + dst->GetPitch();
-    }
+    for (unsigned int i = 0; i < chromaclips; i++)
+      nearest[i] = src[low - radius + i];
+
+    return;
   }
+
+  unsigned int order[MAX_DEPTH];
+
+  for (unsigned int i = 0; i < depth; i++)
+    order[i] = i;
+
+  std::stable_sort(order + 1, order + depth, [&](unsigned int a, unsigned int b) { return best[a] > best[b]; });
+
+  for (unsigned int i = 0; i < chromaclips; i++)
+    nearest[i] = src[order[i]];
 }
 
 
 //////////////////////////////////////////////////////////////////////////////
-// Processing of a stack of pixel values
+// Processing of a single plane
+//
+// field 0/1 processes the top/bottom field, as every other row of the same
+// buffers, -1 the whole plane
 //////////////////////////////////////////////////////////////////////////////
-inline uint16_t Median::ProcessPixel_16bit(uint16_t* values) const
+void Median::ProcessPlane(const MedianProcessor& active, int plane, int mode, PVideoFrame src[MAX_DEPTH], PVideoFrame& dst, unsigned char* index, int field, IScriptEnvironment* env)
 {
-  uint16_t output;
+  if (mode == PLANE_SKIP)
+    return;
 
-  unsigned int sum = 0;
+  const int row = field < 0 ? 0 : field;
+  const int step = field < 0 ? 1 : 2;
 
-  if (blend != depth) // If all clips are to be blended, there is no need to sort them
-    std::sort(values, values + depth);
+  // Destination
+  unsigned char* dstp = dst->GetWritePtr(plane) + row * dst->GetPitch(plane);
+  const int dst_pitch = dst->GetPitch(plane) * step;
 
-  for (unsigned int i = low; i < low + blend; i++)
-    sum = sum + values[i];
+  // Dimensions
+  const int rowsize = dst->GetRowSize(plane);
+  const int height = dst->GetHeight(plane) / step;
 
-  output = sum / blend;
+  // Use values from first clip, nothing to do when the output is that frame
+  if (mode == PLANE_COPY)
+  {
+    if (src[0] && src[0]->GetReadPtr(plane) + row * src[0]->GetPitch(plane) != dstp)
+      env->BitBlt(dstp, dst_pitch, src[0]->GetReadPtr(plane) + row * src[0]->GetPitch(plane), src[0]->GetPitch(plane) * step, rowsize, height);
 
-  return output;
+    return;
+  }
+
+  // Source
+  const unsigned char* srcp[MAX_DEPTH];
+  int src_pitch[MAX_DEPTH];
+
+  for (unsigned int i = 0; i < active.GetDepth(); i++)
+  {
+    const PVideoFrame& frame = src[i] ? src[i] : dst; // written in place
+
+    srcp[i] = frame->GetReadPtr(plane) + row * frame->GetPitch(plane);
+    src_pitch[i] = frame->GetPitch(plane) * step;
+  }
+
+  // Process, argmedian chroma is taken from the clips the index names
+  const int width = rowsize / sample_size(format);
+
+  if (!index)
+    active.ProcessPlane(format, srcp, src_pitch, dstp, dst_pitch, width, height);
+  else if (plane == PLANAR_Y)
+    active.ProcessPlaneIndexed(format, srcp, src_pitch, dstp, dst_pitch, index, info[0].width, width, height);
+  else
+    gather_plane(format, srcp, src_pitch, index, info[0].width, info[0].GetPlaneWidthSubsampling(plane), info[0].GetPlaneHeightSubsampling(plane), dstp, dst_pitch, width, height);
 }
 
-inline unsigned char Median::ProcessPixel(unsigned char* values) const
+
+//////////////////////////////////////////////////////////////////////////////
+// Image processing for interleaved images
+//////////////////////////////////////////////////////////////////////////////
+void Median::ProcessInterleavedFrame(const MedianProcessor& active, PVideoFrame src[MAX_DEPTH], PVideoFrame& dst, int field)
 {
-  unsigned char output;
+  const int row = field < 0 ? 0 : field;
+  const int step = field < 0 ? 1 : 2;
+
+  // Source
+  const unsigned char* srcp[MAX_DEPTH];
+  int src_pitch[MAX_DEPTH];
 
-  if (fastprocess) // Can use a fast method
+  for (unsigned int i = 0; i < active.GetDepth(); i++)
   {
-    output = fastmedian(values);
+    const PVideoFrame& frame = src[i] ? src[i] : dst; // written in place
+
+    srcp[i] = frame->GetReadPtr() + row * frame->GetPitch();
+    src_pitch[i] = frame->GetPitch() * step;
   }
-  else // Full processing
+
+  active.ProcessInterleaved(format, srcp, src_pitch, dst->GetWritePtr() + row * dst->GetPitch(), dst->GetPitch() * step, info[0].width, info[0].height / step, processchroma);
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Selection map: per luma sample, the number of the lowest clip holding the
+// median (0 = first clip)
+//
+// The median itself goes to a scratch plane. The core numbers the clips
+// used in this frame, those left out by exclude are skipped in the map.
+//////////////////////////////////////////////////////////////////////////////
+PVideoFrame Median::SelectionMap(const MedianProcessor& active, PVideoFrame src[MAX_DEPTH], const bool excluded[MAX_DEPTH], IScriptEnvironment* env)
+{
+  PVideoFrame dst = has_at_least_v8 ? env->NewVideoFrameP(vi, &src[0]) : env->NewVideoFrame(vi);
+
+  // Source
+  const unsigned char* srcp[MAX_DEPTH];
+  int src_pitch[MAX_DEPTH];
+
+  for (unsigned int i = 0; i < active.GetDepth(); i++)
   {
-    unsigned int sum = 0;
+    srcp[i] = src[i]->GetReadPtr(PLANAR_Y);
+    src_pitch[i] = src[i]->GetPitch(PLANAR_Y);
+  }
+
+  const int width = info[0].width;
+  const int height = info[0].height;
+  const int pitch = width * sample_size(format);
+
+  std::unique_ptr<unsigned char[]> median(new unsigned char[(size_t)pitch * height]);
+
+  unsigned char* dstp = dst->GetWritePtr(PLANAR_Y);
+  const int dst_pitch = dst->GetPitch(PLANAR_Y);
 
-    if (blend != depth) // If all clips are to be blended, there is no need to sort them
-      std::sort(values, values + depth);
+  active.ProcessPlaneIndexed(format, srcp, src_pitch, median.get(), pitch, dstp, dst_pitch, width, height);
 
-    for (unsigned int i = low; i < low + blend; i++)
-      sum = sum + values[i];
+  // Numbers of the clips used
+  unsigned char clip[MAX_DEPTH];
+  unsigned int used = 0;
 
-    output = sum / blend;
+  for (unsigned int i = 0; i < depth; i++)
+  {
+    if (!excluded[i])
+      clip[used++] = (unsigned char)i;
   }
 
-  return output;
+  if (used < depth)
+  {
+    for (int y = 0; y < height; y++)
+    {
+      unsigned char* row = dstp + (size_t)y * dst_pitch;
+
+      for (int x = 0; x < width; x++)
+        row[x] = clip[row[x]];
+    }
+  }
+
+  return dst;
 }
 
 
@@ -2,12 +2,21 @@
 #define MEDIAN_H
 
 #include <vector>
+#include <memory>
 #include <stdint.h>
+#include "mediancore.h"
+#include "synccache.h"
+#include "workers.h"
 
 #define ERROR_PREFIX "Median: "
 
-const unsigned int MAX_DEPTH = 25;
-const unsigned int MAX_OPT = 9;
+// What happens to a plane, the y/u/v convention of other filters
+enum PlaneMode
+{
+  PLANE_SKIP = 1,    // left as it is, uninitialized in a new frame
+  PLANE_COPY = 2,    // copied from the first clip
+  PLANE_PROCESS = 3,
+};
 
 //////////////////////////////////////////////////////////////////////////////
 // Class definition
@@ -15,7 +24,7 @@ const unsigned int MAX_OPT = 9;
 class Median : public GenericVideoFilter
 {
 public:
-  Median(PClip _child, std::vector<PClip> _clips, unsigned int _low, unsigned int _high, bool _temporal, bool _processchroma, unsigned int _sync, unsigned int _samples, bool _debug, IScriptEnvironment* env);
+  Median(PClip _child, std::vector<PClip> _clips, unsigned int _low, unsigned int _high, bool _temporal, const int _modes[3], bool _argmedian, bool _map, unsigned int _chromaclips, unsigned int _chromalow, unsigned int _chromahigh, bool _fields, unsigned int _sync, unsigned int _samples, const char* _synccache, unsigned int _threads, unsigned int _lazy, double _agreement, double _adaptive, double _exclude, bool _tune, bool _identical, bool _debug, IScriptEnvironment* env);
   ~Median();
 
   PVideoFrame __stdcall GetFrame(int n, IScriptEnvironment* env);
@@ -27,24 +36,48 @@ private:
   unsigned int low;
   unsigned int high;
   bool temporal;
-  bool processchroma;
+  int modes[3]; // Y/U/V or G/B/R
+  bool processchroma; // interleaved formats: U/V of YUY2 and alpha
+  bool argmedian; // chroma from the clip with the luma median
+  bool map; // output is the clip number of the luma median, Y8
+  unsigned int chromaclips; // clips of the chroma planes, 0 = same as luma
+  bool fields; // each field synced and processed on its own
   unsigned int sync;
   unsigned int samples;
+  SyncCache synccache;
+  unsigned int threads;
+  std::unique_ptr<WorkerPool> workers; // sync search, threads > 1
+  unsigned int lazy;
+  double agreement;
+  double exclude;
+  bool identical;
   bool debug;
 
+  MedianProcessor processor;
+  std::unique_ptr<MedianProcessor> subset;
+  std::unique_ptr<MedianProcessor> chroma; // ranks of the chroma planes
+  std::vector<std::unique_ptr<MedianProcessor>> reduced; // by depth
+  MedianStats stats;
+  MedianFormat format;
   unsigned int depth;
-  unsigned int blend;
-  bool fastprocess;
   std::vector<VideoInfo> info;
+  std::vector<unsigned char> selection; // argmedian: clip of the luma median per luma sample
 
-  unsigned char (*fastmedian)(unsigned char*);
-
-  double CompareFrames(int plane, PVideoFrame a, PVideoFrame b, unsigned int points);
-  void ProcessPlane(int plane, PVideoFrame src[MAX_DEPTH], PVideoFrame& dst);
-  void ProcessPlanarFrame(PVideoFrame src[MAX_DEPTH], PVideoFrame& dst);
-  void ProcessInterleavedFrame(PVideoFrame src[MAX_DEPTH], PVideoFrame& dst);
-  inline unsigned char ProcessPixel(unsigned char* values) const;
-  inline uint16_t ProcessPixel_16bit(uint16_t* values) const;
+  void SyncClip(unsigned int i, int n, PVideoFrame src[2 * MAX_DEPTH], double best[2 * MAX_DEPTH], int match[2 * MAX_DEPTH], IScriptEnvironment* env);
+  void ScoreCandidate(unsigned int i, int j, const PVideoFrame& candidate, PVideoFrame src[2 * MAX_DEPTH], double best[2 * MAX_DEPTH], int match[2 * MAX_DEPTH]);
+  void FetchBest(unsigned int i, int n, PVideoFrame src[2 * MAX_DEPTH], const int match[2 * MAX_DEPTH], IScriptEnvironment* env);
+  void FetchClips(int n, unsigned int first, unsigned int last, bool cached, PVideoFrame src[2 * MAX_DEPTH], double best[2 * MAX_DEPTH], int match[2 * MAX_DEPTH], IScriptEnvironment* env);
+  bool Consensus(PVideoFrame src[MAX_DEPTH], double best[MAX_DEPTH], unsigned int count);
+  unsigned int ExcludeClips(PVideoFrame src[MAX_DEPTH], bool excluded[MAX_DEPTH]);
+  void LumaStatistics(PVideoFrame frame, double& mean, double& variance);
+  void SyncParallel(int n, unsigned int first, unsigned int last, PVideoFrame src[2 * MAX_DEPTH], double best[2 * MAX_DEPTH], int match[2 * MAX_DEPTH], IScriptEnvironment* env);
+  double CompareFrames(int plane, const PVideoFrame& a, const PVideoFrame& b, unsigned int points, int field);
+  bool SameFrames(PVideoFrame src[MAX_DEPTH], unsigned int count);
+  void ProcessPlane(const MedianProcessor& active, int plane, int mode, PVideoFrame src[MAX_DEPTH], PVideoFrame& dst, unsigned char* index, int field, IScriptEnvironment* env);
+  void ChromaClips(PVideoFrame src[MAX_DEPTH], const double best[MAX_DEPTH], PVideoFrame nearest[MAX_DEPTH]);
+  void ProcessPlanarFrame(const MedianProcessor& active, PVideoFrame src[MAX_DEPTH], const double best[MAX_DEPTH], PVideoFrame& dst, int field, IScriptEnvironment* env);
+  void ProcessInterleavedFrame(const MedianProcessor& active, PVideoFrame src[MAX_DEPTH], PVideoFrame& dst, int field);
+  PVideoFrame SelectionMap(const MedianProcessor& active, PVideoFrame src[MAX_DEPTH], const bool excluded[MAX_DEPTH], IScriptEnvironment* env);
 
   void debugf(const char* fmt, ...);
 
@@ -47,6 +47,10 @@ void print_yuyv(PVideoFrame& dst, unsigned int line, const char* string)
 
     for (int n = 0; n < FONT_SCALE; n++)
     {
+      // Lines below the picture are left out
+      if (row > end)
+        goto done;
+
       unsigned char* pixel = row;
 
       for (int x = 0; x < std::min(text_width, image_width); x++)
@@ -56,9 +60,6 @@ void print_yuyv(PVideoFrame& dst, unsigned int line, const char* string)
       }
 
       row = row + dst->GetPitch();
-
-      if (row > end)
-        goto done;
     }
   }
 
@@ -132,15 +133,16 @@ void print_planar(PVideoFrame& dst, unsigned int line, const char* string)
 
     for (int n = 0; n < FONT_SCALE; n++)
     {
+      // Lines below the picture are left out
+      if (row > end)
+        goto done;
+
       unsigned char* pixel = row;
 
       for (int x = 0; x < std::min(text_width, image_width); x++)
         *pixel++ = text[x]; // Y
 
       row = row + dst->GetPitch();
-
-      if (row > end)
-        goto done;
     }
   }
 
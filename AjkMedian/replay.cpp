@@ -0,0 +1,187 @@
+#include "avisynth.h"
+#include "replay.h"
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
+
+//////////////////////////////////////////////////////////////////////////////
+// Constructor
+//////////////////////////////////////////////////////////////////////////////
+MedianReplay::MedianReplay(PClip _child, std::vector<PClip> _clips, PClip _map, const int _modes[3], const char* _synccache, IScriptEnvironment* env) :
+  GenericVideoFilter(_child), clips(_clips), map(_map), scaled(false)
+{
+  // Check frame property support
+  has_at_least_v8 = true;
+  try { env->CheckVersion(8); }
+  catch (const AvisynthError&) { has_at_least_v8 = false; }
+
+  depth = (unsigned int)clips.size();
+
+  for (int i = 0; i < 3; i++)
+    modes[i] = _modes[i];
+
+  for (unsigned int i = 1; i < depth; i++)
+  {
+    const VideoInfo& other = clips[i]->GetVideoInfo();
+
+    if (!other.IsSameColorspace(vi))
+      env->ThrowError(ERROR_PREFIX "Format of all clips must match.");
+
+    if (other.width != vi.width || other.height != vi.height)
+      env->ThrowError(ERROR_PREFIX "Dimensions of all clips must match.");
+  }
+
+  if (!vi.IsPlanar())
+    env->ThrowError(ERROR_PREFIX "Replay needs a planar format.");
+
+  switch (vi.ComponentSize())
+  {
+  case 1: format = MEDIAN_PLANE_8BIT; break;
+  case 2: format = MEDIAN_PLANE_16BIT; break;
+  default: format = MEDIAN_PLANE_FLOAT; break;
+  }
+
+  mapinfo = map->GetVideoInfo();
+
+  if (!mapinfo.IsY() || mapinfo.ComponentSize() != 1)
+    env->ThrowError(ERROR_PREFIX "Map needs to be a Y8 clip.");
+
+  // Nearest map sample of every plane sample, chroma at its top left luma sample
+  scaled = mapinfo.width != vi.width || mapinfo.height != vi.height;
+
+  static const int planes[] = { PLANAR_Y, PLANAR_U, PLANAR_V };
+
+  for (int p = 0; scaled && p < (vi.IsY() ? 1 : 3); p++)
+  {
+    const int sx = vi.GetPlaneWidthSubsampling(planes[p]);
+    const int sy = vi.GetPlaneHeightSubsampling(planes[p]);
+
+    columns[p].resize(vi.width >> sx);
+    rows[p].resize(vi.height >> sy);
+
+    for (size_t x = 0; x < columns[p].size(); x++)
+      columns[p][x] = (int)(((int64_t)x << sx) * mapinfo.width / vi.width);
+
+    for (size_t y = 0; y < rows[p].size(); y++)
+      rows[p][y] = (int)(((int64_t)y << sy) * mapinfo.height / vi.height);
+  }
+
+  // Offsets of the clips, as the Median that made the map found them
+  if (_synccache && *_synccache)
+  {
+    std::string error;
+
+    if (!synccache.Load(_synccache, depth, mapinfo.num_frames, false, error))
+      env->ThrowError(ERROR_PREFIX "%s", error.c_str());
+  }
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Destructor
+//////////////////////////////////////////////////////////////////////////////
+MedianReplay::~MedianReplay()
+{
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Actual image processing operations
+//////////////////////////////////////////////////////////////////////////////
+PVideoFrame __stdcall MedianReplay::GetFrame(int n, IScriptEnvironment* env)
+{
+  PVideoFrame index = map->GetFrame(n, env);
+
+  // Frames missing from the sync cache are taken as they are
+  int match[MAX_DEPTH] = { 0 };
+  double score[MAX_DEPTH];
+
+  synccache.Lookup(n, match, score);
+
+  // Source
+  PVideoFrame src[MAX_DEPTH];
+
+  for (unsigned int i = 0; i < depth; i++)
+    src[i] = clips[i]->GetFrame(n + match[i], env);
+
+  // Every clip the map names has to be there
+  const unsigned char* indexp = index->GetReadPtr(PLANAR_Y);
+  const int index_pitch = index->GetPitch(PLANAR_Y);
+  unsigned char highest = 0;
+
+  for (int y = 0; y < mapinfo.height; y++)
+    highest = std::max(highest, *std::max_element(indexp + (size_t)y * index_pitch, indexp + (size_t)y * index_pitch + mapinfo.width));
+
+  if (highest >= depth)
+    env->ThrowError(ERROR_PREFIX "Map of frame %d names clip %d, only %u clips given.", n, highest + 1, depth);
+
+  // The first source frame takes the result when nobody else holds it, the
+  // gather reads it through the output then
+  PVideoFrame output;
+
+  if (src[0]->IsWritable())
+  {
+    output = src[0];
+    src[0] = nullptr;
+  }
+  else
+    output = has_at_least_v8 ? env->NewVideoFrameP(vi, &src[0]) : env->NewVideoFrame(vi); // w/ frame property copy source
+
+  ReplayPlane(0, PLANAR_Y, src, index, output, env);
+
+  if (!vi.IsY())
+  {
+    ReplayPlane(1, PLANAR_U, src, index, output, env);
+    ReplayPlane(2, PLANAR_V, src, index, output, env);
+  }
+
+  return output;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Replay of a single plane
+//////////////////////////////////////////////////////////////////////////////
+void MedianReplay::ReplayPlane(int p, int plane, PVideoFrame src[MAX_DEPTH], const PVideoFrame& index, PVideoFrame& dst, IScriptEnvironment* env)
+{
+  if (modes[p] == PLANE_SKIP)
+    return;
+
+  // Destination
+  unsigned char* dstp = dst->GetWritePtr(plane);
+  const int dst_pitch = dst->GetPitch(plane);
+
+  // Dimensions
+  const int rowsize = dst->GetRowSize(plane);
+  const int height = dst->GetHeight(plane);
+
+  // Use values from first clip, nothing to do when the output is that frame
+  if (modes[p] == PLANE_COPY)
+  {
+    if (src[0])
+      env->BitBlt(dstp, dst_pitch, src[0]->GetReadPtr(plane), src[0]->GetPitch(plane), rowsize, height);
+
+    return;
+  }
+
+  // Source
+  const unsigned char* srcp[MAX_DEPTH];
+  int src_pitch[MAX_DEPTH];
+
+  for (unsigned int i = 0; i < depth; i++)
+  {
+    const PVideoFrame& frame = src[i] ? src[i] : dst; // written in place
+
+    srcp[i] = frame->GetReadPtr(plane);
+    src_pitch[i] = frame->GetPitch(plane);
+  }
+
+  const unsigned char* indexp = index->GetReadPtr(PLANAR_Y);
+  const int index_pitch = index->GetPitch(PLANAR_Y);
+  const int width = rowsize / sample_size(format);
+
+  if (scaled)
+    gather_plane_mapped(format, srcp, src_pitch, indexp, index_pitch, columns[p].data(), rows[p].data(), dstp, dst_pitch, width, height);
+  else
+    gather_plane(format, srcp, src_pitch, indexp, index_pitch, vi.GetPlaneWidthSubsampling(plane), vi.GetPlaneHeightSubsampling(plane), dstp, dst_pitch, width, height);
+}
@@ -0,0 +1,43 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <vector>
+#include "median.h"
+
+//////////////////////////////////////////////////////////////////////////////
+// Class definition
+//
+// Every sample taken from the clip a selection map (Median with map=true)
+// names, chroma at the top left luma sample as with argmedian. The clips may
+// differ in size from the map, it is then looked up nearest neighbour.
+//////////////////////////////////////////////////////////////////////////////
+class MedianReplay : public GenericVideoFilter
+{
+public:
+  MedianReplay(PClip _child, std::vector<PClip> _clips, PClip _map, const int _modes[3], const char* _synccache, IScriptEnvironment* env);
+  ~MedianReplay();
+
+  PVideoFrame __stdcall GetFrame(int n, IScriptEnvironment* env);
+
+private:
+  bool has_at_least_v8; // passing frame property support
+
+  std::vector<PClip> clips;
+  PClip map;
+  int modes[3]; // Y/U/V or G/B/R
+  SyncCache synccache;
+
+  MedianFormat format;
+  unsigned int depth;
+  VideoInfo mapinfo;
+
+  // Map sample of each plane sample, when the sizes differ
+  bool scaled;
+  std::vector<int> columns[3];
+  std::vector<int> rows[3];
+
+  void ReplayPlane(int p, int plane, PVideoFrame src[MAX_DEPTH], const PVideoFrame& index, PVideoFrame& dst, IScriptEnvironment* env);
+};
+
+
+#endif // REPLAY_H
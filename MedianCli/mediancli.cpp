@@ -0,0 +1,394 @@
+//////////////////////////////////////////////////////////////////////////////
+// Command line version of the Median filter
+//
+// Reads a number of YUV4MPEG2 or raw planar inputs (files or pipes), runs the
+// same median, blend or temporal median processing as the AviSynth plugin
+// and writes YUV4MPEG2 to stdout or a file, e.g.
+//
+//   mediancli cap1.y4m cap2.y4m cap3.y4m | ffmpeg -i - out.mkv
+//
+// Regular files are memory mapped, so source frames are processed in place.
+// Frames are processed on worker threads and handed to the writer through a
+// bounded queue, which also limits how far ahead the inputs are read.
+//////////////////////////////////////////////////////////////////////////////
+
+#include "mediancore.h"
+#include "y4m.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <climits>
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
+
+static void usage()
+{
+  fprintf(stderr,
+    "Usage: mediancli [options] <input> [<input> ...]\n"
+    "\n"
+    "Options:\n"
+    "  -m <mode>      median (default), blend or temporal\n"
+    "  -low <n>       blend: number of lowest values to drop (default 1)\n"
+    "  -high <n>      blend: number of highest values to drop (default 1)\n"
+    "  -radius <n>    temporal: frames on each side (default 1)\n"
+    "  -nochroma      copy chroma from the first input\n"
+    "  -tune          time the kernels at startup and use the fastest\n"
+    "  -stats         report the blocks copied because all inputs agreed\n"
+    "  -adaptive <t>  median: median of the first 3 inputs where they are within\n"
+    "                 t (8 bit steps) of each other, all inputs elsewhere\n"
+    "  -raw <format>  headerless planar input, WxH[:420|422|444|400][:bits]\n"
+    "  -t <threads>   worker threads (default: number of logical processors)\n"
+    "  -q <frames>    output queue length (default: 2 * threads)\n"
+    "  -o <file>      output file (default: stdout)\n"
+    "  -              as input name: read from stdin\n");
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Processing state shared by the workers and the writer
+//////////////////////////////////////////////////////////////////////////////
+struct Pipeline
+{
+  std::vector<VideoReader>* readers;
+  const MedianProcessor* processor;
+  MedianFormat format;
+  bool temporal;
+  int radius;
+  bool chroma;
+  unsigned int depth;
+
+  std::mutex lock;
+  std::condition_variable changed;
+  int next;     // next frame to be claimed by a worker
+  int written;  // frames written so far
+  int end;      // number of output frames, INT_MAX until known
+  bool failed;
+  std::vector<std::vector<unsigned char>> slots;
+  std::vector<char> ready;
+};
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Compute one output frame
+//////////////////////////////////////////////////////////////////////////////
+static bool process_frame(Pipeline& p, int n, unsigned char* dst)
+{
+  std::vector<VideoReader>& readers = *p.readers;
+  const unsigned char* frame[MAX_DEPTH];
+
+  for (unsigned int i = 0; i < p.depth; i++)
+  {
+    frame[i] = p.temporal ? readers[0].GetFrame(n - p.radius + i) : readers[i].GetFrame(n);
+
+    if (!frame[i])
+      return false;
+  }
+
+  const VideoReader& layout = readers[0];
+  const int sample = layout.GetSampleSize();
+
+  for (int plane = 0; plane < layout.GetPlaneCount(); plane++)
+  {
+    const unsigned char* srcp[MAX_DEPTH];
+    int src_pitch[MAX_DEPTH];
+
+    const unsigned int offset = layout.GetPlaneOffset(plane);
+    const int width = layout.GetPlaneWidth(plane);
+    const int height = layout.GetPlaneHeight(plane);
+    const int pitch = width * sample;
+
+    for (unsigned int i = 0; i < p.depth; i++)
+    {
+      srcp[i] = frame[i] + offset;
+      src_pitch[i] = pitch;
+    }
+
+    if (plane == 0 || p.chroma)
+      p.processor->ProcessPlane(p.format, srcp, src_pitch, dst + offset, pitch, width, height);
+    else
+      copy_plane(srcp[0], pitch, dst + offset, pitch, pitch, height);
+  }
+
+  return true;
+}
+
+static void worker(Pipeline& p)
+{
+  const int queue = (int)p.slots.size();
+
+  for (;;)
+  {
+    int n;
+
+    {
+      std::unique_lock<std::mutex> guard(p.lock);
+
+      // Don't run further ahead of the writer than the queue allows
+      p.changed.wait(guard, [&] { return p.next < p.written + queue || p.next >= p.end; });
+
+      if (p.next >= p.end)
+        return;
+
+      n = p.next++;
+    }
+
+    bool ok = false;
+    bool last = !(*p.readers)[0].HasFrame(n);
+
+    if (!last)
+      ok = process_frame(p, n, p.slots[n % queue].data());
+
+    std::lock_guard<std::mutex> guard(p.lock);
+
+    if (last || !ok)
+    {
+      p.end = std::min(p.end, n);
+      p.failed = p.failed || !last;
+    }
+    else
+      p.ready[n % queue] = 1;
+
+    p.changed.notify_all();
+  }
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Entry point
+//////////////////////////////////////////////////////////////////////////////
+int main(int argc, char** argv)
+{
+  const char* output = nullptr;
+  std::string mode = "median";
+  int low = 1;
+  int high = 1;
+  int radius = 1;
+  bool chroma = true;
+  bool tune = false;
+  bool showstats = false;
+  double adaptive = 0.0;
+  int threads = 0;
+  int queue = 0;
+  bool israw = false;
+  RawFormat raw;
+  std::vector<const char*> inputs;
+
+  for (int i = 1; i < argc; i++)
+  {
+    const char* arg = argv[i];
+    const bool more = i + 1 < argc;
+
+    if (strcmp(arg, "-m") == 0 && more) mode = argv[++i];
+    else if (strcmp(arg, "-low") == 0 && more) low = atoi(argv[++i]);
+    else if (strcmp(arg, "-high") == 0 && more) high = atoi(argv[++i]);
+    else if (strcmp(arg, "-radius") == 0 && more) radius = atoi(argv[++i]);
+    else if (strcmp(arg, "-nochroma") == 0) chroma = false;
+    else if (strcmp(arg, "-tune") == 0) tune = true;
+    else if (strcmp(arg, "-stats") == 0) showstats = true;
+    else if (strcmp(arg, "-adaptive") == 0 && more) adaptive = atof(argv[++i]);
+    else if (strcmp(arg, "-t") == 0 && more) threads = atoi(argv[++i]);
+    else if (strcmp(arg, "-q") == 0 && more) queue = atoi(argv[++i]);
+    else if (strcmp(arg, "-o") == 0 && more) output = argv[++i];
+    else if (strcmp(arg, "-raw") == 0 && more)
+    {
+      if (!parse_raw_format(argv[++i], raw))
+      {
+        fprintf(stderr, "mediancli: invalid raw format %s\n", argv[i]);
+        return 1;
+      }
+
+      israw = true;
+    }
+    else if (arg[0] == '-' && arg[1] != 0)
+    {
+      usage();
+      return 1;
+    }
+    else
+      inputs.push_back(arg);
+  }
+
+  // Same limits as the plugin functions
+  const int n = (int)inputs.size();
+  const bool temporal = mode == "temporal";
+  unsigned int depth;
+
+  if (mode == "median")
+  {
+    if (n < 3 || n > (int)MAX_DEPTH || n % 2 == 0)
+    {
+      fprintf(stderr, "mediancli: need an odd number of inputs between 3 and %u.\n", (MAX_DEPTH - 1) | 1);
+      return 1;
+    }
+
+    depth = n;
+    low = high = (n - 1) / 2;
+  }
+  else if (mode == "blend")
+  {
+    if (n < 3 || n > (int)MAX_DEPTH || low < 0 || high < 0 || low + high >= n)
+    {
+      fprintf(stderr, "mediancli: need 3-%u inputs and low + high below the number of inputs.\n", MAX_DEPTH);
+      return 1;
+    }
+
+    depth = n;
+  }
+  else if (temporal)
+  {
+    if (n != 1 || radius < 1 || radius > (int)(MAX_DEPTH - 1) / 2)
+    {
+      fprintf(stderr, "mediancli: temporal needs one input and a radius between 1 and %u.\n", (MAX_DEPTH - 1) / 2);
+      return 1;
+    }
+
+    depth = 2 * radius + 1;
+    low = high = radius;
+  }
+  else
+  {
+    usage();
+    return 1;
+  }
+
+  if (threads <= 0)
+    threads = (int)std::max(1U, std::thread::hardware_concurrency());
+
+  if (queue <= 0)
+    queue = 2 * threads;
+
+  // Open inputs, streams have to keep every frame still needed by the queue
+  std::vector<VideoReader> readers(n);
+
+  for (int i = 0; i < n; i++)
+  {
+    std::string error;
+
+    if (!readers[i].Open(inputs[i], israw ? &raw : nullptr, error))
+    {
+      fprintf(stderr, "mediancli: %s\n", error.c_str());
+      return 1;
+    }
+
+    readers[i].SetHistory(queue + 2 * (temporal ? radius : 0) + 1);
+
+    const RawFormat& a = readers[i].GetFormat();
+    const RawFormat& b = readers[0].GetFormat();
+
+    if (a.width != b.width || a.height != b.height || a.subsampling_w != b.subsampling_w || a.subsampling_h != b.subsampling_h || a.bits != b.bits)
+    {
+      fprintf(stderr, "mediancli: format and dimensions of all inputs must match.\n");
+      return 1;
+    }
+  }
+
+  // Output
+  FILE* file = stdout;
+
+  if (output && !(file = fopen(output, "wb")))
+  {
+    fprintf(stderr, "mediancli: cannot create %s\n", output);
+    return 1;
+  }
+
+#ifdef _WIN32
+  if (file == stdout)
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+
+  MedianProcessor processor(depth, low, high);
+  MedianStats stats;
+
+  if (showstats)
+    processor.SetStats(&stats);
+
+  if (adaptive > 0.0)
+    processor.SetAdaptive(adaptive * (1 << (readers[0].GetFormat().bits - 8)));
+
+  Pipeline p;
+  p.readers = &readers;
+  p.processor = &processor;
+  p.format = readers[0].GetSampleSize() == 1 ? MEDIAN_PLANE_8BIT : MEDIAN_PLANE_16BIT;
+  p.temporal = temporal;
+  p.radius = radius;
+  p.chroma = chroma;
+  p.depth = depth;
+  p.next = 0;
+  p.written = 0;
+  p.end = INT_MAX;
+  p.failed = false;
+  p.slots.assign(queue, std::vector<unsigned char>(readers[0].GetFrameSize()));
+  p.ready.assign(queue, 0);
+
+  if (tune)
+  {
+    processor.Tune(p.format);
+    fprintf(stderr, "mediancli: kernel %s on %s\n", kernel_name(processor.GetKernel(p.format)), cpu_signature());
+  }
+
+  bool ok = write_y4m_header(file, readers[0].GetHeader());
+
+  std::vector<std::thread> pool;
+
+  for (int t = 0; t < threads; t++)
+    pool.emplace_back(worker, std::ref(p));
+
+  // Write frames in order as they become ready
+  while (ok)
+  {
+    std::unique_lock<std::mutex> guard(p.lock);
+
+    p.changed.wait(guard, [&] { return p.ready[p.written % queue] || p.written >= p.end; });
+
+    if (p.written >= p.end)
+      break;
+
+    guard.unlock();
+
+    ok = write_y4m_frame(file, p.slots[p.written % queue].data(), readers[0].GetFrameSize());
+
+    guard.lock();
+
+    p.ready[p.written % queue] = 0;
+    p.written++;
+
+    if (!ok)
+      p.end = p.written;
+
+    p.changed.notify_all();
+  }
+
+  for (auto& thread : pool)
+    thread.join();
+
+  if (file != stdout)
+    fclose(file);
+  else
+    fflush(file);
+
+  if (p.failed)
+    fprintf(stderr, "mediancli: read error after %d frames\n", p.written);
+  else if (!ok)
+    fprintf(stderr, "mediancli: write error after %d frames\n", p.written);
+  else
+    fprintf(stderr, "mediancli: %d frames\n", p.written);
+
+  if (showstats)
+  {
+    fprintf(stderr, "mediancli: %llu of %llu blocks copied, all inputs agreed\n", (unsigned long long)stats.skipped, (unsigned long long)stats.blocks);
+
+    if (stats.pixels > 0)
+      fprintf(stderr, "mediancli: %.2f%% of adaptive pixels escalated to all inputs\n", 100.0 * stats.escalated / stats.pixels);
+  }
+
+  return p.failed || !ok ? 1 : 0;
+}
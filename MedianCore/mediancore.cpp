@@ -0,0 +1,1377 @@
+#include "mediancore.h"
+#include "opt_med.h"
+#include <algorithm>
+#include <type_traits>
+#include <limits>
+#include <string>
+#include <vector>
+#include <map>
+#include <tuple>
+#include <mutex>
+#include <chrono>
+#include <string.h>
+
+#ifdef INTEL_INTRINSICS
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+//////////////////////////////////////////////////////////////////////////////
+// Constructor
+//////////////////////////////////////////////////////////////////////////////
+MedianProcessor::MedianProcessor(unsigned int _depth, unsigned int _low, unsigned int _high) :
+  depth(_depth), low(_low), high(_high), fastmedian(nullptr), skipequal(true), adaptive(0.0), stats(nullptr), streambytes(last_level_cache())
+{
+  blend = depth - low - high;
+
+  if (blend == 1 && low == high && depth <= MAX_OPT)
+    fastprocess = true;
+  else
+    fastprocess = false;
+
+  switch (depth)
+  {
+  case 3: fastmedian = opt_med3; break;
+  case 5: fastmedian = opt_med5; break;
+  case 7: fastmedian = opt_med7; break;
+  case 9: fastmedian = opt_med9; break;
+  }
+
+  kernel[0] = fastprocess ? MEDIAN_KERNEL_NETWORK : depth >= MIN_RADIX ? MEDIAN_KERNEL_RADIX : MEDIAN_KERNEL_SORT;
+  kernel[1] = depth >= (blend == 1 ? MIN_RADIX_16BIT : MIN_RADIX_16BIT_BLEND) ? MEDIAN_KERNEL_RADIX : MEDIAN_KERNEL_SORT;
+  kernel[2] = blend == 1 && depth >= MIN_SELECT_FLOAT ? MEDIAN_KERNEL_SELECT : MEDIAN_KERNEL_SORT;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Entry points
+//////////////////////////////////////////////////////////////////////////////
+void MedianProcessor::ProcessPlane(MedianFormat format, const unsigned char* const* srcp, const int* src_pitch, unsigned char* dstp, int dst_pitch, int width, int height) const
+{
+  ProcessStrips(format, srcp, src_pitch, dstp, dst_pitch, width, height, true, nullptr, 0);
+}
+
+void MedianProcessor::ProcessPlaneIndexed(MedianFormat format, const unsigned char* const* srcp, const int* src_pitch, unsigned char* dstp, int dst_pitch, unsigned char* indexp, int index_pitch, int width, int height) const
+{
+  ProcessStrips(format, srcp, src_pitch, dstp, dst_pitch, width, height, true, indexp, index_pitch);
+}
+
+void MedianProcessor::ProcessInterleaved(MedianFormat format, const unsigned char* const* srcp, const int* src_pitch, unsigned char* dstp, int dst_pitch, int width, int height, bool processchroma) const
+{
+  ProcessStrips(format, srcp, src_pitch, dstp, dst_pitch, width, height, processchroma, nullptr, 0);
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Strips: a deep stack reads more row streams than the hardware prefetchers
+// follow, so rows are cut into strips of whole agreement blocks whose sources
+// fit STRIP_BYTES together, and the next strip of every source (the start of
+// the next row after the last one) is prefetched while the current one is
+// processed. When the plane is larger than streambytes the output of a strip
+// goes to a scratch row first and is written with non-temporal stores, so it
+// doesn't evict the sources on its way to memory. Indexed medians go through
+// the scratch row as well, the sources are compared with the median there.
+//////////////////////////////////////////////////////////////////////////////
+static int pixel_size(MedianFormat format)
+{
+  switch (format)
+  {
+  case MEDIAN_YUY2: return 2;
+  case MEDIAN_BGR24: return 3;
+  case MEDIAN_BGR32: return 4;
+  case MEDIAN_BGR64: return 8;
+  default: return sample_size(format);
+  }
+}
+
+static void prefetch_strip(const unsigned char* const* srcp, unsigned int depth, int offset, int bytes)
+{
+#ifdef INTEL_INTRINSICS
+  for (unsigned int i = 0; i < depth; i++)
+  {
+    const char* p = reinterpret_cast<const char*>(srcp[i] + offset);
+
+    for (int x = 0; x < bytes; x += 64)
+      _mm_prefetch(p + x, _MM_HINT_T0);
+  }
+#else
+  (void)srcp; (void)depth; (void)offset; (void)bytes;
+#endif
+}
+
+static void stream_row(unsigned char* dstp, const unsigned char* srcp, int bytes)
+{
+#ifdef INTEL_INTRINSICS
+  const int head = std::min(bytes, (int)((16 - ((uintptr_t)dstp & 15)) & 15));
+  int x = head;
+
+  memcpy(dstp, srcp, head);
+
+  for (; x + 16 <= bytes; x += 16)
+    _mm_stream_si128(reinterpret_cast<__m128i*>(dstp + x), _mm_loadu_si128(reinterpret_cast<const __m128i*>(srcp + x)));
+
+  memcpy(dstp + x, srcp + x, bytes - x);
+#else
+  memcpy(dstp, srcp, bytes);
+#endif
+}
+
+// Lowest source index holding the median of each sample, going down from the
+// last source keeps the loops branch free
+template<typename pixel_t>
+static void median_index(const unsigned char* const* srcp, unsigned int depth, const unsigned char* median, int count, unsigned char* indexp)
+{
+  const pixel_t* m = reinterpret_cast<const pixel_t*>(median);
+
+  memset(indexp, 0, count);
+
+  for (unsigned int k = depth; k-- > 0;)
+  {
+    const pixel_t* s = reinterpret_cast<const pixel_t*>(srcp[k]);
+
+    for (int x = 0; x < count; x++)
+      indexp[x] = s[x] == m[x] ? (unsigned char)k : indexp[x];
+  }
+}
+
+void MedianProcessor::ProcessStrips(MedianFormat format, const unsigned char* const* _srcp, const int* src_pitch, unsigned char* dstp, int dst_pitch, int width, int height, bool processchroma, unsigned char* indexp, int index_pitch) const
+{
+  const int pixel = pixel_size(format);
+  const int strip = std::max(SKIP_BLOCK, STRIP_BYTES / (int)(depth * pixel) / SKIP_BLOCK * SKIP_BLOCK);
+  const bool stream = (uint64_t)width * pixel * height * (depth + 1) > (uint64_t)streambytes;
+
+  // Source
+  const unsigned char* srcp[MAX_DEPTH];
+  const unsigned char* stripp[MAX_DEPTH];
+
+  for (unsigned int i = 0; i < depth; i++)
+    srcp[i] = _srcp[i];
+
+  alignas(64) unsigned char scratch[SKIP_BLOCK * 8 > STRIP_BYTES ? SKIP_BLOCK * 8 : STRIP_BYTES];
+
+  prefetch_strip(srcp, depth, 0, std::min(strip, width) * pixel);
+
+  for (int y = 0; y < height; y++)
+  {
+    for (int x = 0; x < width; x += strip)
+    {
+      const int count = std::min(strip, width - x);
+
+      if (x + count < width)
+        prefetch_strip(srcp, depth, (x + count) * pixel, std::min(strip, width - x - count) * pixel);
+      else if (y + 1 < height)
+      {
+        for (unsigned int i = 0; i < depth; i++)
+          stripp[i] = srcp[i] + src_pitch[i];
+
+        prefetch_strip(stripp, depth, 0, std::min(strip, width) * pixel);
+      }
+
+      for (unsigned int i = 0; i < depth; i++)
+        stripp[i] = srcp[i] + x * pixel;
+
+      if (stream || indexp)
+      {
+        // The sources are compared with the median before the output,
+        // which may be one of them, is written
+        ProcessStrip(format, stripp, src_pitch, scratch, 0, count, 1, processchroma);
+
+        switch (indexp ? format : MEDIAN_YUY2)
+        {
+        case MEDIAN_PLANE_8BIT: median_index<unsigned char>(stripp, depth, scratch, count, indexp + x); break;
+        case MEDIAN_PLANE_16BIT: median_index<uint16_t>(stripp, depth, scratch, count, indexp + x); break;
+        case MEDIAN_PLANE_FLOAT: median_index<float>(stripp, depth, scratch, count, indexp + x); break;
+        default: break;
+        }
+
+        if (stream)
+          stream_row(dstp + x * pixel, scratch, count * pixel);
+        else
+          memcpy(dstp + x * pixel, scratch, count * pixel);
+      }
+      else
+        ProcessStrip(format, stripp, src_pitch, dstp + x * pixel, dst_pitch, count, 1, processchroma);
+    }
+
+    for (unsigned int i = 0; i < depth; i++)
+      srcp[i] += src_pitch[i];
+
+    dstp += dst_pitch;
+    indexp += indexp ? index_pitch : 0;
+  }
+
+#ifdef INTEL_INTRINSICS
+  if (stream)
+    _mm_sfence();
+#endif
+}
+
+// Blocks where all sources agree are copied when SkipsEqual, adaptive medians
+// go through the block loop as well
+void MedianProcessor::ProcessStrip(MedianFormat format, const unsigned char* const* srcp, const int* src_pitch, unsigned char* dstp, int dst_pitch, int width, int height, bool processchroma) const
+{
+  const bool planar = format == MEDIAN_PLANE_8BIT || format == MEDIAN_PLANE_16BIT || format == MEDIAN_PLANE_FLOAT;
+
+  if (SkipsEqual(format) || IsAdaptive(format))
+    ProcessBlocks(format, srcp, src_pitch, dstp, dst_pitch, width, height, processchroma);
+  else if (planar)
+    ProcessPlaneRegion(format, srcp, src_pitch, dstp, dst_pitch, width, height);
+  else
+    ProcessInterleavedRegion(format, srcp, src_pitch, dstp, dst_pitch, width, height, processchroma);
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Agreement check: rows are split into blocks of SKIP_BLOCK pixels, a block
+// that is byte for byte the same in every source is copied from the first
+// one. Every kernel returns that common value there, integer blends included
+// (float blends are left out, see SkipsEqual). Runs of differing blocks go to
+// the kernels in one piece.
+//////////////////////////////////////////////////////////////////////////////
+bool MedianProcessor::IsAdaptive(MedianFormat format) const
+{
+  const bool planar = format == MEDIAN_PLANE_8BIT || format == MEDIAN_PLANE_16BIT || format == MEDIAN_PLANE_FLOAT;
+
+  return adaptive > 0.0 && planar && blend == 1 && depth >= 5;
+}
+
+// Compares 16 bytes at a time (8 without SSE2) against the first source,
+// stops at the first chunk that differs
+static bool sources_agree(const unsigned char* const* srcp, unsigned int depth, int offset, int bytes)
+{
+  const unsigned char* first = srcp[0] + offset;
+
+  for (unsigned int i = 1; i < depth; i++)
+  {
+    const unsigned char* other = srcp[i] + offset;
+    int x = 0;
+
+#ifdef INTEL_INTRINSICS
+    for (; x + 16 <= bytes; x += 16)
+    {
+      const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(first + x));
+      const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(other + x));
+
+      if (_mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) != 0xFFFF)
+        return false;
+    }
+#endif
+
+    for (; x + 8 <= bytes; x += 8)
+    {
+      uint64_t a, b;
+      memcpy(&a, first + x, 8);
+      memcpy(&b, other + x, 8);
+
+      if (a != b)
+        return false;
+    }
+
+    for (; x < bytes; x++)
+    {
+      if (first[x] != other[x])
+        return false;
+    }
+  }
+
+  return true;
+}
+
+void MedianProcessor::ProcessBlocks(MedianFormat format, const unsigned char* const* _srcp, const int* src_pitch, unsigned char* dstp, int dst_pitch, int width, int height, bool processchroma) const
+{
+  const int pixel = pixel_size(format);
+  const bool planar = format == MEDIAN_PLANE_8BIT || format == MEDIAN_PLANE_16BIT || format == MEDIAN_PLANE_FLOAT;
+  const bool adapt = IsAdaptive(format);
+  const bool skip = SkipsEqual(format);
+
+  // Source
+  const unsigned char* srcp[MAX_DEPTH];
+  const unsigned char* runp[MAX_DEPTH];
+
+  for (unsigned int i = 0; i < depth; i++)
+    srcp[i] = _srcp[i];
+
+  uint64_t blocks = 0;
+  uint64_t skipped = 0;
+  uint64_t adapted = 0;
+  uint64_t escalated = 0;
+
+  // Hands pixels [begin, end) of the current row to the kernels
+  auto process = [&](int begin, int end)
+  {
+    if (end <= begin)
+      return;
+
+    for (unsigned int i = 0; i < depth; i++)
+      runp[i] = srcp[i] + begin * pixel;
+
+    if (planar)
+      ProcessPlaneRegion(format, runp, src_pitch, dstp + begin * pixel, dst_pitch, end - begin, 1);
+    else
+      ProcessInterleavedRegion(format, runp, src_pitch, dstp + begin * pixel, dst_pitch, end - begin, 1, processchroma);
+  };
+
+  for (int y = 0; y < height; y++)
+  {
+    int run = 0; // first pixel of the pending run of differing blocks
+
+    for (int x = 0; x < width; x += SKIP_BLOCK)
+    {
+      const int count = std::min(SKIP_BLOCK, width - x);
+
+      if (skip && sources_agree(srcp, depth, x * pixel, count * pixel))
+      {
+        process(run, x);
+        memmove(dstp + x * pixel, srcp[0] + x * pixel, count * pixel); // in place: the same bytes
+
+        run = x + count;
+        skipped++;
+      }
+      else if (adapt)
+      {
+        process(run, x);
+
+        switch (format)
+        {
+        case MEDIAN_PLANE_8BIT: escalated += AdaptiveBlock<unsigned char>(format, srcp, src_pitch, x, count, dstp); break;
+        case MEDIAN_PLANE_16BIT: escalated += AdaptiveBlock<uint16_t>(format, srcp, src_pitch, x, count, dstp); break;
+        default: escalated += AdaptiveBlock<float>(format, srcp, src_pitch, x, count, dstp); break;
+        }
+
+        run = x + count;
+        adapted += count;
+      }
+    }
+
+    process(run, width);
+
+    blocks += (width + SKIP_BLOCK - 1) / SKIP_BLOCK;
+
+    for (unsigned int i = 0; i < depth; i++)
+      srcp[i] += src_pitch[i];
+
+    dstp += dst_pitch;
+  }
+
+  if (stats)
+  {
+    stats->blocks += blocks;
+    stats->skipped += skipped;
+
+    if (adapt)
+    {
+      stats->pixels += adapted;
+      stats->escalated += escalated;
+    }
+  }
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Adaptive median: median of 3 with escalation
+//
+// The median and spread of the first three sources are computed for the
+// whole block, lanes with a spread above the threshold get the full stack
+// instead. The radix kernel gets them packed into a block of their own.
+// Other kernels do few of them one by one, for many they run over the whole
+// block and only the escalated lanes are taken.
+//////////////////////////////////////////////////////////////////////////////
+template<typename pixel_t>
+int MedianProcessor::AdaptiveBlock(MedianFormat format, const unsigned char* const* srcp, const int* src_pitch, int x, int count, unsigned char* dstp) const
+{
+  const pixel_t* a = reinterpret_cast<const pixel_t*>(srcp[0]) + x;
+  const pixel_t* b = reinterpret_cast<const pixel_t*>(srcp[1]) + x;
+  const pixel_t* c = reinterpret_cast<const pixel_t*>(srcp[2]) + x;
+  pixel_t* out = reinterpret_cast<pixel_t*>(dstp) + x;
+
+  const pixel_t limit = std::is_same<pixel_t, float>::value ? (pixel_t)adaptive : (pixel_t)std::min(adaptive, (double)std::numeric_limits<pixel_t>::max());
+
+  // The result is put together here, the output may be one of the sources
+  pixel_t dst[SKIP_BLOCK];
+  unsigned char escalate[SKIP_BLOCK];
+  int escalated = 0;
+
+  for (int i = 0; i < count; i++)
+  {
+    const pixel_t lo = std::min(a[i], b[i]);
+    const pixel_t hi = std::max(a[i], b[i]);
+    const bool wide = std::max(hi, c[i]) - std::min(lo, c[i]) > limit;
+
+    dst[i] = std::max(lo, std::min(hi, c[i]));
+    escalate[i] = wide;
+    escalated += wide;
+  }
+
+  if (escalated == 0)
+  {
+    memcpy(out, dst, count * sizeof(pixel_t));
+    return 0;
+  }
+
+  // Radix: the escalated lanes packed into a block of their own
+  if constexpr (!std::is_same<pixel_t, float>::value)
+  {
+    if (kernel[sample_type(format)] == MEDIAN_KERNEL_RADIX)
+    {
+      pixel_t values[MAX_DEPTH * SKIP_BLOCK];
+      pixel_t output[SKIP_BLOCK];
+      int lanes[SKIP_BLOCK];
+      int packed = 0;
+
+      for (int i = 0; i < count; i++)
+      {
+        if (escalate[i])
+          lanes[packed++] = i;
+      }
+
+      // Every row is filled up to the block width with its last lane, so
+      // all values RadixBlock may read are written
+      for (unsigned int k = 0; k < depth; k++)
+      {
+        const pixel_t* row = reinterpret_cast<const pixel_t*>(srcp[k]) + x;
+
+        for (int j = 0; j < SKIP_BLOCK; j++)
+          values[k * SKIP_BLOCK + j] = row[lanes[std::min(j, packed - 1)]];
+      }
+
+      RadixBlock(values, SKIP_BLOCK, packed, output);
+
+      for (int j = 0; j < packed; j++)
+        dst[lanes[j]] = output[j];
+
+      memcpy(out, dst, count * sizeof(pixel_t));
+      return escalated;
+    }
+  }
+
+  if (escalated * 4 > count)
+  {
+    const unsigned char* blockp[MAX_DEPTH];
+
+    for (unsigned int i = 0; i < depth; i++)
+      blockp[i] = srcp[i] + x * sizeof(pixel_t);
+
+    pixel_t full[SKIP_BLOCK];
+
+    ProcessPlaneRegion(format, blockp, src_pitch, reinterpret_cast<unsigned char*>(full), 0, count, 1);
+
+    for (int i = 0; i < count; i++)
+      dst[i] = escalate[i] ? full[i] : dst[i];
+
+    memcpy(out, dst, count * sizeof(pixel_t));
+    return escalated;
+  }
+
+  for (int i = 0; i < count; i++)
+  {
+    if (!escalate[i])
+      continue;
+
+    pixel_t values[MAX_DEPTH];
+
+    for (unsigned int k = 0; k < depth; k++)
+      values[k] = reinterpret_cast<const pixel_t*>(srcp[k])[x + i];
+
+    if constexpr (std::is_same<pixel_t, unsigned char>::value)
+      dst[i] = ProcessPixel(values);
+    else if constexpr (std::is_same<pixel_t, uint16_t>::value)
+      dst[i] = ProcessPixel_16bit(values);
+    else
+      dst[i] = ProcessPixel_float(values);
+  }
+
+  memcpy(out, dst, count * sizeof(pixel_t));
+  return escalated;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Processing of a single plane
+//////////////////////////////////////////////////////////////////////////////
+void MedianProcessor::ProcessPlaneRegion(MedianFormat format, const unsigned char* const* srcp, const int* src_pitch, unsigned char* dstp, int dst_pitch, int width, int height) const
+{
+  switch (format)
+  {
+  case MEDIAN_PLANE_8BIT:
+    if (kernel[0] == MEDIAN_KERNEL_RADIX)
+      ProcessPlane_radix<unsigned char>(srcp, src_pitch, dstp, dst_pitch, width, height);
+    else
+      ProcessPlane_t<unsigned char>(srcp, src_pitch, dstp, dst_pitch, width, height);
+    break;
+  case MEDIAN_PLANE_16BIT:
+    if (kernel[1] == MEDIAN_KERNEL_RADIX)
+      ProcessPlane_radix<uint16_t>(srcp, src_pitch, dstp, dst_pitch, width, height);
+    else
+      ProcessPlane_t<uint16_t>(srcp, src_pitch, dstp, dst_pitch, width, height);
+    break;
+  case MEDIAN_PLANE_FLOAT: ProcessPlane_t<float>(srcp, src_pitch, dstp, dst_pitch, width, height); break;
+  default: break;
+  }
+}
+
+template<typename pixel_t>
+void MedianProcessor::ProcessPlane_t(const unsigned char* const* _srcp, const int* src_pitch, unsigned char* dstp, int dst_pitch, int width, int height) const
+{
+  // Source
+  const unsigned char* srcp[MAX_DEPTH];
+
+  for (unsigned int i = 0; i < depth; i++)
+    srcp[i] = _srcp[i];
+
+  // Process
+  for (int y = 0; y < height; ++y)
+  {
+    for (int x = 0; x < width; ++x)
+    {
+      pixel_t values[MAX_DEPTH];
+
+      for (unsigned int i = 0; i < depth; i++)
+        values[i] = reinterpret_cast<const pixel_t*>(srcp[i])[x];
+
+      if constexpr (std::is_same<pixel_t, unsigned char>::value)
+        reinterpret_cast<pixel_t*>(dstp)[x] = ProcessPixel(values);
+      else if constexpr (std::is_same<pixel_t, uint16_t>::value)
+        reinterpret_cast<pixel_t*>(dstp)[x] = ProcessPixel_16bit(values);
+      else
+        reinterpret_cast<pixel_t*>(dstp)[x] = ProcessPixel_float(values);
+    }
+
+    for (unsigned int i = 0; i < depth; i++)
+      srcp[i] = srcp[i] + src_pitch[i];
+
+    dstp = dstp + dst_pitch;
+  }
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Radix selection for 8 and 16 bit samples
+//
+// The k-th smallest value is found one bit at a time from the top: count
+// the candidates with a zero in the current bit, if there are more than k
+// the bit is zero, otherwise it is one and the zeros are skipped. One round
+// of counting per bit regardless of depth, done for a block of pixels at
+// once so the counting loops vectorize. Bits that are zero in every sample
+// of the block are skipped, so 10 bit video takes 10 rounds, not 16.
+//
+// Blends don't select every rank in the window. The window sum is the total
+// minus the sum of the lowest low and the highest high values, and those
+// follow from the values at ranks low - 1 and depth - high.
+//////////////////////////////////////////////////////////////////////////////
+static const int RADIX_BLOCK = 64;
+
+static_assert(SKIP_BLOCK <= RADIX_BLOCK, "adaptive medians hand blocks of escalated lanes to the radix kernel");
+
+static_assert(MAX_DEPTH <= 255, "radix counters are bytes for 8 bit samples");
+static_assert(MAX_DEPTH * 255 <= 65535, "8 bit radix sums are 16 bit");
+
+// values holds depth rows of count samples, stride apart. Counters have the
+// sample type, MAX_DEPTH fits in a byte.
+template<typename pixel_t>
+static void radix_select(const pixel_t* values, int stride, int count, unsigned int depth, unsigned int rank, int top, pixel_t* result)
+{
+  pixel_t prefix[RADIX_BLOCK];
+  pixel_t k[RADIX_BLOCK];
+
+  for (int x = 0; x < count; x++)
+  {
+    prefix[x] = 0;
+    k[x] = (pixel_t)rank;
+  }
+
+  for (int bit = top; bit >= 0; bit--)
+  {
+    // Candidates match the prefix in the bits above, the prefix has a zero
+    // in the current bit, so one comparison finds the candidates with a zero
+    const pixel_t mask = (pixel_t)(~0u << bit);
+    pixel_t zeros[RADIX_BLOCK] = { 0 };
+
+    for (unsigned int i = 0; i < depth; i++)
+    {
+      const pixel_t* row = values + i * stride;
+
+      for (int x = 0; x < count; x++)
+        zeros[x] += (row[x] & mask) == prefix[x];
+    }
+
+    for (int x = 0; x < count; x++)
+    {
+      if (k[x] >= zeros[x])
+      {
+        k[x] -= zeros[x];
+        prefix[x] |= (pixel_t)(1u << bit);
+      }
+    }
+  }
+
+  memcpy(result, prefix, count * sizeof(pixel_t));
+}
+
+// Sum of the values below (sign 1) or above (sign -1) limit and how many
+// there are
+template<typename pixel_t, typename sum_t>
+static void radix_outside(const pixel_t* values, int stride, int count, unsigned int depth, const pixel_t* limit, bool below, sum_t* sum, pixel_t* number)
+{
+  for (int x = 0; x < count; x++)
+  {
+    sum[x] = 0;
+    number[x] = 0;
+  }
+
+  for (unsigned int i = 0; i < depth; i++)
+  {
+    const pixel_t* row = values + i * stride;
+
+    for (int x = 0; x < count; x++)
+    {
+      const pixel_t outside = below ? row[x] < limit[x] : row[x] > limit[x];
+      sum[x] += row[x] & (pixel_t)-outside;
+      number[x] += outside;
+    }
+  }
+}
+
+template<typename pixel_t>
+void MedianProcessor::RadixBlock(const pixel_t* values, int stride, int count, pixel_t* dstp) const
+{
+  // 8 bit samples are summed in 16 bits, MAX_DEPTH values of 255 fit
+  typedef typename std::conditional<sizeof(pixel_t) == 1, uint16_t, uint32_t>::type sum_t;
+
+  // Highest bit set anywhere in the block
+  pixel_t bits[RADIX_BLOCK] = { 0 };
+
+  for (unsigned int i = 0; i < depth; i++)
+  {
+    const pixel_t* row = values + i * stride;
+
+    for (int x = 0; x < count; x++)
+      bits[x] |= row[x];
+  }
+
+  unsigned int all = 0;
+
+  for (int x = 0; x < count; x++)
+    all |= bits[x];
+
+  int top = -1;
+
+  while (all >> (top + 1))
+    top++;
+
+  if (blend == 1)
+  {
+    radix_select(values, stride, count, depth, low, top, dstp);
+    return;
+  }
+
+  sum_t sum[RADIX_BLOCK] = { 0 };
+
+  for (unsigned int i = 0; i < depth; i++)
+  {
+    const pixel_t* row = values + i * stride;
+
+    for (int x = 0; x < count; x++)
+      sum[x] += row[x];
+  }
+
+  pixel_t limit[RADIX_BLOCK];
+  sum_t outside[RADIX_BLOCK];
+  pixel_t number[RADIX_BLOCK];
+
+  // Lowest low values: everything below the value at rank low - 1, plus
+  // as many copies of that value as are still missing
+  if (low > 0)
+  {
+    radix_select(values, stride, count, depth, low - 1, top, limit);
+    radix_outside(values, stride, count, depth, limit, true, outside, number);
+
+    for (int x = 0; x < count; x++)
+      sum[x] -= (sum_t)(outside[x] + (low - number[x]) * limit[x]);
+  }
+
+  // Highest high values, the same from the top
+  if (high > 0)
+  {
+    radix_select(values, stride, count, depth, depth - high, top, limit);
+    radix_outside(values, stride, count, depth, limit, false, outside, number);
+
+    for (int x = 0; x < count; x++)
+      sum[x] -= (sum_t)(outside[x] + (high - number[x]) * limit[x]);
+  }
+
+  for (int x = 0; x < count; x++)
+    dstp[x] = (pixel_t)(sum[x] / blend);
+}
+
+template<typename pixel_t>
+void MedianProcessor::ProcessPlane_radix(const unsigned char* const* _srcp, const int* src_pitch, unsigned char* _dstp, int dst_pitch, int width, int height) const
+{
+  // Source
+  const unsigned char* srcp[MAX_DEPTH];
+
+  for (unsigned int i = 0; i < depth; i++)
+    srcp[i] = _srcp[i];
+
+  // Process a block of pixels of all sources at a time
+  pixel_t values[MAX_DEPTH * RADIX_BLOCK];
+
+  for (int y = 0; y < height; ++y)
+  {
+    pixel_t* dstp = reinterpret_cast<pixel_t*>(_dstp);
+
+    for (int x = 0; x < width; x += RADIX_BLOCK)
+    {
+      const int count = std::min(RADIX_BLOCK, width - x);
+
+      for (unsigned int i = 0; i < depth; i++)
+        memcpy(values + i * RADIX_BLOCK, reinterpret_cast<const pixel_t*>(srcp[i]) + x, count * sizeof(pixel_t));
+
+      RadixBlock(values, RADIX_BLOCK, count, dstp + x);
+    }
+
+    for (unsigned int i = 0; i < depth; i++)
+      srcp[i] = srcp[i] + src_pitch[i];
+
+    _dstp = _dstp + dst_pitch;
+  }
+}
+
+// BGR64 a block of pixels at a time, channel by channel
+void MedianProcessor::ProcessBGR64_radix(const unsigned char* const* _srcp, const int* src_pitch, unsigned char* dstp, int dst_pitch, int width, int height, bool processchroma) const
+{
+  // Source
+  const unsigned char* srcp[MAX_DEPTH];
+
+  for (unsigned int i = 0; i < depth; i++)
+    srcp[i] = _srcp[i];
+
+  uint16_t values[MAX_DEPTH * RADIX_BLOCK];
+  uint16_t output[RADIX_BLOCK];
+
+  for (int y = 0; y < height; ++y)
+  {
+    for (int x = 0; x < width; x += RADIX_BLOCK)
+    {
+      const int count = std::min(RADIX_BLOCK, width - x);
+
+      for (int c = 0; c < 4; c++)
+      {
+        for (unsigned int i = 0; i < depth; i++)
+        {
+          const unsigned char* pixel = srcp[i] + x * 8 + c * 2;
+
+          for (int n = 0; n < count; n++)
+            values[i * RADIX_BLOCK + n] = pixel[n * 8] | (pixel[n * 8 + 1] << 8);
+        }
+
+        if (c == 3 && !processchroma) // Alpha of the first source
+          memcpy(output, values, count * sizeof(uint16_t));
+        else
+          RadixBlock(values, RADIX_BLOCK, count, output);
+
+        for (int n = 0; n < count; n++)
+        {
+          dstp[(x + n) * 8 + c * 2] = static_cast<unsigned char>(output[n]);
+          dstp[(x + n) * 8 + c * 2 + 1] = static_cast<unsigned char>(output[n] >> 8);
+        }
+      }
+    }
+
+    for (unsigned int i = 0; i < depth; i++)
+      srcp[i] = srcp[i] + src_pitch[i];
+
+    dstp = dstp + dst_pitch;
+  }
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Image processing for interleaved images
+//////////////////////////////////////////////////////////////////////////////
+void MedianProcessor::ProcessInterleavedRegion(MedianFormat format, const unsigned char* const* _srcp, const int* src_pitch, unsigned char* dstp, int dst_pitch, int width, int height, bool processchroma) const
+{
+  // Source
+  const unsigned char* srcp[MAX_DEPTH];
+
+  for (unsigned int i = 0; i < depth; i++)
+    srcp[i] = _srcp[i];
+
+  // Process
+  if (format == MEDIAN_YUY2)
+  {
+    //////////////////////////////////////////////////////////////////////
+    // YUYV
+    //////////////////////////////////////////////////////////////////////
+    unsigned char luma[MAX_DEPTH];
+    unsigned char chroma[MAX_DEPTH];
+
+    for (int y = 0; y < height; ++y)
+    {
+      for (int x = 0; x < width; x++)
+      {
+        for (unsigned int i = 0; i < depth; i++)
+        {
+          luma[i] = srcp[i][x * 2];
+          chroma[i] = srcp[i][x * 2 + 1];
+        }
+
+        dstp[x * 2] = ProcessPixel(luma);
+        dstp[x * 2 + 1] = processchroma ? ProcessPixel(chroma) : chroma[0];
+      }
+
+      for (unsigned int i = 0; i < depth; i++)
+        srcp[i] = srcp[i] + src_pitch[i];
+
+      dstp = dstp + dst_pitch;
+    }
+  }
+  else if (format == MEDIAN_BGR24)
+  {
+    //////////////////////////////////////////////////////////////////////
+    // BGR
+    //////////////////////////////////////////////////////////////////////
+    unsigned char b[MAX_DEPTH];
+    unsigned char g[MAX_DEPTH];
+    unsigned char r[MAX_DEPTH];
+
+    for (int y = 0; y < height; ++y)
+    {
+      for (int x = 0; x < width; x++)
+      {
+        for (unsigned int i = 0; i < depth; i++)
+        {
+          b[i] = srcp[i][x * 3];
+          g[i] = srcp[i][x * 3 + 1];
+          r[i] = srcp[i][x * 3 + 2];
+        }
+
+        dstp[x * 3] = ProcessPixel(b);
+        dstp[x * 3 + 1] = ProcessPixel(g);
+        dstp[x * 3 + 2] = ProcessPixel(r);
+      }
+
+      for (unsigned int i = 0; i < depth; i++)
+        srcp[i] = srcp[i] + src_pitch[i];
+
+      dstp = dstp + dst_pitch;
+    }
+  }
+  else if (format == MEDIAN_BGR32)
+  {
+    //////////////////////////////////////////////////////////////////////
+    // BGRA
+    //////////////////////////////////////////////////////////////////////
+    unsigned char b[MAX_DEPTH];
+    unsigned char g[MAX_DEPTH];
+    unsigned char r[MAX_DEPTH];
+    unsigned char a[MAX_DEPTH];
+
+    for (int y = 0; y < height; ++y)
+    {
+      for (int x = 0; x < width; x++)
+      {
+        for (unsigned int i = 0; i < depth; i++)
+        {
+          b[i] = srcp[i][x * 4];
+          g[i] = srcp[i][x * 4 + 1];
+          r[i] = srcp[i][x * 4 + 2];
+          a[i] = srcp[i][x * 4 + 3];
+        }
+
+        dstp[x * 4] = ProcessPixel(b);
+        dstp[x * 4 + 1] = ProcessPixel(g);
+        dstp[x * 4 + 2] = ProcessPixel(r);
+        dstp[x * 4 + 3] = processchroma ? ProcessPixel(a) : a[0];
+      }
+
+      for (unsigned int i = 0; i < depth; i++)
+        srcp[i] = srcp[i] + src_pitch[i];
+
+      dstp = dstp + dst_pitch;
+    }
+  }
+  else if (format == MEDIAN_BGR64 && kernel[1] == MEDIAN_KERNEL_RADIX)
+  {
+    ProcessBGR64_radix(_srcp, src_pitch, dstp, dst_pitch, width, height, processchroma);
+  }
+  else if (format == MEDIAN_BGR64)
+  {
+    //////////////////////////////////////////////////////////////////////
+    // BGRA, 16 bit per channel
+    //////////////////////////////////////////////////////////////////////
+    uint16_t b_16bit[MAX_DEPTH];
+    uint16_t g_16bit[MAX_DEPTH];
+    uint16_t r_16bit[MAX_DEPTH];
+    uint16_t a_16bit[MAX_DEPTH];
+
+    for (int y = 0; y < height; ++y)
+    {
+      for (int x = 0; x < width; x++)
+      {
+        for (unsigned int i = 0; i < depth; i++)
+        {
+          b_16bit[i] = srcp[i][x * 8 + 0] | (srcp[i][x * 8 + 1] << 8);
+          g_16bit[i] = srcp[i][x * 8 + 2] | (srcp[i][x * 8 + 3] << 8);
+          r_16bit[i] = srcp[i][x * 8 + 4] | (srcp[i][x * 8 + 5] << 8);
+          a_16bit[i] = srcp[i][x * 8 + 6] | (srcp[i][x * 8 + 7] << 8);
+        }
+
+        uint16_t median_b = ProcessPixel_16bit(b_16bit);
+        uint16_t median_g = ProcessPixel_16bit(g_16bit);
+        uint16_t median_r = ProcessPixel_16bit(r_16bit);
+        uint16_t median_a = processchroma ? ProcessPixel_16bit(a_16bit) : a_16bit[0];
+
+        dstp[x * 8] = static_cast<unsigned char>(median_b);
+        dstp[x * 8 + 1] = static_cast<unsigned char>(median_b >> 8);
+        dstp[x * 8 + 2] = static_cast<unsigned char>(median_g);
+        dstp[x * 8 + 3] = static_cast<unsigned char>(median_g >> 8);
+        dstp[x * 8 + 4] = static_cast<unsigned char>(median_r);
+        dstp[x * 8 + 5] = static_cast<unsigned char>(median_r >> 8);
+        dstp[x * 8 + 6] = static_cast<unsigned char>(median_a);
+        dstp[x * 8 + 7] = static_cast<unsigned char>(median_a >> 8);
+      }
+
+      for (unsigned int i = 0; i < depth; i++)
+        srcp[i] = srcp[i] + src_pitch[i];
+
+      dstp = dstp + dst_pitch;
+    }
+  }
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Processing of a stack of pixel values
+//////////////////////////////////////////////////////////////////////////////
+unsigned char MedianProcessor::ProcessPixel(unsigned char* values) const
+{
+  if (kernel[0] == MEDIAN_KERNEL_NETWORK) // Can use a fast method
+    return fastmedian(values);
+
+  if (kernel[0] == MEDIAN_KERNEL_RADIX) // Interleaved formats, a block of one pixel
+  {
+    unsigned char output;
+    RadixBlock(values, 1, 1, &output);
+    return output;
+  }
+
+  return Select(kernel[0], values);
+}
+
+uint16_t MedianProcessor::ProcessPixel_16bit(uint16_t* values) const
+{
+  if (kernel[1] == MEDIAN_KERNEL_RADIX)
+  {
+    uint16_t output;
+    RadixBlock(values, 1, 1, &output);
+    return output;
+  }
+
+  return Select(kernel[1], values);
+}
+
+float MedianProcessor::ProcessPixel_float(float* values) const
+{
+  return Select(kernel[2], values);
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Full processing
+//
+// Brings the values between low and high into place and averages them.
+// Floats are summed in ascending order with every kernel, so the kernels
+// don't change the rounding.
+//////////////////////////////////////////////////////////////////////////////
+template<typename pixel_t>
+pixel_t MedianProcessor::Select(MedianKernel method, pixel_t* values) const
+{
+  if (blend != depth) // If all clips are to be blended, there is no need to sort them
+  {
+    switch (method)
+    {
+    case MEDIAN_KERNEL_SELECT:
+      std::nth_element(values, values + low, values + depth);
+
+      if (blend > 1)
+        std::nth_element(values + low + 1, values + low + blend - 1, values + depth);
+
+      if constexpr (std::is_same<pixel_t, float>::value)
+        std::sort(values + low, values + low + blend);
+      break;
+
+    case MEDIAN_KERNEL_INSERTION:
+      for (unsigned int i = 1; i < depth; i++)
+      {
+        const pixel_t value = values[i];
+        unsigned int j = i;
+
+        for (; j > 0 && values[j - 1] > value; j--)
+          values[j] = values[j - 1];
+
+        values[j] = value;
+      }
+      break;
+
+    default:
+      std::sort(values, values + depth);
+      break;
+    }
+  }
+
+  if constexpr (std::is_same<pixel_t, float>::value)
+  {
+    float sum = 0.0f;
+
+    for (unsigned int i = low; i < low + blend; i++)
+      sum = sum + values[i];
+
+    return sum / blend;
+  }
+  else
+  {
+    unsigned int sum = 0;
+
+    for (unsigned int i = low; i < low + blend; i++)
+      sum = sum + values[i];
+
+    return (pixel_t)(sum / blend);
+  }
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Kernel calibration
+//////////////////////////////////////////////////////////////////////////////
+static const int TUNE_WIDTH = 256;
+static const int TUNE_HEIGHT = 16;
+static const int TUNE_ROUNDS = 3;
+
+int MedianProcessor::sample_type(MedianFormat format)
+{
+  switch (format)
+  {
+  case MEDIAN_PLANE_16BIT:
+  case MEDIAN_BGR64:
+    return 1;
+  case MEDIAN_PLANE_FLOAT:
+    return 2;
+  default:
+    return 0;
+  }
+}
+
+bool MedianProcessor::IsAvailable(MedianKernel kernel, MedianFormat format) const
+{
+  if (kernel == MEDIAN_KERNEL_NETWORK)
+    return fastprocess && sample_type(format) == 0;
+
+  if (kernel == MEDIAN_KERNEL_RADIX)
+    return sample_type(format) != 2;
+
+  return kernel < MEDIAN_KERNEL_COUNT;
+}
+
+template<typename pixel_t>
+MedianKernel MedianProcessor::Calibrate(MedianFormat format) const
+{
+  // Captures of the same frame: a common value per pixel with some noise
+  // and an occasional dropout
+  const double maximum = std::is_same<pixel_t, float>::value ? 1.0 : std::is_same<pixel_t, uint16_t>::value ? 65535.0 : 255.0;
+  std::vector<std::vector<pixel_t>> planes(depth, std::vector<pixel_t>(TUNE_WIDTH * TUNE_HEIGHT));
+  uint32_t state = 2463534242u;
+
+  for (int p = 0; p < TUNE_WIDTH * TUNE_HEIGHT; p++)
+  {
+    const double base = (p * 37 % 256) / 255.0;
+
+    for (unsigned int i = 0; i < depth; i++)
+    {
+      state ^= state << 13;
+      state ^= state >> 17;
+      state ^= state << 5;
+
+      double value = base + ((int)(state & 15) - 8) / 255.0;
+
+      if ((state >> 8) % 64 == 0)
+        value = (state >> 16) & 1 ? 1.0 : 0.0;
+
+      value = std::min(std::max(value, 0.0), 1.0) * maximum;
+      planes[i][p] = std::is_same<pixel_t, float>::value ? (pixel_t)value : (pixel_t)(value + 0.5);
+    }
+  }
+
+  const unsigned char* srcp[MAX_DEPTH];
+  int src_pitch[MAX_DEPTH];
+
+  for (unsigned int i = 0; i < depth; i++)
+  {
+    srcp[i] = reinterpret_cast<const unsigned char*>(planes[i].data());
+    src_pitch[i] = TUNE_WIDTH * sizeof(pixel_t);
+  }
+
+  std::vector<pixel_t> output(TUNE_WIDTH * TUNE_HEIGHT);
+
+  const bool planar = format == MEDIAN_PLANE_8BIT || format == MEDIAN_PLANE_16BIT || format == MEDIAN_PLANE_FLOAT;
+  const int width = TUNE_WIDTH * (int)sizeof(pixel_t) / pixel_size(format); // in pixels
+
+  // Time the loop of the format, some kernels work on whole rows and the
+  // interleaved ones go pixel by pixel
+  MedianProcessor candidate(*this);
+  candidate.SetSkipEqual(false);
+  candidate.SetAdaptive(0.0);
+  candidate.SetStats(nullptr);
+  MedianKernel best = MEDIAN_KERNEL_SORT;
+  double best_time = 0.0;
+
+  for (int k = 0; k < MEDIAN_KERNEL_COUNT; k++)
+  {
+    if (!IsAvailable((MedianKernel)k, format))
+      continue;
+
+    candidate.SetKernel(format, (MedianKernel)k);
+
+    double time = 0.0;
+
+    for (int round = 0; round < TUNE_ROUNDS; round++)
+    {
+      const auto start = std::chrono::steady_clock::now();
+
+      if (planar)
+        candidate.ProcessPlane(format, srcp, src_pitch, reinterpret_cast<unsigned char*>(output.data()), TUNE_WIDTH * sizeof(pixel_t), width, TUNE_HEIGHT);
+      else
+        candidate.ProcessInterleaved(format, srcp, src_pitch, reinterpret_cast<unsigned char*>(output.data()), TUNE_WIDTH * sizeof(pixel_t), width, TUNE_HEIGHT, true);
+
+      const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+      if (round == 0 || elapsed < time)
+        time = elapsed;
+    }
+
+    if (best_time == 0.0 || time < best_time)
+    {
+      best = (MedianKernel)k;
+      best_time = time;
+    }
+  }
+
+  return best;
+}
+
+void MedianProcessor::Tune(MedianFormat format)
+{
+  static std::mutex lock;
+  static std::map<std::tuple<std::string, int, unsigned int, unsigned int, unsigned int>, MedianKernel> tuned;
+
+  const int type = sample_type(format);
+  const auto key = std::make_tuple(std::string(cpu_signature()), (int)format, depth, low, high);
+
+  std::lock_guard<std::mutex> guard(lock);
+
+  auto it = tuned.find(key);
+
+  if (it == tuned.end())
+  {
+    MedianKernel best;
+
+    switch (type)
+    {
+    case 1: best = Calibrate<uint16_t>(format); break;
+    case 2: best = Calibrate<float>(format); break;
+    default: best = Calibrate<unsigned char>(format); break;
+    }
+
+    it = tuned.insert({ key, best }).first;
+  }
+
+  kernel[type] = it->second;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Helpers
+//////////////////////////////////////////////////////////////////////////////
+void copy_plane(const unsigned char* srcp, int src_pitch, unsigned char* dstp, int dst_pitch, int rowsize, int height)
+{
+  for (int y = 0; y < height; ++y)
+  {
+    memcpy(dstp, srcp, rowsize);
+
+    srcp = srcp + src_pitch;
+    dstp = dstp + dst_pitch;
+  }
+}
+
+template<typename pixel_t>
+static void gather_plane_t(const unsigned char* const* srcp, const int* src_pitch, const unsigned char* indexp, int index_pitch, int subsample_x, int subsample_y, unsigned char* _dstp, int dst_pitch, int width, int height)
+{
+  for (int y = 0; y < height; y++)
+  {
+    const unsigned char* index = indexp + (size_t)(y << subsample_y) * index_pitch;
+    pixel_t* dstp = reinterpret_cast<pixel_t*>(_dstp + (size_t)y * dst_pitch);
+
+    for (int x = 0; x < width; x++)
+    {
+      const unsigned int k = index[x << subsample_x];
+      dstp[x] = reinterpret_cast<const pixel_t*>(srcp[k] + (size_t)y * src_pitch[k])[x];
+    }
+  }
+}
+
+void gather_plane(MedianFormat format, const unsigned char* const* srcp, const int* src_pitch, const unsigned char* indexp, int index_pitch, int subsample_x, int subsample_y, unsigned char* dstp, int dst_pitch, int width, int height)
+{
+  switch (format)
+  {
+  case MEDIAN_PLANE_16BIT: gather_plane_t<uint16_t>(srcp, src_pitch, indexp, index_pitch, subsample_x, subsample_y, dstp, dst_pitch, width, height); break;
+  case MEDIAN_PLANE_FLOAT: gather_plane_t<float>(srcp, src_pitch, indexp, index_pitch, subsample_x, subsample_y, dstp, dst_pitch, width, height); break;
+  default: gather_plane_t<unsigned char>(srcp, src_pitch, indexp, index_pitch, subsample_x, subsample_y, dstp, dst_pitch, width, height); break;
+  }
+}
+
+template<typename pixel_t>
+static void gather_plane_mapped_t(const unsigned char* const* srcp, const int* src_pitch, const unsigned char* indexp, int index_pitch, const int* columns, const int* rows, unsigned char* _dstp, int dst_pitch, int width, int height)
+{
+  for (int y = 0; y < height; y++)
+  {
+    const unsigned char* index = indexp + (size_t)rows[y] * index_pitch;
+    pixel_t* dstp = reinterpret_cast<pixel_t*>(_dstp + (size_t)y * dst_pitch);
+
+    for (int x = 0; x < width; x++)
+    {
+      const unsigned int k = index[columns[x]];
+      dstp[x] = reinterpret_cast<const pixel_t*>(srcp[k] + (size_t)y * src_pitch[k])[x];
+    }
+  }
+}
+
+void gather_plane_mapped(MedianFormat format, const unsigned char* const* srcp, const int* src_pitch, const unsigned char* indexp, int index_pitch, const int* columns, const int* rows, unsigned char* dstp, int dst_pitch, int width, int height)
+{
+  switch (format)
+  {
+  case MEDIAN_PLANE_16BIT: gather_plane_mapped_t<uint16_t>(srcp, src_pitch, indexp, index_pitch, columns, rows, dstp, dst_pitch, width, height); break;
+  case MEDIAN_PLANE_FLOAT: gather_plane_mapped_t<float>(srcp, src_pitch, indexp, index_pitch, columns, rows, dstp, dst_pitch, width, height); break;
+  default: gather_plane_mapped_t<unsigned char>(srcp, src_pitch, indexp, index_pitch, columns, rows, dstp, dst_pitch, width, height); break;
+  }
+}
+
+int sample_size(MedianFormat format)
+{
+  switch (format)
+  {
+  case MEDIAN_PLANE_16BIT: return 2;
+  case MEDIAN_PLANE_FLOAT: return 4;
+  default: return 1;
+  }
+}
+
+const char* kernel_name(MedianKernel kernel)
+{
+  switch (kernel)
+  {
+  case MEDIAN_KERNEL_NETWORK: return "network";
+  case MEDIAN_KERNEL_SORT: return "sort";
+  case MEDIAN_KERNEL_SELECT: return "select";
+  case MEDIAN_KERNEL_INSERTION: return "insertion";
+  case MEDIAN_KERNEL_RADIX: return "radix";
+  default: return "unknown";
+  }
+}
+
+const char* cpu_signature()
+{
+  static const std::string signature = []()
+  {
+    std::string brand;
+
+#ifdef INTEL_INTRINSICS
+    unsigned int regs[12] = { 0 };
+
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0x80000000);
+
+    if ((unsigned int)info[0] >= 0x80000004)
+    {
+      for (int i = 0; i < 3; i++)
+        __cpuid(reinterpret_cast<int*>(regs) + 4 * i, 0x80000002 + i);
+    }
+#else
+    if (__get_cpuid_max(0x80000000, nullptr) >= 0x80000004)
+    {
+      for (unsigned int i = 0; i < 3; i++)
+        __get_cpuid(0x80000002 + i, &regs[4 * i], &regs[4 * i + 1], &regs[4 * i + 2], &regs[4 * i + 3]);
+    }
+#endif
+
+    brand.assign(reinterpret_cast<const char*>(regs), strnlen(reinterpret_cast<const char*>(regs), sizeof(regs)));
+    brand.erase(0, brand.find_first_not_of(' '));
+#endif
+
+    return brand.empty() ? std::string("unknown") : brand;
+  }();
+
+  return signature.c_str();
+}
+
+
+size_t last_level_cache()
+{
+  static const size_t size = []()
+  {
+    size_t largest = 0;
+
+#ifdef INTEL_INTRINSICS
+    // Deterministic cache parameters, leaf 4 on Intel, 0x8000001D on AMD
+    const unsigned int leaves[] = { 4, 0x8000001D };
+
+    for (unsigned int leaf : leaves)
+    {
+      unsigned int regs[4] = { 0 };
+
+#ifdef _MSC_VER
+      __cpuid(reinterpret_cast<int*>(regs), leaf & 0x80000000);
+#else
+      regs[0] = __get_cpuid_max(leaf & 0x80000000, nullptr);
+#endif
+
+      if (regs[0] < leaf)
+        continue;
+
+      for (unsigned int index = 0; index < 16; index++)
+      {
+#ifdef _MSC_VER
+        __cpuidex(reinterpret_cast<int*>(regs), leaf, index);
+#else
+        __cpuid_count(leaf, index, regs[0], regs[1], regs[2], regs[3]);
+#endif
+
+        const unsigned int type = regs[0] & 31; // 0 = no more caches, 1 = data, 3 = unified
+
+        if (type == 0)
+          break;
+
+        if (type == 1 || type == 3)
+        {
+          const size_t ways = (regs[1] >> 22) + 1;
+          const size_t partitions = ((regs[1] >> 12) & 1023) + 1;
+          const size_t line = (regs[1] & 4095) + 1;
+          const size_t sets = (size_t)regs[2] + 1;
+
+          largest = std::max(largest, ways * partitions * line * sets);
+        }
+      }
+
+      if (largest)
+        break;
+    }
+#endif
+
+    return largest ? largest : (size_t)8 << 20;
+  }();
+
+  return size;
+}
@@ -0,0 +1,196 @@
+#ifndef MEDIANCORE_H
+#define MEDIANCORE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+//////////////////////////////////////////////////////////////////////////////
+// Median core
+//
+// Pixel processing of the Median filter over raw buffers, independent of
+// AviSynth. All source buffers must have the same format and dimensions.
+//////////////////////////////////////////////////////////////////////////////
+const unsigned int MAX_DEPTH = 64; // per pixel scratch is sized for this on the stack
+const unsigned int MAX_OPT = 9;
+const unsigned int MIN_RADIX = 8; // 8 bit stacks from this depth use the radix kernel unless a network applies
+const unsigned int MIN_RADIX_16BIT = 9; // 16 bit medians from this depth use the radix kernel
+const unsigned int MIN_RADIX_16BIT_BLEND = 17; // 16 bit blends select twice, they gain later
+const unsigned int MIN_SELECT_FLOAT = 21; // float medians from this depth use nth_element
+const int SKIP_BLOCK = 64; // pixels per row block of the agreement check
+const int STRIP_BYTES = 8192; // source bytes of all clips per strip, half of a first level data cache
+
+enum MedianFormat
+{
+  // Single planes, width is given in samples
+  MEDIAN_PLANE_8BIT,
+  MEDIAN_PLANE_16BIT,
+  MEDIAN_PLANE_FLOAT,
+
+  // Interleaved formats, width is given in pixels
+  MEDIAN_YUY2,
+  MEDIAN_BGR24,
+  MEDIAN_BGR32,
+  MEDIAN_BGR64,
+};
+
+// Ways of ordering the values before the ones between low and high are
+// averaged. All of them give the same output.
+enum MedianKernel
+{
+  MEDIAN_KERNEL_NETWORK,   // opt_med sorting networks, 8 bit medians of up to MAX_OPT values
+  MEDIAN_KERNEL_SORT,      // std::sort
+  MEDIAN_KERNEL_SELECT,    // std::nth_element around the blended range
+  MEDIAN_KERNEL_INSERTION, // insertion sort, few moves on small and nearly sorted stacks
+  MEDIAN_KERNEL_RADIX,     // 8/16 bit: bit by bit selection over a row of pixels at once
+  MEDIAN_KERNEL_COUNT
+};
+
+// Blocks seen and blocks copied because all sources agreed, pixels that
+// took the adaptive median of 3 path and those of them that needed the full
+// stack. Can be shared by processors running on several threads.
+struct MedianStats
+{
+  std::atomic<uint64_t> blocks;
+  std::atomic<uint64_t> skipped;
+  std::atomic<uint64_t> pixels;
+  std::atomic<uint64_t> escalated;
+
+  MedianStats() : blocks(0), skipped(0), pixels(0), escalated(0) {}
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// Class definition
+//////////////////////////////////////////////////////////////////////////////
+class MedianProcessor
+{
+public:
+  // Sorts depth values and averages the ones between low and high
+  // (exclusive), low == high == (depth - 1) / 2 is a regular median
+  MedianProcessor(unsigned int _depth, unsigned int _low, unsigned int _high);
+
+  unsigned int GetDepth() const { return depth; }
+  unsigned int GetLow() const { return low; }
+  unsigned int GetHigh() const { return high; }
+  unsigned int GetBlend() const { return blend; }
+  bool IsFast() const { return fastprocess; }
+
+  // Times every kernel that can handle the samples of format on a synthetic
+  // block laid out as format (planar or interleaved) and uses the fastest
+  // one from then on. Results are kept for the rest of the process per CPU
+  // signature, format, depth and limits, so further instances don't
+  // calibrate again.
+  void Tune(MedianFormat format);
+
+  bool IsAvailable(MedianKernel kernel, MedianFormat format) const;
+  MedianKernel GetKernel(MedianFormat format) const { return kernel[sample_type(format)]; }
+  void SetKernel(MedianFormat format, MedianKernel _kernel) { kernel[sample_type(format)] = _kernel; }
+
+  // Copy row blocks that are identical in all sources instead of processing
+  // them (default on). Counts go to stats when set. Float blends are always
+  // processed, their sum rounds and may land an ulp off the common value.
+  bool GetSkipEqual() const { return skipequal; }
+  void SetSkipEqual(bool enable) { skipequal = enable; }
+  bool SkipsEqual(MedianFormat format) const { return skipequal && !(format == MEDIAN_PLANE_FLOAT && blend > 1); }
+  void SetStats(MedianStats* _stats) { stats = _stats; }
+
+  // Median of the first three sources where those are no more than
+  // threshold apart (in sample units, 0 = off), the full stack elsewhere.
+  // Applies to medians of 5 or more values on planar formats.
+  double GetAdaptive() const { return adaptive; }
+  void SetAdaptive(double threshold) { adaptive = threshold; }
+  bool IsAdaptive(MedianFormat format) const;
+
+  // Rows are processed in strips of columns whose sources fit STRIP_BYTES,
+  // the next strip of every source is prefetched meanwhile. Planes whose
+  // sources and output take more than stream bytes (default: the last level
+  // cache) are written with non-temporal stores, 0 = always, SIZE_MAX = never.
+  size_t GetStreamBytes() const { return streambytes; }
+  void SetStreamBytes(size_t bytes) { streambytes = bytes; }
+
+  // dstp may be one of the sources (with its pitch), the output is then
+  // written in place
+  void ProcessPlane(MedianFormat format, const unsigned char* const* srcp, const int* src_pitch, unsigned char* dstp, int dst_pitch, int width, int height) const;
+
+  // Median of a plane together with the lowest index of a source holding it,
+  // one byte per sample. Medians (blend 1) of planar formats only.
+  void ProcessPlaneIndexed(MedianFormat format, const unsigned char* const* srcp, const int* src_pitch, unsigned char* dstp, int dst_pitch, unsigned char* indexp, int index_pitch, int width, int height) const;
+
+  // processchroma == false copies U/V (YUY2) and alpha (BGR32/BGR64) from the first source,
+  // dstp may be one of the sources as above
+  void ProcessInterleaved(MedianFormat format, const unsigned char* const* srcp, const int* src_pitch, unsigned char* dstp, int dst_pitch, int width, int height, bool processchroma) const;
+
+  unsigned char ProcessPixel(unsigned char* values) const;
+  uint16_t ProcessPixel_16bit(uint16_t* values) const;
+  float ProcessPixel_float(float* values) const;
+
+private:
+  unsigned int depth;
+  unsigned int low;
+  unsigned int high;
+  unsigned int blend;
+  bool fastprocess;
+
+  unsigned char (*fastmedian)(unsigned char*);
+
+  // Kernel per sample type: 8 bit, 16 bit, float
+  MedianKernel kernel[3];
+
+  bool skipequal;
+  double adaptive;
+  MedianStats* stats;
+  size_t streambytes;
+
+  static int sample_type(MedianFormat format);
+
+  template<typename pixel_t>
+  pixel_t Select(MedianKernel method, pixel_t* values) const;
+
+  template<typename pixel_t>
+  MedianKernel Calibrate(MedianFormat format) const;
+
+  template<typename pixel_t>
+  int AdaptiveBlock(MedianFormat format, const unsigned char* const* srcp, const int* src_pitch, int x, int count, unsigned char* dstp) const;
+
+  void ProcessStrips(MedianFormat format, const unsigned char* const* srcp, const int* src_pitch, unsigned char* dstp, int dst_pitch, int width, int height, bool processchroma, unsigned char* indexp, int index_pitch) const;
+  void ProcessStrip(MedianFormat format, const unsigned char* const* srcp, const int* src_pitch, unsigned char* dstp, int dst_pitch, int width, int height, bool processchroma) const;
+  void ProcessBlocks(MedianFormat format, const unsigned char* const* srcp, const int* src_pitch, unsigned char* dstp, int dst_pitch, int width, int height, bool processchroma) const;
+  void ProcessPlaneRegion(MedianFormat format, const unsigned char* const* srcp, const int* src_pitch, unsigned char* dstp, int dst_pitch, int width, int height) const;
+  void ProcessInterleavedRegion(MedianFormat format, const unsigned char* const* srcp, const int* src_pitch, unsigned char* dstp, int dst_pitch, int width, int height, bool processchroma) const;
+
+  template<typename pixel_t>
+  void ProcessPlane_radix(const unsigned char* const* srcp, const int* src_pitch, unsigned char* dstp, int dst_pitch, int width, int height) const;
+  void ProcessBGR64_radix(const unsigned char* const* srcp, const int* src_pitch, unsigned char* dstp, int dst_pitch, int width, int height, bool processchroma) const;
+
+  template<typename pixel_t>
+  void RadixBlock(const pixel_t* values, int stride, int count, pixel_t* dstp) const;
+
+  template<typename pixel_t>
+  void ProcessPlane_t(const unsigned char* const* srcp, const int* src_pitch, unsigned char* dstp, int dst_pitch, int width, int height) const;
+};
+
+// Plain copy of a plane, rowsize is given in bytes
+void copy_plane(const unsigned char* srcp, int src_pitch, unsigned char* dstp, int dst_pitch, int rowsize, int height);
+
+// Every sample taken from the source an index plane names, the index of
+// sample x, y is at (x << subsample_x, y << subsample_y). width and height
+// are those of the output plane.
+void gather_plane(MedianFormat format, const unsigned char* const* srcp, const int* src_pitch, const unsigned char* indexp, int index_pitch, int subsample_x, int subsample_y, unsigned char* dstp, int dst_pitch, int width, int height);
+
+// Same with the index of sample x, y at (columns[x], rows[y]), for index
+// planes of another size (nearest neighbour)
+void gather_plane_mapped(MedianFormat format, const unsigned char* const* srcp, const int* src_pitch, const unsigned char* indexp, int index_pitch, const int* columns, const int* rows, unsigned char* dstp, int dst_pitch, int width, int height);
+
+// Bytes per sample of a planar format
+int sample_size(MedianFormat format);
+
+// Short name for debug output
+const char* kernel_name(MedianKernel kernel);
+
+// Processor brand string, "unknown" where it can't be read
+const char* cpu_signature();
+
+// Size of the largest data cache in bytes, 8 MiB where it can't be read
+size_t last_level_cache();
+
+#endif // MEDIANCORE_H
@@ -0,0 +1,113 @@
+#include "sync.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#include <algorithm>
+
+//////////////////////////////////////////////////////////////////////////////
+// Frame similarity
+//////////////////////////////////////////////////////////////////////////////
+double compare_samples(const unsigned char* aptr, const unsigned char* bptr, unsigned int length, unsigned int points)
+{
+  if (points < 1 || points > length)
+    points = length;
+
+  const unsigned int step = length / points;
+
+  unsigned long sum = 0;
+
+  for (unsigned int i = 0; i < length; i = i + step)
+    sum = sum + abs((int)aptr[i] - (int)bptr[i]);
+
+  double difference = (100.0 * sum) / (255.0 * points);
+
+  return 100.0 - difference;
+}
+
+
+double compare_rows(const unsigned char* aptr, int a_pitch, const unsigned char* bptr, int b_pitch, unsigned int rowsize, unsigned int height, unsigned int points)
+{
+  const uint64_t length = (uint64_t)rowsize * height;
+
+  if (length == 0)
+    return 100.0;
+
+  if (points < 1 || points > length)
+    points = (unsigned int)std::min<uint64_t>(length, UINT_MAX);
+
+  const uint64_t step = length / points;
+
+  uint64_t sum = 0;
+  uint64_t count = 0;
+
+  for (uint64_t i = 0; i < length; i = i + step)
+  {
+    const size_t y = (size_t)(i / rowsize);
+    const size_t x = (size_t)(i % rowsize);
+
+    sum = sum + abs((int)aptr[y * a_pitch + x] - (int)bptr[y * b_pitch + x]);
+    count++;
+  }
+
+  double difference = (100.0 * sum) / (255.0 * count);
+
+  return 100.0 - difference;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Whole file search with dynamic programming
+//////////////////////////////////////////////////////////////////////////////
+void find_sync_track(const std::vector<float>& scores, int frames, int radius, double penalty, std::vector<int>& track)
+{
+  const int count = 2 * radius + 1;
+
+  track.assign(frames, 0);
+
+  if (frames < 1)
+    return;
+
+  std::vector<double> total(scores.begin(), scores.begin() + count);
+  std::vector<double> next(count);
+  std::vector<unsigned short> from((size_t)frames * count, 0);
+
+  for (int n = 1; n < frames; n++)
+  {
+    for (int k = 0; k < count; k++)
+    {
+      // Ties go to the smallest offset change, then to the lower offset
+      int best = k;
+      double value = total[k];
+
+      for (int j = 0; j < count; j++)
+      {
+        const double candidate = total[j] - penalty * abs(k - j);
+
+        if (candidate > value)
+        {
+          value = candidate;
+          best = j;
+        }
+      }
+
+      next[k] = value + scores[(size_t)n * count + k];
+      from[(size_t)n * count + k] = (unsigned short)best;
+    }
+
+    total.swap(next);
+  }
+
+  int k = 0;
+
+  for (int j = 1; j < count; j++)
+  {
+    if (total[j] > total[k] || (total[j] == total[k] && abs(j - radius) < abs(k - radius)))
+      k = j;
+  }
+
+  for (int n = frames - 1; n >= 0; n--)
+  {
+    track[n] = k - radius;
+    k = from[(size_t)n * count + k];
+  }
+}
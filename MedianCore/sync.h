@@ -0,0 +1,29 @@
+#ifndef SYNC_H
+#define SYNC_H
+
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////////
+// Compare two buffers of 8-bit samples
+//
+// Every (length / points)th sample is compared.
+// returns 100.0 -> exact match, 0.0 -> completely different
+//////////////////////////////////////////////////////////////////////////////
+double compare_samples(const unsigned char* aptr, const unsigned char* bptr, unsigned int length, unsigned int points);
+
+//////////////////////////////////////////////////////////////////////////////
+// Same over rowsize bytes of height rows with their own pitch, a field is
+// given with twice the frame pitch and half the height
+//////////////////////////////////////////////////////////////////////////////
+double compare_rows(const unsigned char* aptr, int a_pitch, const unsigned char* bptr, int b_pitch, unsigned int rowsize, unsigned int height, unsigned int points);
+
+//////////////////////////////////////////////////////////////////////////////
+// Best offset track through a similarity matrix
+//
+// scores: frames * (2 * radius + 1) values, index k stands for offset
+// k - radius. Every frame of offset change costs penalty. track receives
+// one offset per frame.
+//////////////////////////////////////////////////////////////////////////////
+void find_sync_track(const std::vector<float>& scores, int frames, int radius, double penalty, std::vector<int>& track);
+
+#endif // SYNC_H
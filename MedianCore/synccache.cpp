@@ -0,0 +1,343 @@
+#include "synccache.h"
+#include <atomic>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+//////////////////////////////////////////////////////////////////////////////
+// Constructor / destructor
+//////////////////////////////////////////////////////////////////////////////
+SyncCache::SyncCache() :
+  base(nullptr), size(0), depth(0), frames(0),
+#ifdef _WIN32
+  file(INVALID_HANDLE_VALUE), mapping(nullptr)
+#else
+  fd(-1)
+#endif
+{
+}
+
+SyncCache::~SyncCache()
+{
+  Close();
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Header and size of an existing file, checked before mapping it, which
+// would create or resize the file. Returns false when there is no file.
+//////////////////////////////////////////////////////////////////////////////
+static bool read_header(const char* path, SyncCacheHeader& header, long& end)
+{
+  FILE* file = fopen(path, "rb");
+
+  if (!file)
+    return false;
+
+  memset(&header, 0, sizeof(header));
+
+  const bool read = fread(&header, sizeof(header), 1, file) == 1;
+
+  end = fseek(file, 0, SEEK_END) == 0 ? ftell(file) : -1;
+
+  if (!read && end != 0)
+    end = -1;
+
+  fclose(file);
+
+  return true;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Open the cache, creating it when there is none. A cache written with
+// other parameters is only reinitialized with overwrite, anything that
+// isn't a cache never.
+//////////////////////////////////////////////////////////////////////////////
+bool SyncCache::Open(const char* path, unsigned int _depth, unsigned int _frames, unsigned int radius, unsigned int samples, bool fields, bool overwrite, std::string& error)
+{
+  Close();
+
+  depth = _depth;
+  frames = _frames;
+
+  const size_t length = sizeof(SyncCacheHeader) + (size_t)frames * RecordSize();
+
+  SyncCacheHeader stored;
+  long end = 0;
+  const bool exists = read_header(path, stored, end) && end != 0; // empty files are new ones
+
+  if (exists && (end < 0 || memcmp(stored.magic, SYNCCACHE_MAGIC, sizeof(SYNCCACHE_MAGIC)) != 0))
+  {
+    error = "File is not a sync cache, refusing to overwrite it.";
+    return false;
+  }
+
+  const bool valid = exists
+    && stored.version == SYNCCACHE_VERSION
+    && stored.depth == depth
+    && stored.frames == frames
+    && stored.radius == radius
+    && stored.samples == samples
+    && stored.fields == (fields ? 1U : 0U)
+    && (size_t)end == length;
+
+  if (exists && !valid && !overwrite)
+  {
+    char text[256];
+    snprintf(text, sizeof(text), "Sync cache was written for %u clips%s, %u frames, sync %u, samples %u (version %u), delete it to start over.",
+      stored.fields ? stored.depth / 2 : stored.depth, stored.fields ? " with fields" : "", stored.frames, stored.radius, stored.samples, stored.version);
+    error = text;
+    return false;
+  }
+
+  bool created = false;
+
+  if (!Map(path, length, created, error))
+  {
+    Close();
+    return false;
+  }
+
+  if (!valid) // New or overwritten
+  {
+    SyncCacheHeader* header = (SyncCacheHeader*)base;
+
+    memset(base, 0, size);
+    memcpy(header->magic, SYNCCACHE_MAGIC, sizeof(SYNCCACHE_MAGIC));
+    header->version = SYNCCACHE_VERSION;
+    header->depth = depth;
+    header->frames = frames;
+    header->radius = radius;
+    header->samples = samples;
+    header->fields = fields ? 1 : 0;
+  }
+
+  return true;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Open a cache written earlier, leaving its contents as they are
+//////////////////////////////////////////////////////////////////////////////
+bool SyncCache::Load(const char* path, unsigned int _depth, unsigned int _frames, bool fields, std::string& error)
+{
+  Close();
+
+  depth = _depth;
+  frames = _frames;
+
+  const size_t length = sizeof(SyncCacheHeader) + (size_t)frames * RecordSize();
+
+  SyncCacheHeader header;
+  long end = 0;
+
+  if (!read_header(path, header, end))
+  {
+    error = "Cannot open sync cache file.";
+    return false;
+  }
+
+  if (end < 0 || (size_t)end != length
+    || memcmp(header.magic, SYNCCACHE_MAGIC, sizeof(SYNCCACHE_MAGIC)) != 0
+    || header.version != SYNCCACHE_VERSION
+    || header.depth != depth
+    || header.frames != frames
+    || header.fields != (fields ? 1U : 0U))
+  {
+    error = "Sync cache file doesn't match the clips.";
+    return false;
+  }
+
+  bool created = false;
+
+  if (!Map(path, length, created, error))
+  {
+    Close();
+    return false;
+  }
+
+  return true;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Access to per-frame records
+//////////////////////////////////////////////////////////////////////////////
+bool SyncCache::Lookup(int n, int* offset, double* score) const
+{
+  if (!base || n < 0 || n >= (int)frames)
+    return false;
+
+  const unsigned char* record = Record(n);
+
+  if (*(const volatile uint32_t*)record == 0)
+    return false;
+
+  std::atomic_thread_fence(std::memory_order_acquire);
+
+  const SyncCacheEntry* entry = (const SyncCacheEntry*)(record + 8);
+
+  for (unsigned int i = 0; i < depth; i++)
+  {
+    offset[i] = entry[i].offset;
+    score[i] = entry[i].score;
+  }
+
+  return true;
+}
+
+void SyncCache::Store(int n, const int* offset, const double* score)
+{
+  if (!base || n < 0 || n >= (int)frames)
+    return;
+
+  unsigned char* record = Record(n);
+  SyncCacheEntry* entry = (SyncCacheEntry*)(record + 8);
+
+  for (unsigned int i = 0; i < depth; i++)
+  {
+    entry[i].offset = i == 0 ? 0 : offset[i];
+    entry[i].score = i == 0 ? 100.0f : (float)score[i];
+  }
+
+  // Entries must be visible before the record is flagged as valid
+  std::atomic_thread_fence(std::memory_order_release);
+
+  *(volatile uint32_t*)record = 1;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Platform specific file mapping
+//////////////////////////////////////////////////////////////////////////////
+#ifdef _WIN32
+bool SyncCache::Map(const char* path, size_t length, bool& created, std::string& error)
+{
+  file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+
+  if (file == INVALID_HANDLE_VALUE)
+  {
+    error = "Cannot open sync cache file.";
+    return false;
+  }
+
+  LARGE_INTEGER current;
+  if (!GetFileSizeEx(file, &current))
+    current.QuadPart = 0;
+
+  created = (size_t)current.QuadPart != length;
+
+  if (created)
+  {
+    LARGE_INTEGER end;
+    end.QuadPart = length;
+
+    if (!SetFilePointerEx(file, end, NULL, FILE_BEGIN) || !SetEndOfFile(file))
+    {
+      error = "Cannot resize sync cache file.";
+      return false;
+    }
+  }
+
+  mapping = CreateFileMappingA(file, NULL, PAGE_READWRITE, (DWORD)((uint64_t)length >> 32), (DWORD)length, NULL);
+
+  if (mapping == NULL)
+  {
+    error = "Cannot map sync cache file.";
+    return false;
+  }
+
+  base = (unsigned char*)MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, length);
+
+  if (base == NULL)
+  {
+    error = "Cannot map sync cache file.";
+    return false;
+  }
+
+  size = length;
+
+  return true;
+}
+
+void SyncCache::Close()
+{
+  if (base)
+  {
+    FlushViewOfFile(base, 0);
+    UnmapViewOfFile(base);
+  }
+
+  if (mapping)
+    CloseHandle(mapping);
+
+  if (file != INVALID_HANDLE_VALUE)
+    CloseHandle(file);
+
+  base = nullptr;
+  mapping = nullptr;
+  file = INVALID_HANDLE_VALUE;
+  size = 0;
+}
+#else
+bool SyncCache::Map(const char* path, size_t length, bool& created, std::string& error)
+{
+  fd = open(path, O_RDWR | O_CREAT, 0644);
+
+  if (fd < 0)
+  {
+    error = "Cannot open sync cache file.";
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0)
+    st.st_size = 0;
+
+  created = (size_t)st.st_size != length;
+
+  if (created && ftruncate(fd, (off_t)length) != 0)
+  {
+    error = "Cannot resize sync cache file.";
+    return false;
+  }
+
+  void* ptr = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+  if (ptr == MAP_FAILED)
+  {
+    error = "Cannot map sync cache file.";
+    return false;
+  }
+
+  base = (unsigned char*)ptr;
+  size = length;
+
+  return true;
+}
+
+void SyncCache::Close()
+{
+  if (base)
+  {
+    msync(base, size, MS_ASYNC);
+    munmap(base, size);
+  }
+
+  if (fd >= 0)
+    close(fd);
+
+  base = nullptr;
+  fd = -1;
+  size = 0;
+}
+#endif
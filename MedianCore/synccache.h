@@ -0,0 +1,89 @@
+#ifndef SYNCCACHE_H
+#define SYNCCACHE_H
+
+#include <stdint.h>
+#include <string>
+
+//////////////////////////////////////////////////////////////////////////////
+// Persistent sync offset cache
+//
+// File layout (little endian):
+//   header  : SyncCacheHeader
+//   records : frames * (8 + depth * 8) bytes, one record per output frame
+//
+// A record starts with a uint32 "valid" flag followed by 4 padding bytes,
+// then one SyncCacheEntry per clip (clip 0 is the reference and is always
+// stored as offset 0, score 100.0). With fields the second half of the
+// entries holds the bottom field, depth is twice the number of clips then.
+//
+// The file is memory mapped read/write, so records written by GetFrame go
+// back to disk incrementally through the page cache.
+//////////////////////////////////////////////////////////////////////////////
+#define SYNCCACHE_MAGIC   "AJKSYNC"
+#define SYNCCACHE_VERSION 2
+
+struct SyncCacheHeader
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t depth;
+  uint32_t frames;
+  uint32_t radius;
+  uint32_t samples;
+  uint32_t fields; // 1: entries per field
+  uint32_t reserved[2];
+};
+
+struct SyncCacheEntry
+{
+  int32_t offset;
+  float score;
+};
+
+class SyncCache
+{
+public:
+  SyncCache();
+  ~SyncCache();
+
+  SyncCache(const SyncCache&) = delete;
+  SyncCache& operator=(const SyncCache&) = delete;
+
+  // Maps the file, creating it if there is none. A cache written with other
+  // parameters is reinitialized with overwrite and an error otherwise, files
+  // that aren't caches are left alone. Returns false and fills error on failure.
+  bool Open(const char* path, unsigned int depth, unsigned int frames, unsigned int radius, unsigned int samples, bool fields, bool overwrite, std::string& error);
+
+  // Maps an existing file for lookups only, whatever radius and samples it
+  // was written with. Fails when it is missing or doesn't match.
+  bool Load(const char* path, unsigned int depth, unsigned int frames, bool fields, std::string& error);
+  void Close();
+
+  bool IsOpen() const { return base != nullptr; }
+  unsigned int GetDepth() const { return depth; }
+  unsigned int GetFrames() const { return frames; }
+
+  // Read a stored record, returns false if frame n has not been stored yet
+  bool Lookup(int n, int* offset, double* score) const;
+  void Store(int n, const int* offset, const double* score);
+
+private:
+  unsigned char* base;
+  size_t size;
+  unsigned int depth;
+  unsigned int frames;
+
+#ifdef _WIN32
+  void* file;
+  void* mapping;
+#else
+  int fd;
+#endif
+
+  size_t RecordSize() const { return 8 + (size_t)depth * sizeof(SyncCacheEntry); }
+  unsigned char* Record(int n) const { return base + sizeof(SyncCacheHeader) + (size_t)n * RecordSize(); }
+
+  bool Map(const char* path, size_t length, bool& created, std::string& error);
+};
+
+#endif // SYNCCACHE_H
@@ -0,0 +1,115 @@
+#include "workers.h"
+
+//////////////////////////////////////////////////////////////////////////////
+// Constructor / destructor
+//////////////////////////////////////////////////////////////////////////////
+WorkerPool::WorkerPool(unsigned int threads) :
+  task(nullptr), count(0), next(0), busy(0), round(0), quit(false)
+{
+  for (unsigned int t = 1; t < threads; t++)
+    workers.emplace_back(&WorkerPool::Work, this);
+}
+
+WorkerPool::~WorkerPool()
+{
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    quit = true;
+  }
+
+  wake.notify_all();
+
+  for (auto& worker : workers)
+    worker.join();
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// One round
+//////////////////////////////////////////////////////////////////////////////
+void WorkerPool::Run(unsigned int _count, const std::function<void(unsigned int)>& _task)
+{
+  std::unique_lock<std::mutex> owner(running, std::try_to_lock);
+
+  if (!owner.owns_lock() || workers.empty() || _count < 2)
+  {
+    for (unsigned int i = 0; i < _count; i++)
+      _task(i);
+
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> guard(lock);
+
+    task = &_task;
+    count = _count;
+    next = 0;
+    busy = (unsigned int)workers.size();
+    error = nullptr;
+    round++;
+  }
+
+  wake.notify_all();
+
+  Take(); // Calling thread takes part as well
+
+  std::exception_ptr failed;
+
+  {
+    std::unique_lock<std::mutex> guard(lock);
+
+    done.wait(guard, [this]() { return busy == 0; });
+
+    failed = error;
+    error = nullptr;
+    task = nullptr;
+  }
+
+  if (failed)
+    std::rethrow_exception(failed);
+}
+
+// Indices are taken until none are left, a failed task doesn't stop the others
+void WorkerPool::Take()
+{
+  for (unsigned int i = next++; i < count; i = next++)
+  {
+    try { (*task)(i); }
+    catch (...)
+    {
+      std::lock_guard<std::mutex> guard(lock);
+
+      if (!error)
+        error = std::current_exception();
+    }
+  }
+}
+
+void WorkerPool::Work()
+{
+  uint64_t seen = 0;
+
+  for (;;)
+  {
+    {
+      std::unique_lock<std::mutex> guard(lock);
+
+      wake.wait(guard, [&]() { return quit || round != seen; });
+
+      if (quit)
+        return;
+
+      seen = round;
+    }
+
+    Take();
+
+    {
+      std::lock_guard<std::mutex> guard(lock);
+
+      if (--busy == 0)
+        done.notify_one();
+    }
+  }
+}
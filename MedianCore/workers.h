@@ -0,0 +1,54 @@
+#ifndef WORKERS_H
+#define WORKERS_H
+
+#include <stdint.h>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <exception>
+#include <functional>
+
+//////////////////////////////////////////////////////////////////////////////
+// Persistent worker threads
+//
+// The threads are started once and wait between rounds. Run hands out the
+// indices of a round one at a time, the calling thread takes part as well,
+// so a pool of n threads starts n - 1 workers.
+//////////////////////////////////////////////////////////////////////////////
+class WorkerPool
+{
+public:
+  explicit WorkerPool(unsigned int threads);
+  ~WorkerPool();
+
+  unsigned int GetThreads() const { return (unsigned int)workers.size() + 1; }
+
+  // task(0) ... task(count - 1), returns when all are done. The first
+  // exception of a task is rethrown once the round is over. A round started
+  // while another one is running is done by the calling thread alone.
+  void Run(unsigned int count, const std::function<void(unsigned int)>& task);
+
+private:
+  std::vector<std::thread> workers;
+  std::mutex running; // held for a whole round
+  std::mutex lock;
+  std::condition_variable wake;
+  std::condition_variable done;
+
+  // Current round
+  const std::function<void(unsigned int)>* task;
+  unsigned int count;
+  std::atomic<unsigned int> next;
+  unsigned int busy; // workers not finished yet
+  uint64_t round;
+  bool quit;
+  std::exception_ptr error;
+
+  void Work();
+  void Take();
+};
+
+
+#endif // WORKERS_H
@@ -0,0 +1,492 @@
+#include "y4m.h"
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+#ifdef _WIN32
+#include <Windows.h>
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+//////////////////////////////////////////////////////////////////////////////
+// Raw format description
+//////////////////////////////////////////////////////////////////////////////
+bool parse_raw_format(const char* text, RawFormat& format)
+{
+  format.subsampling_w = 1;
+  format.subsampling_h = 1;
+  format.bits = 8;
+
+  char* end;
+  format.width = strtol(text, &end, 10);
+
+  if (*end != 'x')
+    return false;
+
+  format.height = strtol(end + 1, &end, 10);
+
+  if (format.width <= 0 || format.height <= 0)
+    return false;
+
+  while (*end == ':')
+  {
+    const char* token = end + 1;
+
+    if (strncmp(token, "420", 3) == 0) { format.subsampling_w = 1; format.subsampling_h = 1; end = (char*)token + 3; }
+    else if (strncmp(token, "422", 3) == 0) { format.subsampling_w = 1; format.subsampling_h = 0; end = (char*)token + 3; }
+    else if (strncmp(token, "444", 3) == 0) { format.subsampling_w = 0; format.subsampling_h = 0; end = (char*)token + 3; }
+    else if (strncmp(token, "400", 3) == 0) { format.subsampling_w = -1; format.subsampling_h = -1; end = (char*)token + 3; }
+    else
+    {
+      format.bits = strtol(token, &end, 10);
+
+      if (end == token || format.bits < 8 || format.bits > 16)
+        return false;
+    }
+  }
+
+  return *end == 0;
+}
+
+std::string y4m_colorspace(const RawFormat& format)
+{
+  std::string tag;
+
+  if (format.subsampling_w < 0)
+    return format.bits > 8 ? "Cmono" + std::to_string(format.bits) : "Cmono";
+
+  if (format.subsampling_w == 0)
+    tag = "C444";
+  else if (format.subsampling_h == 0)
+    tag = "C422";
+  else
+    tag = "C420";
+
+  if (format.bits > 8)
+    return tag + "p" + std::to_string(format.bits);
+
+  return format.subsampling_h == 1 ? tag + "jpeg" : tag;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Constructor / destructor
+//////////////////////////////////////////////////////////////////////////////
+VideoReader::VideoReader() :
+  format(), frame_size(0), count(-1), raw(false), data(nullptr), length(0),
+#ifdef _WIN32
+  file(INVALID_HANDLE_VALUE), mapping(nullptr),
+#endif
+  stream(nullptr), newest(-1), ring(1)
+{
+}
+
+VideoReader::~VideoReader()
+{
+#ifdef _WIN32
+  if (data)
+    UnmapViewOfFile(data);
+
+  if (mapping)
+    CloseHandle(mapping);
+
+  if (file != INVALID_HANDLE_VALUE)
+    CloseHandle(file);
+#else
+  if (data)
+    munmap((void*)data, length);
+#endif
+
+  if (stream && stream != stdin)
+    fclose(stream);
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Open a file or stream
+//////////////////////////////////////////////////////////////////////////////
+bool VideoReader::Open(const char* path, const RawFormat* _raw, std::string& error)
+{
+  raw = _raw != nullptr;
+
+  if (strcmp(path, "-") == 0)
+  {
+#ifdef _WIN32
+    _setmode(_fileno(stdin), _O_BINARY);
+#endif
+    stream = stdin;
+  }
+  else
+  {
+#ifdef _WIN32
+    const DWORD type = GetFileAttributesA(path);
+    const bool regular = type != INVALID_FILE_ATTRIBUTES && !(type & FILE_ATTRIBUTE_DIRECTORY) && strncmp(path, "\\\\.\\pipe\\", 9) != 0;
+#else
+    struct stat st;
+    const bool regular = stat(path, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0;
+#endif
+
+    if (regular)
+    {
+      if (!MapFile(path, error))
+        return false;
+    }
+    else if (!(stream = fopen(path, "rb")))
+    {
+      error = std::string("Cannot open ") + path;
+      return false;
+    }
+  }
+
+  // Stream header
+  uint64_t position = 0;
+
+  if (raw)
+  {
+    format = *_raw;
+    header = "YUV4MPEG2 W" + std::to_string(format.width) + " H" + std::to_string(format.height) + " F25:1 Ip A1:1 " + y4m_colorspace(format);
+  }
+  else
+  {
+    std::string text;
+
+    if (stream)
+    {
+      int c;
+
+      while ((c = fgetc(stream)) != EOF && c != '\n')
+        text += (char)c;
+    }
+    else
+    {
+      while (position < length && data[position] != '\n')
+        text += (char)data[position++];
+
+      position++;
+    }
+
+    if (!ParseHeader(text, error))
+    {
+      error = std::string(path) + ": " + error;
+      return false;
+    }
+
+    header = text;
+  }
+
+  const uint64_t sample = GetSampleSize();
+
+  frame_size = (unsigned int)(format.width * format.height * sample);
+
+  if (format.subsampling_w >= 0)
+    frame_size = frame_size + 2 * GetPlaneWidth(1) * GetPlaneHeight(1) * (unsigned int)sample;
+
+  if (stream)
+    return true;
+
+  // Index all frames; Y4M frame headers may carry parameters, so their
+  // length is not fixed
+  while (position < length)
+  {
+    if (!raw)
+    {
+      if (length - position < 5 || memcmp(data + position, "FRAME", 5) != 0)
+        break;
+
+      while (position < length && data[position] != '\n')
+        position++;
+
+      position++;
+    }
+
+    if (position + frame_size > length)
+      break;
+
+    offsets.push_back(position);
+    position = position + frame_size;
+  }
+
+  count = (int)offsets.size();
+
+  if (count == 0)
+  {
+    error = std::string(path) + ": no complete frames found.";
+    return false;
+  }
+
+  return true;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// YUV4MPEG2 stream header
+//////////////////////////////////////////////////////////////////////////////
+bool VideoReader::ParseHeader(const std::string& text, std::string& error)
+{
+  if (text.compare(0, 10, "YUV4MPEG2 ") != 0)
+  {
+    error = "not a YUV4MPEG2 file.";
+    return false;
+  }
+
+  format.width = 0;
+  format.height = 0;
+  format.subsampling_w = 1;
+  format.subsampling_h = 1;
+  format.bits = 8;
+
+  size_t start = 10;
+
+  while (start < text.size())
+  {
+    size_t end = text.find(' ', start);
+
+    if (end == std::string::npos)
+      end = text.size();
+
+    const std::string token = text.substr(start, end - start);
+
+    if (!token.empty())
+    {
+      switch (token[0])
+      {
+      case 'W': format.width = atoi(token.c_str() + 1); break;
+      case 'H': format.height = atoi(token.c_str() + 1); break;
+      case 'C':
+        if (token.compare(1, 3, "420") == 0) { format.subsampling_w = 1; format.subsampling_h = 1; }
+        else if (token.compare(1, 3, "422") == 0) { format.subsampling_w = 1; format.subsampling_h = 0; }
+        else if (token.compare(1, 3, "444") == 0) { format.subsampling_w = 0; format.subsampling_h = 0; }
+        else if (token.compare(1, 4, "mono") == 0) { format.subsampling_w = -1; format.subsampling_h = -1; }
+        else
+        {
+          error = "unsupported colorspace " + token.substr(1);
+          return false;
+        }
+
+        // Bit depth suffix: 420p10, 444p16, mono16 ...
+        for (size_t i = 4; i < token.size(); i++)
+        {
+          if (isdigit((unsigned char)token[i]) && (token[i - 1] == 'p' || token.compare(1, 4, "mono") == 0))
+          {
+            format.bits = atoi(token.c_str() + i);
+            break;
+          }
+        }
+
+        if (token.find("alpha") != std::string::npos)
+        {
+          error = "alpha channel is not supported.";
+          return false;
+        }
+        break;
+      }
+    }
+
+    start = end + 1;
+  }
+
+  if (format.width <= 0 || format.height <= 0 || format.bits < 8 || format.bits > 16)
+  {
+    error = "invalid stream header.";
+    return false;
+  }
+
+  return true;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Plane layout
+//////////////////////////////////////////////////////////////////////////////
+int VideoReader::GetPlaneWidth(int plane) const
+{
+  if (plane == 0)
+    return format.width;
+
+  return (format.width + (1 << format.subsampling_w) - 1) >> format.subsampling_w;
+}
+
+int VideoReader::GetPlaneHeight(int plane) const
+{
+  if (plane == 0)
+    return format.height;
+
+  return (format.height + (1 << format.subsampling_h) - 1) >> format.subsampling_h;
+}
+
+unsigned int VideoReader::GetPlaneOffset(int plane) const
+{
+  const unsigned int sample = GetSampleSize();
+
+  if (plane == 0)
+    return 0;
+
+  return (format.width * format.height + (plane - 1) * GetPlaneWidth(1) * GetPlaneHeight(1)) * sample;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Frame access
+//////////////////////////////////////////////////////////////////////////////
+void VideoReader::SetHistory(int frames)
+{
+  ring.resize(frames < 1 ? 1 : frames);
+}
+
+bool VideoReader::HasFrame(int n)
+{
+  if (!stream)
+    return n < count;
+
+  std::lock_guard<std::mutex> guard(lock);
+
+  while (newest < n && ReadNext())
+  {
+  }
+
+  return n <= newest;
+}
+
+const unsigned char* VideoReader::GetFrame(int n)
+{
+  if (n < 0)
+    n = 0;
+
+  if (!stream)
+    return data + offsets[n < count ? n : count - 1];
+
+  std::lock_guard<std::mutex> guard(lock);
+
+  while (newest < n && ReadNext())
+  {
+  }
+
+  if (n > newest && count > 0)
+    n = count - 1;
+
+  if (n > newest || n <= newest - (int)ring.size())
+    return nullptr;
+
+  return ring[n % ring.size()].data();
+}
+
+// Called with the lock held
+bool VideoReader::ReadNext()
+{
+  if (count >= 0) // End of stream was already reached
+    return false;
+
+  if (!raw)
+  {
+    char tag[6] = { 0 };
+    int c;
+
+    if (fread(tag, 1, 5, stream) != 5 || strcmp(tag, "FRAME") != 0)
+    {
+      count = newest + 1;
+      return false;
+    }
+
+    while ((c = fgetc(stream)) != EOF && c != '\n')
+    {
+    }
+  }
+
+  std::vector<unsigned char>& buffer = ring[(newest + 1) % ring.size()];
+
+  buffer.resize(frame_size);
+
+  if (fread(buffer.data(), 1, frame_size, stream) != frame_size)
+  {
+    count = newest + 1;
+    return false;
+  }
+
+  newest++;
+
+  return true;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Platform specific file mapping
+//////////////////////////////////////////////////////////////////////////////
+#ifdef _WIN32
+bool VideoReader::MapFile(const char* path, std::string& error)
+{
+  file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+
+  LARGE_INTEGER size;
+
+  if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &size) || size.QuadPart == 0)
+  {
+    error = std::string("Cannot open ") + path;
+    return false;
+  }
+
+  mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+  data = mapping ? (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+
+  if (!data)
+  {
+    error = std::string("Cannot map ") + path;
+    return false;
+  }
+
+  length = size.QuadPart;
+
+  return true;
+}
+#else
+bool VideoReader::MapFile(const char* path, std::string& error)
+{
+  int fd = open(path, O_RDONLY);
+  struct stat st;
+
+  if (fd < 0 || fstat(fd, &st) != 0)
+  {
+    if (fd >= 0)
+      close(fd);
+
+    error = std::string("Cannot open ") + path;
+    return false;
+  }
+
+  void* ptr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd); // the mapping stays valid
+
+  if (ptr == MAP_FAILED)
+  {
+    error = std::string("Cannot map ") + path;
+    return false;
+  }
+
+  // Frames are mostly read front to back
+  madvise(ptr, st.st_size, MADV_SEQUENTIAL);
+
+  data = (const unsigned char*)ptr;
+  length = st.st_size;
+
+  return true;
+}
+#endif
+
+
+//////////////////////////////////////////////////////////////////////////////
+// YUV4MPEG2 output
+//////////////////////////////////////////////////////////////////////////////
+bool write_y4m_header(FILE* file, const std::string& header)
+{
+  return fprintf(file, "%s\n", header.c_str()) > 0;
+}
+
+bool write_y4m_frame(FILE* file, const unsigned char* frame, unsigned int size)
+{
+  return fwrite("FRAME\n", 1, 6, file) == 6 && fwrite(frame, 1, size, file) == size;
+}
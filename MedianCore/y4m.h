@@ -0,0 +1,108 @@
+#ifndef Y4M_H
+#define Y4M_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <mutex>
+
+//////////////////////////////////////////////////////////////////////////////
+// Raw layout description, used when the input has no Y4M header
+//////////////////////////////////////////////////////////////////////////////
+struct RawFormat
+{
+  int width;
+  int height;
+  int subsampling_w; // log2 of horizontal chroma subsampling, -1 = no chroma
+  int subsampling_h; // log2 of vertical chroma subsampling
+  int bits;          // 8..16
+};
+
+// Parses "WxH[:420|422|444|400][:bits]", returns false on syntax error
+bool parse_raw_format(const char* text, RawFormat& format);
+
+// "C420jpeg" style colorspace tag for a Y4M header
+std::string y4m_colorspace(const RawFormat& format);
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Reader for planar YUV input (YUV4MPEG2 or headerless raw)
+//
+// Regular files are memory mapped and frames are returned in place. Pipes
+// and other streams are read sequentially into a ring of frame buffers that
+// keeps the last SetHistory() frames available.
+//
+// Frames are stored with all planes back to back and no padding. Frame
+// numbers past the ends are clamped like AviSynth does.
+//////////////////////////////////////////////////////////////////////////////
+class VideoReader
+{
+public:
+  VideoReader();
+  ~VideoReader();
+
+  VideoReader(const VideoReader&) = delete;
+  VideoReader& operator=(const VideoReader&) = delete;
+
+  // path "-" reads stdin, raw == nullptr -> input must start with a YUV4MPEG2 header
+  bool Open(const char* path, const RawFormat* raw, std::string& error);
+
+  // Number of frames a stream keeps behind the newest one, must be set before reading
+  void SetHistory(int frames);
+
+  bool IsStream() const { return stream != nullptr; }
+
+  // Frame count, for streams only known after the end has been reached (-1 until then)
+  int GetFrameCount() const { return count; }
+
+  // False if frame n lies after the end of the input, may read ahead on streams
+  bool HasFrame(int n);
+
+  // nullptr on read errors, or if a stream no longer holds frame n
+  const unsigned char* GetFrame(int n);
+
+  const RawFormat& GetFormat() const { return format; }
+  const std::string& GetHeader() const { return header; }
+  unsigned int GetFrameSize() const { return frame_size; }
+  int GetSampleSize() const { return format.bits > 8 ? 2 : 1; }
+  int GetPlaneCount() const { return format.subsampling_w < 0 ? 1 : 3; }
+  int GetPlaneWidth(int plane) const;  // in samples
+  int GetPlaneHeight(int plane) const;
+  unsigned int GetPlaneOffset(int plane) const;
+
+private:
+  RawFormat format;
+  std::string header;
+  unsigned int frame_size;
+  int count;
+  bool raw;
+
+  // Regular files
+  const unsigned char* data;
+  uint64_t length;
+  std::vector<uint64_t> offsets; // position of each frame's data
+#ifdef _WIN32
+  void* file;
+  void* mapping;
+#endif
+
+  // Streams
+  FILE* stream;
+  std::mutex lock;
+  int newest;
+  std::vector<std::vector<unsigned char>> ring;
+
+  bool ParseHeader(const std::string& text, std::string& error);
+  bool MapFile(const char* path, std::string& error);
+  bool ReadNext();
+};
+
+
+//////////////////////////////////////////////////////////////////////////////
+// YUV4MPEG2 output
+//////////////////////////////////////////////////////////////////////////////
+bool write_y4m_header(FILE* file, const std::string& header);
+bool write_y4m_frame(FILE* file, const unsigned char* frame, unsigned int size);
+
+#endif // Y4M_H
@@ -0,0 +1,233 @@
+//////////////////////////////////////////////////////////////////////////////
+// Offline sync analysis for the Median filter
+//
+// Computes a whole-file offset track for every capture relative to the first
+// (reference) one, and writes it in the synccache format of the plugin.
+// Loading the result with Median(..., sync=radius, samples=samples,
+// synccache="map") replaces the runtime sync search by a table lookup.
+//
+// The plugin picks the best offset for every frame on its own. Here the
+// choice is made over the whole file with dynamic programming: every change
+// of offset costs a penalty, so single badly matching frames don't make the
+// track jump around, while real dropped or duplicated frames still do.
+//
+// With -fields every field gets a track of its own, for Median(fields=true).
+//////////////////////////////////////////////////////////////////////////////
+
+#include "y4m.h"
+#include "mediancore.h"
+#include "sync.h"
+#include "synccache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+static void usage()
+{
+  fprintf(stderr,
+    "Usage: syncmap [options] -o <map> <reference> <capture> [<capture> ...]\n"
+    "\n"
+    "Options:\n"
+    "  -o <file>      output sync map, load it with synccache=\"file\" (replaces a map)\n"
+    "  -r <radius>    search radius in frames (default 2), same as sync=\n"
+    "  -s <samples>   luma samples per comparison (default 4096), same as samples=\n"
+    "  -p <penalty>   score penalty per frame of offset change (default 1.0)\n"
+    "  -fields        offsets per field, same as fields=true\n"
+    "  -raw <format>  headerless planar input, WxH[:420|422|444|400][:bits]\n"
+    "  -v             list offset changes\n"
+    "  -              as input name: read from stdin\n");
+}
+
+
+static const char* field_name(bool fields, unsigned int field)
+{
+  return !fields ? "" : field == 0 ? " top" : " bottom";
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Entry point
+//////////////////////////////////////////////////////////////////////////////
+int main(int argc, char** argv)
+{
+  const char* output = nullptr;
+  int radius = 2;
+  int samples = 4096;
+  double penalty = 1.0;
+  bool verbose = false;
+  bool fields = false;
+  bool israw = false;
+  RawFormat raw;
+  std::vector<const char*> inputs;
+
+  for (int i = 1; i < argc; i++)
+  {
+    const char* arg = argv[i];
+    const bool more = i + 1 < argc;
+
+    if (strcmp(arg, "-o") == 0 && more) output = argv[++i];
+    else if (strcmp(arg, "-r") == 0 && more) radius = atoi(argv[++i]);
+    else if (strcmp(arg, "-s") == 0 && more) samples = atoi(argv[++i]);
+    else if (strcmp(arg, "-p") == 0 && more) penalty = atof(argv[++i]);
+    else if (strcmp(arg, "-v") == 0) verbose = true;
+    else if (strcmp(arg, "-fields") == 0) fields = true;
+    else if (strcmp(arg, "-raw") == 0 && more)
+    {
+      if (!parse_raw_format(argv[++i], raw))
+      {
+        fprintf(stderr, "syncmap: invalid raw format %s\n", argv[i]);
+        return 1;
+      }
+
+      israw = true;
+    }
+    else if (arg[0] == '-' && arg[1] != 0)
+    {
+      usage();
+      return 1;
+    }
+    else
+      inputs.push_back(arg);
+  }
+
+  if (!output || inputs.size() < 2 || inputs.size() > MAX_DEPTH || radius < 1 || radius > 1000 || samples < 0 || penalty < 0.0)
+  {
+    usage();
+    return 1;
+  }
+
+  // Open inputs, streams keep the frames of the search window
+  const unsigned int depth = (unsigned int)inputs.size();
+  const int count = 2 * radius + 1;
+  std::vector<VideoReader> readers(depth);
+
+  for (unsigned int i = 0; i < depth; i++)
+  {
+    std::string error;
+
+    if (!readers[i].Open(inputs[i], israw ? &raw : nullptr, error))
+    {
+      fprintf(stderr, "syncmap: %s\n", error.c_str());
+      return 1;
+    }
+
+    readers[i].SetHistory(count + 1);
+
+    if (readers[i].GetFormat().width != readers[0].GetFormat().width || readers[i].GetFormat().height != readers[0].GetFormat().height ||
+      readers[i].GetSampleSize() != readers[0].GetSampleSize())
+    {
+      fprintf(stderr, "syncmap: dimensions of all inputs must match.\n");
+      return 1;
+    }
+  }
+
+  // Similarity of every reference frame against the neighbourhood of each
+  // capture. The luma plane comes first in every frame. Fields are every
+  // other row, the scores of the second one follow at depth.
+  const unsigned int rowsize = readers[0].GetPlaneWidth(0) * readers[0].GetSampleSize();
+  const unsigned int height = readers[0].GetPlaneHeight(0);
+  const unsigned int length = rowsize * height;
+  const unsigned int views = fields ? 2 : 1;
+
+  std::vector<std::vector<float>> scores(views * depth);
+  int frames = 0;
+
+  for (int n = 0; readers[0].HasFrame(n); n++)
+  {
+    const unsigned char* reference = readers[0].GetFrame(n);
+
+    for (unsigned int i = 1; i < depth; i++)
+    {
+      for (int j = -radius; j <= radius; j++)
+      {
+        const unsigned char* candidate = readers[i].GetFrame(n + j);
+
+        if (!reference || !candidate)
+        {
+          fprintf(stderr, "syncmap: read error in %s\n", inputs[candidate ? 0 : i]);
+          return 1;
+        }
+
+        if (!fields)
+          scores[i].push_back((float)compare_samples(reference, candidate, length, samples));
+        else
+        {
+          for (unsigned int f = 0; f < 2; f++)
+            scores[f * depth + i].push_back((float)compare_rows(reference + f * rowsize, 2 * rowsize, candidate + f * rowsize, 2 * rowsize, rowsize, height / 2, samples));
+        }
+      }
+    }
+
+    frames = n + 1;
+
+    if (frames % 1000 == 0)
+      fprintf(stderr, "\rsyncmap: %d", frames);
+  }
+
+  fprintf(stderr, "\rsyncmap: %d frames\n", frames);
+
+  // Offset tracks
+  std::vector<std::vector<int>> tracks(views * depth, std::vector<int>(frames, 0));
+
+  for (unsigned int i = 1; i < views * depth; i++)
+  {
+    if (i == depth) // reference of the second field
+      continue;
+
+    find_sync_track(scores[i], frames, radius, penalty, tracks[i]);
+
+    unsigned int drops = 0;
+    unsigned int dups = 0;
+    double sum = 0.0;
+
+    for (int n = 0; n < frames; n++)
+    {
+      sum = sum + scores[i][(size_t)n * count + tracks[i][n] + radius];
+
+      if (n == 0 || tracks[i][n] == tracks[i][n - 1])
+        continue;
+
+      // A capture that lost a frame falls behind the reference and vice versa
+      const bool dropped = tracks[i][n] < tracks[i][n - 1];
+
+      if (dropped)
+        drops++;
+      else
+        dups++;
+
+      if (verbose)
+        printf("clip %u%s frame %d: offset %+d -> %+d (%s)\n", i % depth + 1, field_name(fields, i / depth), n, tracks[i][n - 1], tracks[i][n], dropped ? "dropped frame" : "duplicated frame");
+    }
+
+    printf("clip %u%s: start offset %+d, %u dropped, %u duplicated, mean score %f\n", i % depth + 1, field_name(fields, i / depth), tracks[i][0], drops, dups, sum / frames);
+  }
+
+  // Write sync map
+  SyncCache map;
+  std::string error;
+
+  if (!map.Open(output, views * depth, frames, radius, samples, fields, true, error))
+  {
+    fprintf(stderr, "syncmap: %s\n", error.c_str());
+    return 1;
+  }
+
+  int offset[2 * MAX_DEPTH];
+  double score[2 * MAX_DEPTH];
+
+  for (int n = 0; n < frames; n++)
+  {
+    for (unsigned int i = 0; i < views * depth; i++)
+    {
+      offset[i] = tracks[i][n];
+      score[i] = i % depth == 0 ? 100.0 : scores[i][(size_t)n * count + tracks[i][n] + radius];
+    }
+
+    map.Store(n, offset, score);
+  }
+
+  return 0;
+}
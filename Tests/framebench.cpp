@@ -0,0 +1,454 @@
+//////////////////////////////////////////////////////////////////////////////
+// Frame throughput benchmark through the headless host
+//
+// Drives the whole GetFrame path of Median, MedianBlend and TemporalMedian
+// on synthetic captures with known offsets, noise and dropouts: source
+// fetch, sync search, planar or interleaved processing and the debug
+// overlay. Thread counts emulate Prefetch(n), every worker thread gets its
+// own filter instance like AviSynth+ does for multi instance filters.
+//
+// Stage times are averages per frame over all workers. Fetch is the time
+// spent in the sources (generation of the synthetic frames, like decoding),
+// sync and overlay are the extra time of a run with sync or debug enabled
+// over a plain run, process is the rest of the plain run.
+//
+//   framebench [-frames n] [-size SD,HD,4K,WxH] [-format YV12,YUY2,...]
+//              [-threads 1,4,...] [-clips n] [-sync radius] [-syncthreads n]
+//              [-seed n] [-csv] [-quick] [plugin]
+//////////////////////////////////////////////////////////////////////////////
+
+#include "mockhost.h"
+#include "synthclip.h"
+#include "mediancore.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <exception>
+
+struct Format
+{
+  const char* name;
+  int pixel_type;
+};
+
+static const Format formats[] =
+{
+  { "YV12", VideoInfo::CS_YV12 },
+  { "YV24", VideoInfo::CS_YV24 },
+  { "YUV420P10", VideoInfo::CS_YUV420P10 },
+  { "YUV420P16", VideoInfo::CS_YUV420P16 },
+  { "YUV420PS", VideoInfo::CS_YUV420PS },
+  { "YUY2", VideoInfo::CS_YUY2 },
+  { "RGB32", VideoInfo::CS_BGR32 },
+  { "RGB64", VideoInfo::CS_BGR64 },
+};
+
+struct Size
+{
+  std::string name;
+  int width;
+  int height;
+};
+
+struct Options
+{
+  int frames;
+  std::vector<Size> sizes;
+  std::vector<Format> formats;
+  std::vector<int> threads;
+  int clips;
+  int sync;
+  int syncthreads;
+  uint32_t seed;
+  bool csv;
+};
+
+typedef std::vector<std::pair<const char*, AVSValue>> Named;
+
+static PClip invoke(ScriptEnvironment& env, const char* name, const std::vector<PClip>& clips, const Named& named)
+{
+  std::vector<AVSValue> args;
+  std::vector<const char*> names;
+
+  for (const PClip& clip : clips)
+  {
+    args.push_back(clip);
+    names.push_back(nullptr);
+  }
+
+  for (const auto& arg : named)
+  {
+    args.push_back(arg.second);
+    names.push_back(arg.first);
+  }
+
+  return env.Invoke(name, AVSValue(args.data(), (int)args.size()), names.data()).AsClip();
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Source wrapper that adds up the time spent in its child
+//////////////////////////////////////////////////////////////////////////////
+class TimedClip : public GenericVideoFilter
+{
+public:
+  TimedClip(PClip _child, std::atomic<int64_t>& _nanoseconds) : GenericVideoFilter(_child), nanoseconds(_nanoseconds) {}
+
+  PVideoFrame __stdcall GetFrame(int n, IScriptEnvironment* env) override
+  {
+    const auto start = std::chrono::steady_clock::now();
+    PVideoFrame frame = child->GetFrame(n, env);
+    nanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    return frame;
+  }
+
+private:
+  std::atomic<int64_t>& nanoseconds;
+};
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Single run
+//////////////////////////////////////////////////////////////////////////////
+struct Run
+{
+  double fps;
+  double latency; // ms per frame and worker
+  double fetch;   // ms per frame spent in the sources
+  double peak;    // MB of frame buffers
+};
+
+// Capture offsets 0, +1, -1, +2, -2, ... within the sync radius
+static int capture_offset(int i, int radius)
+{
+  const int offset = (i + 1) / 2 * (i % 2 ? 1 : -1);
+  return radius > 0 ? std::max(-radius, std::min(radius, offset)) : 0;
+}
+
+static Run run(ScriptEnvironment& env, const Options& options, const char* function, const Format& format, const Size& size, int threads, const Named& named)
+{
+  const bool temporal = strcmp(function, "TemporalMedian") == 0;
+  const int count = temporal ? 1 : options.clips;
+  const int sync = options.sync;
+
+  std::atomic<int64_t> fetch(0);
+  std::atomic<int64_t> latency(0);
+
+  ScriptEnvironment::ResetMemoryPeak();
+  const int64_t baseline = ScriptEnvironment::GetMemoryUsed();
+
+  std::vector<PClip> sources;
+
+  for (int i = 0; i < count; i++)
+  {
+    SyntheticParams params = { options.seed * 1000u + i, capture_offset(i, sync), 6, 20 };
+    PClip clip = new SyntheticClip(make_video_info(format.pixel_type, size.width, size.height, options.frames + 2 * sync), params);
+    sources.push_back(new TimedClip(clip, fetch));
+  }
+
+  std::vector<PClip> instances;
+
+  for (int t = 0; t < threads; t++)
+    instances.push_back(invoke(env, function, sources, named));
+
+  std::atomic<int> next(0);
+  std::exception_ptr error[64];
+
+  auto worker = [&](int t)
+  {
+    try
+    {
+      for (int n = next++; n < options.frames; n = next++)
+      {
+        const auto start = std::chrono::steady_clock::now();
+        instances[t]->GetFrame(n, &env);
+        latency += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+      }
+    }
+    catch (...)
+    {
+      error[t] = std::current_exception();
+    }
+  };
+
+  const auto start = std::chrono::steady_clock::now();
+
+  std::vector<std::thread> pool;
+
+  for (int t = 1; t < threads; t++)
+    pool.emplace_back(worker, t);
+
+  worker(0);
+
+  for (auto& thread : pool)
+    thread.join();
+
+  const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  for (int t = 0; t < threads; t++)
+  {
+    if (error[t])
+      std::rethrow_exception(error[t]);
+  }
+
+  Run result;
+  result.fps = options.frames / std::max(seconds, 1e-9);
+  result.latency = latency / 1e6 / options.frames;
+  result.fetch = fetch / 1e6 / options.frames;
+  result.peak = (ScriptEnvironment::GetMemoryPeak() - baseline) / (1024.0 * 1024.0);
+
+  return result;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Stage breakdown of one configuration
+//////////////////////////////////////////////////////////////////////////////
+static void print_header(const Options& options)
+{
+  if (options.csv)
+    printf("function,format,size,threads,fps,fps_sync,fetch_ms,process_ms,sync_ms,overlay_ms,peak_mb\n");
+  else
+    printf("%-15s %-10s %-10s %7s %8s %8s %9s %10s %8s %10s %9s\n", "function", "format", "size", "threads", "fps", "fps sync", "fetch ms", "process ms", "sync ms", "overlay ms", "peak MB");
+}
+
+static void benchmark(ScriptEnvironment& env, const Options& options, const char* function, const Format& format, const Size& size, int threads)
+{
+  const bool temporal = strcmp(function, "TemporalMedian") == 0;
+
+  Named base;
+
+  if (temporal)
+    base.push_back({ "radius", AVSValue(options.sync > 0 ? options.sync : 2) });
+
+  Named synced = base;
+  synced.push_back({ "sync", AVSValue(options.sync) });
+  synced.push_back({ "threads", AVSValue(options.syncthreads) });
+
+  Named debug = base;
+  debug.push_back({ "debug", AVSValue(true) });
+
+  const Run plain = run(env, options, function, format, size, threads, base);
+  const Run overlay = run(env, options, function, format, size, threads, debug);
+  const bool has_sync = !temporal && options.sync > 0;
+  const Run sync = has_sync ? run(env, options, function, format, size, threads, synced) : plain;
+
+  // Time outside the sources
+  const double process = std::max(plain.latency - plain.fetch, 0.0);
+  const double sync_time = std::max(sync.latency - sync.fetch - process, 0.0);
+  const double overlay_time = std::max(overlay.latency - overlay.fetch - process, 0.0);
+  const double peak = std::max(plain.peak, sync.peak);
+
+  char fps_sync[32] = "-";
+
+  if (has_sync)
+    snprintf(fps_sync, sizeof(fps_sync), "%.2f", sync.fps);
+
+  if (options.csv)
+    printf("%s,%s,%s,%d,%.3f,%s,%.3f,%.3f,%.3f,%.3f,%.1f\n", function, format.name, size.name.c_str(), threads, plain.fps, fps_sync, plain.fetch, process, sync_time, overlay_time, peak);
+  else
+    printf("%-15s %-10s %-10s %7d %8.2f %8s %9.2f %10.2f %8.2f %10.2f %9.1f\n", function, format.name, size.name.c_str(), threads, plain.fps, fps_sync, plain.fetch, process, sync_time, overlay_time, peak);
+
+  fflush(stdout);
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Entry point
+//////////////////////////////////////////////////////////////////////////////
+static void usage()
+{
+  fprintf(stderr,
+    "Usage: framebench [options] [plugin]\n"
+    "\n"
+    "Options:\n"
+    "  -frames <n>       frames per run (default 20)\n"
+    "  -size <list>      SD, HD, 4K or WxH (default SD,HD,4K)\n"
+    "  -format <list>    YV12, YV24, YUV420P10, YUV420P16, YUV420PS, YUY2, RGB32, RGB64\n"
+    "                    (default YV12,YUY2)\n"
+    "  -threads <list>   worker threads, each with its own instance (default 1,<cores>)\n"
+    "  -clips <n>        captures for Median and MedianBlend (default 5)\n"
+    "  -sync <radius>    sync radius, also the capture offsets and temporal radius (default 2)\n"
+    "  -syncthreads <n>  threads argument of the filter (default 1)\n"
+    "  -seed <n>         generator seed (default 1)\n"
+    "  -csv              comma separated output\n"
+    "  -quick            tiny run that only checks everything works\n");
+}
+
+static std::vector<std::string> split(const char* text)
+{
+  std::vector<std::string> items;
+  std::string item;
+
+  for (const char* p = text; ; p++)
+  {
+    if (*p == ',' || *p == 0)
+    {
+      if (!item.empty())
+        items.push_back(item);
+
+      item.clear();
+
+      if (*p == 0)
+        break;
+    }
+    else
+      item += *p;
+  }
+
+  return items;
+}
+
+static bool parse_sizes(const char* text, std::vector<Size>& sizes)
+{
+  sizes.clear();
+
+  for (const std::string& item : split(text))
+  {
+    Size size = { item, 0, 0 };
+
+    if (item == "SD") { size.width = 720; size.height = 576; }
+    else if (item == "HD") { size.width = 1920; size.height = 1080; }
+    else if (item == "4K") { size.width = 3840; size.height = 2160; }
+    else if (sscanf(item.c_str(), "%dx%d", &size.width, &size.height) != 2 || size.width < 16 || size.height < 16 || size.width % 4 || size.height % 2)
+      return false;
+
+    sizes.push_back(size);
+  }
+
+  return !sizes.empty();
+}
+
+static bool parse_formats(const char* text, std::vector<Format>& selected)
+{
+  selected.clear();
+
+  for (const std::string& item : split(text))
+  {
+    auto it = std::find_if(std::begin(formats), std::end(formats), [&](const Format& format) { return item == format.name; });
+
+    if (it == std::end(formats))
+      return false;
+
+    selected.push_back(*it);
+  }
+
+  return !selected.empty();
+}
+
+static bool parse_threads(const char* text, std::vector<int>& threads)
+{
+  threads.clear();
+
+  for (const std::string& item : split(text))
+  {
+    const int count = atoi(item.c_str());
+
+    if (count < 1 || count > 64)
+      return false;
+
+    threads.push_back(count);
+  }
+
+  return !threads.empty();
+}
+
+int main(int argc, char** argv)
+{
+  const char* plugin = AJKMEDIAN_PLUGIN;
+
+  Options options;
+  options.frames = 20;
+  options.clips = 5;
+  options.sync = 2;
+  options.syncthreads = 1;
+  options.seed = 1;
+  options.csv = false;
+
+  parse_sizes("SD,HD,4K", options.sizes);
+  parse_formats("YV12,YUY2", options.formats);
+
+  const int cores = (int)std::min(64U, std::max(1U, std::thread::hardware_concurrency()));
+
+  options.threads.push_back(1);
+
+  if (cores > 1)
+    options.threads.push_back(cores);
+
+  for (int i = 1; i < argc; i++)
+  {
+    const char* arg = argv[i];
+    const bool more = i + 1 < argc;
+    bool ok = true;
+
+    if (strcmp(arg, "-frames") == 0 && more) ok = (options.frames = atoi(argv[++i])) > 0;
+    else if (strcmp(arg, "-size") == 0 && more) ok = parse_sizes(argv[++i], options.sizes);
+    else if (strcmp(arg, "-format") == 0 && more) ok = parse_formats(argv[++i], options.formats);
+    else if (strcmp(arg, "-threads") == 0 && more) ok = parse_threads(argv[++i], options.threads);
+    else if (strcmp(arg, "-clips") == 0 && more) ok = (options.clips = atoi(argv[++i])) >= 3 && options.clips <= (int)MAX_DEPTH && options.clips % 2;
+    else if (strcmp(arg, "-sync") == 0 && more) ok = (options.sync = atoi(argv[++i])) >= 0 && options.sync <= (int)(MAX_DEPTH - 1) / 2;
+    else if (strcmp(arg, "-syncthreads") == 0 && more) ok = (options.syncthreads = atoi(argv[++i])) >= 0;
+    else if (strcmp(arg, "-seed") == 0 && more) options.seed = (uint32_t)strtoul(argv[++i], nullptr, 10);
+    else if (strcmp(arg, "-csv") == 0) options.csv = true;
+    else if (strcmp(arg, "-quick") == 0)
+    {
+      options.frames = 4;
+      parse_sizes("176x144", options.sizes);
+      parse_formats("YV12,YUY2", options.formats);
+      options.threads = { 1, 2 };
+    }
+    else if (arg[0] != '-')
+      plugin = arg;
+    else
+      ok = false;
+
+    if (!ok)
+    {
+      usage();
+      return 1;
+    }
+  }
+
+  ScriptEnvironment env;
+  std::string error;
+
+  if (!env.LoadPlugin(plugin, error))
+  {
+    fprintf(stderr, "framebench: %s\n", error.c_str());
+    return 1;
+  }
+
+  if (!options.csv)
+    printf("%d frames, %d captures, sync radius %d, seed %u\n\n", options.frames, options.clips, options.sync, options.seed);
+
+  print_header(options);
+
+  try
+  {
+    for (const Size& size : options.sizes)
+      for (const Format& format : options.formats)
+        for (const char* function : { "Median", "MedianBlend", "TemporalMedian" })
+          for (int threads : options.threads)
+            benchmark(env, options, function, format, size, threads);
+  }
+  catch (const AvisynthError& e)
+  {
+    fprintf(stderr, "framebench: %s\n", e.msg);
+    return 1;
+  }
+
+  if (ScriptEnvironment::GetMemoryUsed() != 0)
+  {
+    fprintf(stderr, "framebench: frame buffers leaked\n");
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,1449 @@
+//////////////////////////////////////////////////////////////////////////////
+// Plugin test through the headless host
+//
+// Loads the plugin, creates Median, MedianBlend and TemporalMedian on
+// synthetic captures and compares GetFrame output with a plain sort of the
+// source samples. Also checks argument validation, the sync search against
+// captures with known offsets, passthrough of identical sources, lazy
+// fetching, the adaptive median of 3, exclusion of blank captures, plane
+// modes, argmedian chroma, output written in place, and reports GetFrame
+// timings.
+//
+//   hosttest [plugin]
+//////////////////////////////////////////////////////////////////////////////
+
+#include "mockhost.h"
+#include "synthclip.h"
+#include "mediancore.h"
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <chrono>
+#include <type_traits>
+#include <filesystem>
+
+static const int WIDTH = 94;
+static const int HEIGHT = 38;
+static const int FRAMES = 30;
+
+struct Format
+{
+  const char* name;
+  int pixel_type;
+};
+
+static const Format formats[] =
+{
+  { "YV12", VideoInfo::CS_YV12 },
+  { "YV16", VideoInfo::CS_YV16 },
+  { "YV24", VideoInfo::CS_YV24 },
+  { "Y8", VideoInfo::CS_Y8 },
+  { "YUV420P10", VideoInfo::CS_YUV420P10 },
+  { "YUV444P16", VideoInfo::CS_YUV444P16 },
+  { "YUV420PS", VideoInfo::CS_YUV420PS },
+  { "RGBP16", VideoInfo::CS_RGBP16 },
+  { "YUY2", VideoInfo::CS_YUY2 },
+  { "RGB24", VideoInfo::CS_BGR24 },
+  { "RGB32", VideoInfo::CS_BGR32 },
+  { "RGB64", VideoInfo::CS_BGR64 },
+};
+
+static int failures = 0;
+
+static void report(const std::string& name, bool ok, const std::string& detail = "")
+{
+  printf("%-48s %s%s%s\n", name.c_str(), ok ? "ok" : "FAIL", detail.empty() ? "" : ": ", detail.c_str());
+
+  if (!ok)
+    failures++;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Filter creation
+//////////////////////////////////////////////////////////////////////////////
+typedef std::vector<std::pair<const char*, AVSValue>> Named;
+
+static PClip invoke(ScriptEnvironment& env, const char* name, const std::vector<PClip>& clips, const Named& named = Named())
+{
+  std::vector<AVSValue> args;
+  std::vector<const char*> names;
+
+  for (const PClip& clip : clips)
+  {
+    args.push_back(clip);
+    names.push_back(nullptr);
+  }
+
+  for (const auto& arg : named)
+  {
+    args.push_back(arg.second);
+    names.push_back(arg.first);
+  }
+
+  return env.Invoke(name, AVSValue(args.data(), (int)args.size()), names.data()).AsClip();
+}
+
+static std::vector<PClip> make_clips(int pixel_type, int count, const std::vector<int>& offsets = std::vector<int>())
+{
+  std::vector<PClip> clips;
+
+  for (int i = 0; i < count; i++)
+  {
+    SyntheticParams params = { 1000u + i, i < (int)offsets.size() ? offsets[i] : 0, 6, 20 };
+    clips.push_back(new SyntheticClip(make_video_info(pixel_type, WIDTH, HEIGHT, FRAMES), params));
+  }
+
+  return clips;
+}
+
+// Sync cache files go to the temp directory
+static std::string temp_file(const char* name)
+{
+  return (std::filesystem::temp_directory_path() / name).string();
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Reference
+//
+// Sorts the values of every sample position and averages the ones between
+// low and high, the way the filter is documented to work. Samples that
+// aren't processed have to equal the first source.
+//////////////////////////////////////////////////////////////////////////////
+template<typename T>
+static T reference(std::vector<T> values, int low, int high)
+{
+  const int depth = (int)values.size();
+  const int blend = depth - low - high;
+
+  if (blend != depth)
+    std::sort(values.begin(), values.end());
+
+  if constexpr (std::is_same<T, float>::value)
+  {
+    float sum = 0.0f;
+
+    for (int i = low; i < low + blend; i++)
+      sum = sum + values[i];
+
+    return sum / blend;
+  }
+  else
+  {
+    unsigned int sum = 0;
+
+    for (int i = low; i < low + blend; i++)
+      sum = sum + values[i];
+
+    return (T)(sum / blend);
+  }
+}
+
+// channels: samples per pixel, passthrough: mask of channels copied from the first source
+template<typename T>
+static bool compare_plane(const std::vector<PVideoFrame>& src, const PVideoFrame& dst, int plane, int low, int high,
+                          int channels, unsigned int passthrough, std::string& detail)
+{
+  const int width = dst->GetRowSize(plane) / (int)sizeof(T);
+  const int height = dst->GetHeight(plane);
+
+  std::vector<T> values(src.size());
+
+  for (int y = 0; y < height; y++)
+  {
+    const T* out = reinterpret_cast<const T*>(dst->GetReadPtr(plane) + y * dst->GetPitch(plane));
+
+    for (int x = 0; x < width; x++)
+    {
+      for (size_t i = 0; i < src.size(); i++)
+        values[i] = reinterpret_cast<const T*>(src[i]->GetReadPtr(plane) + y * src[i]->GetPitch(plane))[x];
+
+      const T expected = passthrough & (1u << (x % channels)) ? values[0] : reference(values, low, high);
+
+      if (out[x] != expected)
+      {
+        char buffer[128];
+        snprintf(buffer, sizeof(buffer), "plane %d x %d y %d: %g, expected %g", plane, x, y, (double)out[x], (double)expected);
+        detail = buffer;
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+static bool compare_frame(const VideoInfo& vi, const std::vector<PVideoFrame>& src, const PVideoFrame& dst, int low, int high, bool chroma, std::string& detail)
+{
+  if (vi.IsPlanar())
+  {
+    static const int planes[] = { PLANAR_Y, PLANAR_U, PLANAR_V };
+
+    for (int plane : planes)
+    {
+      const unsigned int passthrough = plane != PLANAR_Y && !chroma ? 1 : 0;
+      bool ok;
+
+      switch (vi.ComponentSize())
+      {
+      case 1: ok = compare_plane<uint8_t>(src, dst, plane, low, high, 1, passthrough, detail); break;
+      case 2: ok = compare_plane<uint16_t>(src, dst, plane, low, high, 1, passthrough, detail); break;
+      default: ok = compare_plane<float>(src, dst, plane, low, high, 1, passthrough, detail); break;
+      }
+
+      if (!ok)
+        return false;
+    }
+
+    return true;
+  }
+
+  // Interleaved: U/V of YUY2 and alpha of RGB32/RGB64 follow the chroma setting
+  if (vi.IsYUY2())
+    return compare_plane<uint8_t>(src, dst, 0, low, high, 2, chroma ? 0 : 2, detail);
+  else if (vi.IsRGB24())
+    return compare_plane<uint8_t>(src, dst, 0, low, high, 3, 0, detail);
+  else if (vi.IsRGB32())
+    return compare_plane<uint8_t>(src, dst, 0, low, high, 4, chroma ? 0 : 8, detail);
+  else
+    return compare_plane<uint16_t>(src, dst, 0, low, high, 4, chroma ? 0 : 8, detail);
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Tests
+//////////////////////////////////////////////////////////////////////////////
+static void test_output(ScriptEnvironment& env, const Format& format, const char* function, int count, int low, int high, bool chroma, int radius, bool tune = false)
+{
+  const bool temporal = strcmp(function, "TemporalMedian") == 0;
+
+  char name[128];
+  snprintf(name, sizeof(name), "%s %s %d/%d/%d%s%s", function, format.name, temporal ? 2 * radius + 1 : count, low, high, chroma ? "" : " nochroma", tune ? " tune" : "");
+
+  try
+  {
+    std::vector<PClip> clips = make_clips(format.pixel_type, temporal ? 1 : count);
+    Named named = { { "chroma", AVSValue(chroma) }, { "tune", AVSValue(tune) } };
+
+    if (temporal)
+      named.push_back({ "radius", AVSValue(radius) });
+    else if (strcmp(function, "MedianBlend") == 0)
+    {
+      named.push_back({ "low", AVSValue(low) });
+      named.push_back({ "high", AVSValue(high) });
+    }
+
+    PClip filter = invoke(env, function, clips, named);
+    const VideoInfo& vi = filter->GetVideoInfo();
+
+    for (int n : { 0, 1, FRAMES / 2, FRAMES - 1 })
+    {
+      std::vector<PVideoFrame> src;
+
+      for (int i = 0; i < (temporal ? 2 * radius + 1 : count); i++)
+        src.push_back(temporal ? clips[0]->GetFrame(n - radius + i, &env) : clips[i]->GetFrame(n, &env));
+
+      PVideoFrame dst = filter->GetFrame(n, &env);
+      std::string detail;
+
+      if (!compare_frame(vi, src, dst, temporal ? radius : low, temporal ? radius : high, chroma, detail))
+      {
+        report(name, false, "frame " + std::to_string(n) + " " + detail);
+        return;
+      }
+    }
+
+    report(name, true);
+  }
+  catch (const AvisynthError& e)
+  {
+    report(name, false, e.msg);
+  }
+}
+
+static void test_sync(ScriptEnvironment& env, int threads)
+{
+  const std::vector<int> offsets = { 0, 2, -1, 1, -2 };
+  const int sync = 3;
+
+  std::string name = "Median sync " + std::to_string(sync) + " threads " + std::to_string(threads);
+
+  try
+  {
+    std::vector<PClip> clips = make_clips(VideoInfo::CS_YV12, (int)offsets.size(), offsets);
+    PClip filter = invoke(env, "Median", clips, { { "sync", AVSValue(sync) }, { "threads", AVSValue(threads) } });
+
+    for (int n = 5; n < FRAMES - 5; n += 7)
+    {
+      // Capture i shows the scene of frame n at its frame n - offset
+      std::vector<PVideoFrame> src;
+
+      for (size_t i = 0; i < clips.size(); i++)
+        src.push_back(clips[i]->GetFrame(n - offsets[i], &env));
+
+      PVideoFrame dst = filter->GetFrame(n, &env);
+      std::string detail;
+
+      if (!compare_frame(filter->GetVideoInfo(), src, dst, 2, 2, true, detail))
+      {
+        report(name, false, "frame " + std::to_string(n) + " " + detail);
+        return;
+      }
+    }
+
+    report(name, true);
+  }
+  catch (const AvisynthError& e)
+  {
+    report(name, false, e.msg);
+  }
+}
+
+// A reopened sync cache replaces the search: the second filter requests every
+// capture once per frame, at the offset the first one found
+static void test_synccache(ScriptEnvironment& env)
+{
+  const std::vector<int> offsets = { 0, 2, -1, 1, -2 };
+  const std::vector<int> frames = { 5, 12, 19 };
+  const std::string path = temp_file("hosttest_reopen.sync");
+  const std::string name = "Median synccache reopened";
+
+  remove(path.c_str());
+
+  try
+  {
+    std::vector<SyntheticClip*> captures;
+    std::vector<PClip> clips;
+
+    for (int i = 0; i < (int)offsets.size(); i++)
+    {
+      SyntheticParams params = { 1000u + i, offsets[i], 6, 20 };
+      captures.push_back(new SyntheticClip(make_video_info(VideoInfo::CS_YV12, WIDTH, HEIGHT, FRAMES), params));
+      clips.push_back(captures.back());
+    }
+
+    const Named named = { { "sync", AVSValue(3) }, { "synccache", AVSValue(path.c_str()) } };
+    std::string detail;
+    bool ok = true;
+
+    for (int pass = 0; pass < 2 && ok; pass++)
+    {
+      PClip filter = invoke(env, "Median", clips, named);
+
+      for (int n : frames)
+      {
+        std::vector<long> before;
+
+        for (SyntheticClip* capture : captures)
+          before.push_back(capture->GetRequests());
+
+        PVideoFrame dst = filter->GetFrame(n, &env);
+
+        // Searched: every candidate of the radius, cached: the offset alone
+        for (size_t i = 1; i < captures.size() && ok; i++)
+        {
+          const long requests = captures[i]->GetRequests() - before[i];
+
+          if (pass == 0 ? requests < 7 : requests != 1)
+          {
+            ok = false;
+            detail = "pass " + std::to_string(pass + 1) + " frame " + std::to_string(n) + " clip " + std::to_string(i + 1) + ": " + std::to_string(requests) + " requests";
+          }
+        }
+
+        std::vector<PVideoFrame> src;
+
+        for (size_t i = 0; i < clips.size(); i++)
+          src.push_back(clips[i]->GetFrame(n - offsets[i], &env));
+
+        if (ok && !compare_frame(filter->GetVideoInfo(), src, dst, 2, 2, true, detail))
+        {
+          ok = false;
+          detail = "pass " + std::to_string(pass + 1) + " frame " + std::to_string(n) + " " + detail;
+        }
+
+        if (!ok)
+          break;
+      }
+    }
+
+    report(name, ok, detail);
+  }
+  catch (const AvisynthError& e)
+  {
+    report(name, false, e.msg);
+  }
+
+  remove(path.c_str());
+}
+
+// Sources that are the same picture come back as the first source frame
+static void test_passthrough(ScriptEnvironment& env)
+{
+  const VideoInfo vi = make_video_info(VideoInfo::CS_YV12, WIDTH, HEIGHT, FRAMES);
+  const SyntheticParams params = { 7, 0, 6, 20 };
+
+  PClip clip = new SyntheticClip(vi, params);
+  PClip copy1 = new SyntheticClip(vi, params);
+  PClip copy2 = new SyntheticClip(vi, params);
+  PClip other = new SyntheticClip(vi, { 8, 0, 6, 20 });
+
+  struct PassCase
+  {
+    const char* name;
+    std::vector<PClip> clips;
+    bool identical;
+    bool passthrough;
+  };
+
+  const PassCase cases[] =
+  {
+    { "Median passthrough, same clip", { clip, clip, clip }, false, true },
+    { "Median passthrough, equal content", { clip, copy1, copy2 }, true, true },
+    { "Median no passthrough, equal content unchecked", { clip, copy1, copy2 }, false, false },
+    { "Median no passthrough, one clip differs", { clip, copy1, other }, true, false },
+  };
+
+  for (const PassCase& c : cases)
+  {
+    try
+    {
+      PClip filter = invoke(env, "Median", c.clips, { { "identical", AVSValue(c.identical) } });
+      bool ok = true;
+
+      for (int n : { 0, FRAMES / 2 })
+      {
+        std::vector<PVideoFrame> src;
+
+        for (const PClip& source : c.clips)
+          src.push_back(source->GetFrame(n, &env));
+
+        PVideoFrame dst = filter->GetFrame(n, &env);
+        std::string detail;
+
+        ok = ok && compare_frame(vi, src, dst, 1, 1, true, detail);
+        ok = ok && (dst->GetReadPtr() == src[0]->GetReadPtr()) == c.passthrough;
+      }
+
+      report(c.name, ok);
+    }
+    catch (const AvisynthError& e)
+    {
+      report(c.name, false, e.msg);
+    }
+  }
+
+  // Float blends are processed, their average of equal values may be an ulp off
+  try
+  {
+    const VideoInfo fvi = make_video_info(VideoInfo::CS_YUV420PS, WIDTH, HEIGHT, FRAMES);
+    PClip fclip = new SyntheticClip(fvi, params);
+    PClip filter = invoke(env, "MedianBlend", { fclip, fclip, fclip }, { { "low", AVSValue(0) }, { "high", AVSValue(0) } });
+    bool ok = true;
+    std::string detail;
+
+    for (int n : { 0, FRAMES / 2 })
+    {
+      std::vector<PVideoFrame> src(3, fclip->GetFrame(n, &env));
+      PVideoFrame dst = filter->GetFrame(n, &env);
+
+      ok = ok && dst->GetReadPtr() != src[0]->GetReadPtr() && compare_frame(fvi, src, dst, 0, 0, true, detail);
+    }
+
+    report("MedianBlend float, same clip processed", ok, detail);
+  }
+  catch (const AvisynthError& e)
+  {
+    report("MedianBlend float, same clip processed", false, e.msg);
+  }
+
+  // The overlay goes to a copy, not into the source frame
+  try
+  {
+    PClip filter = invoke(env, "Median", { clip, clip, clip }, { { "debug", AVSValue(true) } });
+    PVideoFrame dst = filter->GetFrame(3, &env);
+    PVideoFrame src = clip->GetFrame(3, &env);
+    PVideoFrame fresh = copy1->GetFrame(3, &env);
+
+    bool ok = dst->GetReadPtr() != src->GetReadPtr();
+
+    for (int y = 0; y < HEIGHT && ok; y++)
+      ok = memcmp(src->GetReadPtr() + y * src->GetPitch(), fresh->GetReadPtr() + y * fresh->GetPitch(), WIDTH) == 0;
+
+    report("Median passthrough with debug", ok);
+  }
+  catch (const AvisynthError& e)
+  {
+    report("Median passthrough with debug", false, e.msg);
+  }
+}
+
+// lazy=3: the last clips are only fetched when the first three disagree
+static void test_lazy(ScriptEnvironment& env, int sync)
+{
+  const std::vector<int> offsets = { 0, 1, -1, 2, 0 };
+
+  struct LazyCase
+  {
+    const char* name;
+    double agreement;
+    bool consensus;
+  };
+
+  const LazyCase cases[] =
+  {
+    { "Median lazy 3 of 5, agreeing", 0.0, true },
+    { "Median lazy 3 of 5, disagreeing", 100.0, false },
+  };
+
+  for (const LazyCase& c : cases)
+  {
+    const std::string name = std::string(c.name) + (sync ? ", sync" : "");
+
+    try
+    {
+      std::vector<SyntheticClip*> captures;
+      std::vector<PClip> clips;
+
+      for (int i = 0; i < 5; i++)
+      {
+        SyntheticParams params = { 1000u + i, sync ? offsets[i] : 0, 6, 20 };
+        captures.push_back(new SyntheticClip(make_video_info(VideoInfo::CS_YV12, WIDTH, HEIGHT, FRAMES), params));
+        clips.push_back(captures.back());
+      }
+
+      Named named = { { "lazy", AVSValue(3) }, { "agreement", AVSValue(c.agreement) } };
+
+      if (sync)
+        named.push_back({ "sync", AVSValue(sync) });
+
+      PClip filter = invoke(env, "Median", clips, named);
+      bool ok = true;
+      std::string detail;
+
+      for (int n = 5; n < FRAMES - 5 && ok; n += 7)
+      {
+        PVideoFrame dst = filter->GetFrame(n, &env);
+
+        // Reference frames are fetched after the filter, so they don't count
+        std::vector<PVideoFrame> src;
+
+        for (size_t i = 0; i < (c.consensus ? 3 : clips.size()); i++)
+          src.push_back(clips[i]->GetFrame(n - (sync ? offsets[i] : 0), &env));
+
+        ok = compare_frame(filter->GetVideoInfo(), src, dst, (int)src.size() / 2, (int)src.size() / 2, true, detail);
+      }
+
+      for (size_t i = 3; i < clips.size() && ok; i++)
+      {
+        // Without consensus the filter and the reference fetch it 3 times each
+        const long requests = captures[i]->GetRequests();
+
+        if (c.consensus ? requests != 0 : requests <= 3)
+        {
+          ok = false;
+          detail = "clip " + std::to_string(i + 1) + " requested " + std::to_string(requests) + " times";
+        }
+      }
+
+      report(name, ok, detail);
+    }
+    catch (const AvisynthError& e)
+    {
+      report(name, false, e.msg);
+    }
+  }
+}
+
+// adaptive=255 covers the whole 8 bit and float range, so every pixel is
+// the median of the first three clips. Interleaved formats ignore it.
+static void test_adaptive(ScriptEnvironment& env, const Format& format, bool median3)
+{
+  const std::string name = std::string("Median adaptive ") + format.name;
+
+  try
+  {
+    std::vector<PClip> clips = make_clips(format.pixel_type, 7);
+    PClip filter = invoke(env, "Median", clips, { { "adaptive", AVSValue(255.0) } });
+    std::string detail;
+    bool ok = true;
+
+    for (int n : { 0, FRAMES / 2 })
+    {
+      std::vector<PVideoFrame> src;
+
+      for (size_t i = 0; i < (median3 ? 3 : clips.size()); i++)
+        src.push_back(clips[i]->GetFrame(n, &env));
+
+      const int limit = (int)src.size() / 2;
+      ok = ok && compare_frame(filter->GetVideoInfo(), src, filter->GetFrame(n, &env), limit, limit, true, detail);
+    }
+
+    report(name, ok, detail);
+  }
+  catch (const AvisynthError& e)
+  {
+    report(name, false, e.msg);
+  }
+}
+
+// Blank captures are left out, the median of the others is the output
+static void test_exclude(ScriptEnvironment& env, const Format& format, const std::vector<int>& blank)
+{
+  std::string name = std::string("Median exclude ") + format.name + ", blank";
+
+  for (int i : blank)
+    name += " " + std::to_string(i + 1);
+
+  try
+  {
+    std::vector<PClip> clips;
+    std::vector<PClip> healthy;
+
+    for (int i = 0; i < 7; i++)
+    {
+      const bool dead = std::find(blank.begin(), blank.end(), i) != blank.end();
+      SyntheticParams params = { 1000u + i, 0, 6, 20, dead ? 16 : 0 };
+
+      clips.push_back(new SyntheticClip(make_video_info(format.pixel_type, WIDTH, HEIGHT, FRAMES), params));
+
+      if (!dead)
+        healthy.push_back(clips.back());
+    }
+
+    // Even counts lose one more clip, the test only uses odd ones
+    PClip filter = invoke(env, "Median", clips, { { "exclude", AVSValue(40.0) } });
+    std::string detail;
+    bool ok = true;
+
+    for (int n : { 0, FRAMES / 2 })
+    {
+      std::vector<PVideoFrame> src;
+
+      for (const PClip& clip : healthy)
+        src.push_back(clip->GetFrame(n, &env));
+
+      const int limit = (int)src.size() / 2;
+      ok = ok && compare_frame(filter->GetVideoInfo(), src, filter->GetFrame(n, &env), limit, limit, true, detail);
+    }
+
+    report(name, ok, detail);
+  }
+  catch (const AvisynthError& e)
+  {
+    report(name, false, e.msg);
+  }
+}
+
+// Plane modes: processed planes are the median, copied ones equal the first
+// clip, left ones aren't defined in a new frame and aren't checked
+static void test_planes(ScriptEnvironment& env, const Format& format, const char* function, int y, int u, int v)
+{
+  const std::string name = std::string(function) + " y/u/v " + std::to_string(y) + std::to_string(u) + std::to_string(v) + " " + format.name;
+
+  try
+  {
+    std::vector<PClip> clips = make_clips(format.pixel_type, 5);
+    PClip filter = invoke(env, function, clips, { { "y", AVSValue(y) }, { "u", AVSValue(u) }, { "v", AVSValue(v) } });
+    const int limit = strcmp(function, "MedianBlend") == 0 ? 1 : 2;
+
+    static const int planes[] = { PLANAR_Y, PLANAR_U, PLANAR_V };
+    const int modes[] = { y, u, v };
+
+    std::string detail;
+    bool ok = true;
+
+    for (int n : { 0, FRAMES / 2 })
+    {
+      std::vector<PVideoFrame> src;
+
+      for (const PClip& clip : clips)
+        src.push_back(clip->GetFrame(n, &env));
+
+      PVideoFrame dst = filter->GetFrame(n, &env);
+
+      for (int p = 0; p < 3 && ok; p++)
+      {
+        if (modes[p] == 1)
+          continue;
+
+        const unsigned int passthrough = modes[p] == 2 ? 1 : 0;
+
+        switch (filter->GetVideoInfo().ComponentSize())
+        {
+        case 1: ok = compare_plane<uint8_t>(src, dst, planes[p], limit, limit, 1, passthrough, detail); break;
+        case 2: ok = compare_plane<uint16_t>(src, dst, planes[p], limit, limit, 1, passthrough, detail); break;
+        default: ok = compare_plane<float>(src, dst, planes[p], limit, limit, 1, passthrough, detail); break;
+        }
+      }
+    }
+
+    report(name, ok, detail);
+  }
+  catch (const AvisynthError& e)
+  {
+    report(name, false, e.msg);
+  }
+}
+
+// Chroma ranks: luma is the median/blend of all sources, chroma that of the
+// sources listed in nearest (clip numbers, TemporalMedian: frame offsets)
+struct ChromaCase
+{
+  const char* function;
+  int count;
+  Named named;
+  int low, high;
+  int chromalow, chromahigh;
+  std::vector<int> nearest;
+  std::vector<int> noise;
+  std::vector<int> offsets;
+  bool fresh;
+};
+
+static void test_chroma(ScriptEnvironment& env, const Format& format, const ChromaCase& c)
+{
+  const bool temporal = strcmp(c.function, "TemporalMedian") == 0;
+  const std::string name = std::string(c.function) + " chroma " + format.name + " " + std::to_string(c.nearest.size()) + " of " + std::to_string(c.count) + (c.offsets.empty() ? "" : " sync");
+
+  try
+  {
+    std::vector<PClip> clips;
+
+    for (int i = 0; i < (temporal ? 1 : c.count); i++)
+    {
+      SyntheticParams params = { 1000u + i, i < (int)c.offsets.size() ? c.offsets[i] : 0, i < (int)c.noise.size() ? c.noise[i] : 6, 20, 0, c.fresh };
+      clips.push_back(new SyntheticClip(make_video_info(format.pixel_type, WIDTH, HEIGHT, FRAMES), params));
+    }
+
+    PClip filter = invoke(env, c.function, clips, c.named);
+
+    std::string detail;
+    bool ok = true;
+
+    for (int n : { 5, FRAMES / 2 })
+    {
+      std::vector<PVideoFrame> src;
+      std::vector<PVideoFrame> nearest;
+
+      for (int i = 0; i < c.count; i++)
+        src.push_back(temporal ? clips[0]->GetFrame(n - c.count / 2 + i, &env) : clips[i]->GetFrame(n - (i < (int)c.offsets.size() ? c.offsets[i] : 0), &env));
+
+      for (int i : c.nearest)
+        nearest.push_back(temporal ? clips[0]->GetFrame(n + i, &env) : src[i]);
+
+      PVideoFrame dst = filter->GetFrame(n, &env);
+
+      switch (filter->GetVideoInfo().ComponentSize())
+      {
+      case 1:
+        ok = ok && compare_plane<uint8_t>(src, dst, PLANAR_Y, c.low, c.high, 1, 0, detail)
+          && compare_plane<uint8_t>(nearest, dst, PLANAR_U, c.chromalow, c.chromahigh, 1, 0, detail)
+          && compare_plane<uint8_t>(nearest, dst, PLANAR_V, c.chromalow, c.chromahigh, 1, 0, detail);
+        break;
+      case 2:
+        ok = ok && compare_plane<uint16_t>(src, dst, PLANAR_Y, c.low, c.high, 1, 0, detail)
+          && compare_plane<uint16_t>(nearest, dst, PLANAR_U, c.chromalow, c.chromahigh, 1, 0, detail)
+          && compare_plane<uint16_t>(nearest, dst, PLANAR_V, c.chromalow, c.chromahigh, 1, 0, detail);
+        break;
+      default:
+        ok = ok && compare_plane<float>(src, dst, PLANAR_Y, c.low, c.high, 1, 0, detail)
+          && compare_plane<float>(nearest, dst, PLANAR_U, c.chromalow, c.chromahigh, 1, 0, detail)
+          && compare_plane<float>(nearest, dst, PLANAR_V, c.chromalow, c.chromahigh, 1, 0, detail);
+        break;
+      }
+    }
+
+    report(name, ok, detail);
+  }
+  catch (const AvisynthError& e)
+  {
+    report(name, false, e.msg);
+  }
+}
+
+// Argmedian: chroma comes from the lowest clip whose luma is the median, at
+// the top left luma sample of each chroma sample
+template<typename T>
+static bool compare_argmedian(const VideoInfo& vi, const std::vector<PVideoFrame>& src, const PVideoFrame& dst, std::string& detail)
+{
+  const int limit = (int)src.size() / 2;
+
+  if (!compare_plane<T>(src, dst, PLANAR_Y, limit, limit, 1, 0, detail))
+    return false;
+
+  for (int plane : { PLANAR_U, PLANAR_V })
+  {
+    const int sx = vi.GetPlaneWidthSubsampling(plane);
+    const int sy = vi.GetPlaneHeightSubsampling(plane);
+
+    for (int y = 0; y < dst->GetHeight(plane); y++)
+    {
+      for (int x = 0; x < dst->GetRowSize(plane) / (int)sizeof(T); x++)
+      {
+        auto sample = [&](const PVideoFrame& frame, int p, int px, int py) { return reinterpret_cast<const T*>(frame->GetReadPtr(p) + py * frame->GetPitch(p))[px]; };
+
+        const T median = sample(dst, PLANAR_Y, x << sx, y << sy);
+        size_t k = 0;
+
+        while (sample(src[k], PLANAR_Y, x << sx, y << sy) != median)
+          k++;
+
+        if (sample(dst, plane, x, y) != sample(src[k], plane, x, y))
+        {
+          detail = "plane " + std::to_string(plane) + " x " + std::to_string(x) + " y " + std::to_string(y) + " isn't from clip " + std::to_string(k + 1);
+          return false;
+        }
+      }
+    }
+  }
+
+  return true;
+}
+
+static void test_argmedian(ScriptEnvironment& env, const Format& format, const char* function)
+{
+  const bool temporal = strcmp(function, "TemporalMedian") == 0;
+  const std::string name = std::string(function) + " argmedian " + format.name;
+
+  try
+  {
+    std::vector<PClip> clips = make_clips(format.pixel_type, temporal ? 1 : 5);
+    PClip filter = invoke(env, function, clips, { { "argmedian", AVSValue(true) } });
+    const VideoInfo& vi = filter->GetVideoInfo();
+
+    std::string detail;
+    bool ok = true;
+
+    for (int n : { 0, FRAMES / 2 })
+    {
+      std::vector<PVideoFrame> src;
+
+      for (int i = 0; i < (temporal ? 3 : 5); i++)
+        src.push_back(temporal ? clips[0]->GetFrame(n - 1 + i, &env) : clips[i]->GetFrame(n, &env));
+
+      PVideoFrame dst = filter->GetFrame(n, &env);
+
+      switch (vi.ComponentSize())
+      {
+      case 1: ok = ok && compare_argmedian<uint8_t>(vi, src, dst, detail); break;
+      case 2: ok = ok && compare_argmedian<uint16_t>(vi, src, dst, detail); break;
+      default: ok = ok && compare_argmedian<float>(vi, src, dst, detail); break;
+      }
+    }
+
+    report(name, ok, detail);
+  }
+  catch (const AvisynthError& e)
+  {
+    report(name, false, e.msg);
+  }
+}
+
+// Selection map: each sample names the lowest clip whose luma is the median
+// of the clips used, numbers are those of all clips
+template<typename T>
+static bool compare_map(const std::vector<PVideoFrame>& src, const std::vector<int>& numbers, const PVideoFrame& map, std::string& detail)
+{
+  const int limit = (int)src.size() / 2;
+  std::vector<T> values(src.size());
+
+  for (int y = 0; y < map->GetHeight(PLANAR_Y); y++)
+  {
+    for (int x = 0; x < map->GetRowSize(PLANAR_Y); x++)
+    {
+      for (size_t i = 0; i < src.size(); i++)
+        values[i] = reinterpret_cast<const T*>(src[i]->GetReadPtr(PLANAR_Y) + y * src[i]->GetPitch(PLANAR_Y))[x];
+
+      const T median = reference(values, limit, limit);
+      const size_t k = std::find(values.begin(), values.end(), median) - values.begin();
+      const int number = map->GetReadPtr(PLANAR_Y)[y * map->GetPitch(PLANAR_Y) + x];
+
+      if (number != numbers[k])
+      {
+        detail = "x " + std::to_string(x) + " y " + std::to_string(y) + ": clip " + std::to_string(number + 1) + ", expected " + std::to_string(numbers[k] + 1);
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+// Replay: every sample comes from the clip the map names at the nearest map
+// sample of its top left luma sample
+template<typename T>
+static bool compare_replay(const VideoInfo& vi, const PVideoFrame& map, const VideoInfo& mapinfo, const std::vector<PVideoFrame>& src, const PVideoFrame& dst, std::string& detail)
+{
+  for (int plane : { PLANAR_Y, PLANAR_U, PLANAR_V })
+  {
+    const int sx = vi.GetPlaneWidthSubsampling(plane);
+    const int sy = vi.GetPlaneHeightSubsampling(plane);
+
+    for (int y = 0; y < dst->GetHeight(plane); y++)
+    {
+      for (int x = 0; x < dst->GetRowSize(plane) / (int)sizeof(T); x++)
+      {
+        const int mx = (x << sx) * mapinfo.width / vi.width;
+        const int my = (y << sy) * mapinfo.height / vi.height;
+        const int k = map->GetReadPtr(PLANAR_Y)[my * map->GetPitch(PLANAR_Y) + mx];
+
+        auto sample = [&](const PVideoFrame& frame) { return reinterpret_cast<const T*>(frame->GetReadPtr(plane) + y * frame->GetPitch(plane))[x]; };
+
+        if (sample(dst) != sample(src[k]))
+        {
+          detail = "plane " + std::to_string(plane) + " x " + std::to_string(x) + " y " + std::to_string(y) + " isn't from clip " + std::to_string(k + 1);
+          return false;
+        }
+      }
+    }
+  }
+
+  return true;
+}
+
+static bool compare_replay(const VideoInfo& vi, const PVideoFrame& map, const VideoInfo& mapinfo, const std::vector<PVideoFrame>& src, const PVideoFrame& dst, std::string& detail)
+{
+  switch (vi.ComponentSize())
+  {
+  case 1: return compare_replay<uint8_t>(vi, map, mapinfo, src, dst, detail);
+  case 2: return compare_replay<uint16_t>(vi, map, mapinfo, src, dst, detail);
+  default: return compare_replay<float>(vi, map, mapinfo, src, dst, detail);
+  }
+}
+
+// Median map=true, and MedianReplay of the map on the same clips, which is
+// the argmedian output. Blank clips left out by exclude keep their numbers.
+static void test_map(ScriptEnvironment& env, const Format& format, const std::vector<int>& blank)
+{
+  std::string name = std::string("Median map ") + format.name;
+
+  for (int i : blank)
+    name += i == blank[0] ? ", blank " + std::to_string(i + 1) : " " + std::to_string(i + 1);
+
+  try
+  {
+    std::vector<PClip> clips;
+    std::vector<int> healthy;
+
+    for (int i = 0; i < (blank.empty() ? 5 : 7); i++)
+    {
+      const bool dead = std::find(blank.begin(), blank.end(), i) != blank.end();
+      SyntheticParams params = { 1000u + i, 0, 6, 20, dead ? 16 : 0 };
+
+      clips.push_back(new SyntheticClip(make_video_info(format.pixel_type, WIDTH, HEIGHT, FRAMES), params));
+
+      if (!dead)
+        healthy.push_back(i);
+    }
+
+    Named named = { { "map", AVSValue(true) } };
+
+    if (!blank.empty())
+      named.push_back({ "exclude", AVSValue(40.0) });
+
+    PClip map = invoke(env, "Median", clips, named);
+    PClip replay = invoke(env, "MedianReplay", clips, { { "map", AVSValue(map) } });
+
+    const VideoInfo& mapinfo = map->GetVideoInfo();
+    const VideoInfo& vi = replay->GetVideoInfo();
+
+    std::string detail;
+    bool ok = mapinfo.IsY() && mapinfo.ComponentSize() == 1 && mapinfo.width == WIDTH && mapinfo.height == HEIGHT;
+
+    if (!ok)
+      detail = "map isn't Y8 of the clips' size";
+
+    for (int n : { 0, FRAMES / 2 })
+    {
+      std::vector<PVideoFrame> src;
+
+      for (int i : healthy)
+        src.push_back(clips[i]->GetFrame(n, &env));
+
+      PVideoFrame index = map->GetFrame(n, &env);
+
+      switch (vi.ComponentSize())
+      {
+      case 1: ok = ok && compare_map<uint8_t>(src, healthy, index, detail) && compare_argmedian<uint8_t>(vi, src, replay->GetFrame(n, &env), detail); break;
+      case 2: ok = ok && compare_map<uint16_t>(src, healthy, index, detail) && compare_argmedian<uint16_t>(vi, src, replay->GetFrame(n, &env), detail); break;
+      default: ok = ok && compare_map<float>(src, healthy, index, detail) && compare_argmedian<float>(vi, src, replay->GetFrame(n, &env), detail); break;
+      }
+    }
+
+    report(name, ok, detail);
+  }
+  catch (const AvisynthError& e)
+  {
+    report(name, false, e.msg);
+  }
+}
+
+// Replay on other clips: twice the size of the map, synced through the sync
+// cache the Median that made the map wrote
+static void test_replay(ScriptEnvironment& env, const Format& format, bool sync)
+{
+  const std::string name = std::string("MedianReplay ") + format.name + (sync ? " sync" : " 2x");
+  const std::vector<int> offsets = sync ? std::vector<int>{ 0, 2, -1, 1, -2 } : std::vector<int>();
+  const std::string file = temp_file("hosttest_replay.sync");
+  const char* cache = file.c_str();
+
+  try
+  {
+    std::vector<PClip> captures = make_clips(format.pixel_type, 5, offsets);
+    std::vector<PClip> clips;
+
+    for (int i = 0; i < 5; i++)
+    {
+      SyntheticParams params = { 3000u + i, sync ? offsets[i] : 0, 6, 20 };
+      clips.push_back(new SyntheticClip(make_video_info(format.pixel_type, sync ? WIDTH : 2 * WIDTH, sync ? HEIGHT : 2 * HEIGHT, FRAMES), params));
+    }
+
+    Named named = { { "map", AVSValue(true) } };
+
+    if (sync)
+    {
+      remove(cache);
+      named.push_back({ "sync", AVSValue(3) });
+      named.push_back({ "synccache", AVSValue(cache) });
+    }
+
+    PClip map = invoke(env, "Median", captures, named);
+
+    // Offsets are in the cache once the map frames were made
+    for (int n = 0; n < FRAMES; n++)
+      map->GetFrame(n, &env);
+
+    PClip replay = invoke(env, "MedianReplay", clips, { { "map", AVSValue(map) }, { "synccache", AVSValue(sync ? cache : "") } });
+
+    std::string detail;
+    bool ok = true;
+
+    for (int n = 5; n < FRAMES - 5 && ok; n += 7)
+    {
+      std::vector<PVideoFrame> src;
+
+      for (size_t i = 0; i < clips.size(); i++)
+        src.push_back(clips[i]->GetFrame(n - (sync ? offsets[i] : 0), &env));
+
+      ok = compare_replay(replay->GetVideoInfo(), map->GetFrame(n, &env), map->GetVideoInfo(), src, replay->GetFrame(n, &env), detail);
+    }
+
+    report(name, ok, detail);
+  }
+  catch (const AvisynthError& e)
+  {
+    report(name, false, e.msg);
+  }
+
+  if (sync)
+    remove(cache);
+}
+
+// Fields: the captures show the fields of a frame at different offsets, as
+// after a dropped field. Every field is the median/blend of the same field
+// of the frames its own sync found. With a sync cache a second filter reads
+// the offsets of both fields back.
+static void test_fields(ScriptEnvironment& env, const Format& format, const char* function, bool cache, bool fresh, int threads)
+{
+  const std::vector<int> offsets = { 0, 2, -1, 1, -2 };
+  const std::vector<int> bottom = { 0, 1, 0, -1, 1 };
+  const bool blend = strcmp(function, "MedianBlend") == 0;
+  const std::string file = temp_file("hosttest_fields.sync");
+  const char* path = file.c_str();
+
+  const std::string name = std::string(function) + " fields " + format.name + (cache ? " synccache" : "") + (fresh ? " in place" : "") + (threads > 1 ? " threads " + std::to_string(threads) : "");
+
+  try
+  {
+    std::vector<PClip> clips;
+
+    for (int i = 0; i < 5; i++)
+    {
+      SyntheticParams params = { 1000u + i, offsets[i], 6, 20, 0, fresh, bottom[i] };
+      clips.push_back(new SyntheticClip(make_video_info(format.pixel_type, WIDTH, 40, FRAMES), params));
+    }
+
+    Named named = { { "fields", AVSValue(true) }, { "sync", AVSValue(3) }, { "threads", AVSValue(threads) } };
+
+    if (blend)
+    {
+      named.push_back({ "low", AVSValue(1) });
+      named.push_back({ "high", AVSValue(1) });
+    }
+
+    if (cache)
+    {
+      remove(path);
+      named.push_back({ "synccache", AVSValue(path) });
+    }
+
+    std::string detail;
+    bool ok = true;
+
+    for (int pass = 0; pass < (cache ? 2 : 1) && ok; pass++)
+    {
+      PClip filter = invoke(env, function, clips, named);
+      const VideoInfo& vi = filter->GetVideoInfo();
+
+      for (int n = 5; n < FRAMES - 5 && ok; n += 7)
+      {
+        PVideoFrame dst = filter->GetFrame(n, &env);
+
+        // Each capture woven from the frames showing the fields of scene n
+        std::vector<PVideoFrame> src;
+
+        for (size_t i = 0; i < clips.size(); i++)
+        {
+          PVideoFrame top = clips[i]->GetFrame(n - offsets[i], &env);
+          PVideoFrame low = clips[i]->GetFrame(n - offsets[i] - bottom[i], &env);
+          PVideoFrame woven = env.NewVideoFrame(vi);
+
+          for (int plane : vi.IsPlanar() ? std::vector<int>{ PLANAR_Y, PLANAR_U, PLANAR_V } : std::vector<int>{ 0 })
+          {
+            for (int y = 0; y < woven->GetHeight(plane); y++)
+            {
+              const PVideoFrame& field = y & 1 ? low : top;
+              memcpy(woven->GetWritePtr(plane) + y * woven->GetPitch(plane), field->GetReadPtr(plane) + y * field->GetPitch(plane), woven->GetRowSize(plane));
+            }
+          }
+
+          src.push_back(woven);
+        }
+
+        ok = compare_frame(vi, src, dst, blend ? 1 : 2, blend ? 1 : 2, true, detail);
+
+        if (!ok)
+          detail = "pass " + std::to_string(pass + 1) + " frame " + std::to_string(n) + " " + detail;
+      }
+    }
+
+    report(name, ok, detail);
+  }
+  catch (const AvisynthError& e)
+  {
+    report(name, false, e.msg);
+  }
+
+  if (cache)
+    remove(path);
+}
+
+// Sources nobody else holds: the result goes into the first (temporal: the
+// center) source frame, so no frame buffer is allocated beyond the inputs
+static void test_inplace(ScriptEnvironment& env, const Format& format, const char* function, int count, const Named& named)
+{
+  const bool temporal = strcmp(function, "TemporalMedian") == 0;
+  const int radius = temporal ? named[0].second.AsInt() : 0;
+  const int inputs = temporal ? 2 * radius + 1 : count;
+  const int limit = temporal ? radius : strcmp(function, "MedianBlend") == 0 ? named[0].second.AsInt() : count / 2;
+
+  const std::string name = std::string(function) + " in place " + format.name;
+
+  try
+  {
+    std::vector<PClip> clips;
+
+    for (int i = 0; i < count; i++)
+    {
+      SyntheticParams params = { 1000u + i, 0, 6, 20, 0, true };
+      clips.push_back(new SyntheticClip(make_video_info(format.pixel_type, WIDTH, HEIGHT, FRAMES), params));
+    }
+
+    PClip filter = invoke(env, function, clips, named);
+    std::string detail;
+    bool ok = true;
+
+    for (int n : { 0, FRAMES / 2 })
+    {
+      const int64_t before = ScriptEnvironment::GetMemoryUsed();
+      ScriptEnvironment::ResetMemoryPeak();
+
+      PVideoFrame dst = filter->GetFrame(n, &env);
+
+      // Only the output is left, the inputs were released
+      const int64_t frame = ScriptEnvironment::GetMemoryUsed() - before;
+      const int64_t peak = ScriptEnvironment::GetMemoryPeak() - before;
+
+      if (peak != inputs * frame)
+      {
+        ok = false;
+        detail = "frame " + std::to_string(n) + ": " + std::to_string(peak / frame) + " frames allocated for " + std::to_string(inputs) + " inputs";
+      }
+
+      // Fresh frames have the same content
+      std::vector<PVideoFrame> src;
+
+      for (int i = 0; i < inputs; i++)
+        src.push_back(temporal ? clips[0]->GetFrame(n - radius + i, &env) : clips[i]->GetFrame(n, &env));
+
+      ok = ok && compare_frame(filter->GetVideoInfo(), src, dst, limit, limit, true, detail);
+    }
+
+    report(name, ok, detail);
+  }
+  catch (const AvisynthError& e)
+  {
+    report(name, false, e.msg);
+  }
+}
+
+static void test_error(ScriptEnvironment& env, const char* name, const char* function, const std::vector<PClip>& clips, const Named& named = Named())
+{
+  try
+  {
+    invoke(env, function, clips, named);
+    report(name, false, "no error");
+  }
+  catch (const AvisynthError& e)
+  {
+    report(name, strncmp(e.msg, "Median: ", 8) == 0, e.msg);
+  }
+}
+
+static void test_errors(ScriptEnvironment& env)
+{
+  std::vector<PClip> yv12 = make_clips(VideoInfo::CS_YV12, 5);
+
+  test_error(env, "Median with 2 clips", "Median", { yv12[0], yv12[1] });
+  test_error(env, "Median with 4 clips", "Median", { yv12[0], yv12[1], yv12[2], yv12[3] });
+  test_error(env, "Median with negative sync", "Median", { yv12[0], yv12[1], yv12[2] }, { { "sync", AVSValue(-1) } });
+  test_error(env, "Median with negative threads", "Median", { yv12[0], yv12[1], yv12[2] }, { { "threads", AVSValue(-1) } });
+  test_error(env, "MedianBlend low + high >= clips", "MedianBlend", { yv12[0], yv12[1], yv12[2] }, { { "low", AVSValue(2) }, { "high", AVSValue(1) } });
+  test_error(env, "Median with even lazy", "Median", yv12, { { "lazy", AVSValue(4) } });
+  test_error(env, "Median with lazy = clips", "Median", yv12, { { "lazy", AVSValue(5) } });
+  test_error(env, "Median with agreement above 100", "Median", yv12, { { "lazy", AVSValue(3) }, { "agreement", AVSValue(101.0) } });
+  test_error(env, "Median with negative adaptive", "Median", yv12, { { "adaptive", AVSValue(-1.0) } });
+  test_error(env, "Median with negative exclude", "Median", yv12, { { "exclude", AVSValue(-1.0) } });
+  test_error(env, "Median with u = 4", "Median", yv12, { { "u", AVSValue(4) } });
+  test_error(env, "Median y = 2 on YUY2", "Median", make_clips(VideoInfo::CS_YUY2, 3), { { "y", AVSValue(2) } });
+  test_error(env, "MedianBlend u = 1 on RGB32", "MedianBlend", make_clips(VideoInfo::CS_BGR32, 3), { { "chroma", AVSValue(false) }, { "u", AVSValue(1) } });
+  test_error(env, "Median argmedian with y = 2", "Median", yv12, { { "argmedian", AVSValue(true) }, { "y", AVSValue(2) } });
+  test_error(env, "Median argmedian on YUY2", "Median", make_clips(VideoInfo::CS_YUY2, 3), { { "argmedian", AVSValue(true) } });
+  test_error(env, "Median map on YUY2", "Median", make_clips(VideoInfo::CS_YUY2, 3), { { "map", AVSValue(true) } });
+  test_error(env, "Median map with lazy", "Median", yv12, { { "map", AVSValue(true) }, { "lazy", AVSValue(3) } });
+  test_error(env, "MedianReplay without map", "MedianReplay", yv12);
+  test_error(env, "MedianReplay with YV12 map", "MedianReplay", yv12, { { "map", AVSValue(yv12[0]) } });
+  test_error(env, "MedianReplay on YUY2", "MedianReplay", make_clips(VideoInfo::CS_YUY2, 3), { { "map", AVSValue(make_clips(VideoInfo::CS_Y8, 1)[0]) } });
+  test_error(env, "Median with even chromaclips", "Median", yv12, { { "chromaclips", AVSValue(4) } });
+  test_error(env, "Median chromaclips with argmedian", "Median", yv12, { { "chromaclips", AVSValue(3) }, { "argmedian", AVSValue(true) } });
+  test_error(env, "Median chromaclips on YUY2", "Median", make_clips(VideoInfo::CS_YUY2, 5), { { "chromaclips", AVSValue(3) } });
+  test_error(env, "MedianBlend chroma low + high >= chromaclips", "MedianBlend", yv12, { { "chromaclips", AVSValue(3) }, { "chromalow", AVSValue(1) }, { "chromahigh", AVSValue(2) } });
+  test_error(env, "TemporalMedian chromaradius above radius", "TemporalMedian", { yv12[0] }, { { "radius", AVSValue(2) }, { "chromaradius", AVSValue(3) } });
+  test_error(env, "Median fields with lazy", "Median", yv12, { { "fields", AVSValue(true) }, { "lazy", AVSValue(3) } });
+  test_error(env, "Median fields on YV12 height 38", "Median", yv12, { { "fields", AVSValue(true) } });
+  test_error(env, "TemporalMedian with y = 0", "TemporalMedian", { yv12[0] }, { { "y", AVSValue(0) } });
+  test_error(env, "TemporalMedian radius 0", "TemporalMedian", { yv12[0] }, { { "radius", AVSValue(0) } });
+  test_error(env, "TemporalMedian radius above limit", "TemporalMedian", { yv12[0] }, { { "radius", AVSValue((int)(MAX_DEPTH - 1) / 2 + 1) } });
+
+  std::vector<PClip> deep = make_clips(VideoInfo::CS_YV12, MAX_DEPTH + 1);
+  test_error(env, "Median with too many clips", "Median", deep);
+  test_error(env, "MedianBlend with too many clips", "MedianBlend", deep);
+
+  std::vector<PClip> mixed = { yv12[0], yv12[1], make_clips(VideoInfo::CS_YV24, 1)[0] };
+  test_error(env, "Median with mixed formats", "Median", mixed);
+
+  SyntheticParams params = { 1, 0, 0, 0 };
+  mixed[2] = new SyntheticClip(make_video_info(VideoInfo::CS_YV12, WIDTH + 2, HEIGHT, FRAMES), params);
+  test_error(env, "Median with mixed dimensions", "Median", mixed);
+
+  std::vector<PClip> rgb48 = make_clips(VideoInfo::CS_BGR48, 3);
+  test_error(env, "Median on RGB48", "Median", rgb48);
+
+  // Sync caches: other files and caches of other settings are left alone
+  const std::string guard = temp_file("hosttest_guard.sync");
+  const char* path = guard.c_str();
+  const char* text = "not a sync cache\n";
+  FILE* file = fopen(path, "wb");
+
+  if (file)
+  {
+    fputs(text, file);
+    fclose(file);
+  }
+
+  test_error(env, "Median synccache on another file", "Median", yv12, { { "sync", AVSValue(2) }, { "synccache", AVSValue(path) } });
+
+  char kept[32] = { 0 };
+  file = fopen(path, "rb");
+
+  if (file)
+  {
+    fread(kept, 1, sizeof(kept) - 1, file);
+    fclose(file);
+  }
+
+  report("Median synccache on another file kept", strcmp(kept, text) == 0);
+  remove(path);
+
+  try
+  {
+    invoke(env, "Median", yv12, { { "sync", AVSValue(2) }, { "synccache", AVSValue(path) } })->GetFrame(0, &env);
+    test_error(env, "Median synccache with other sync", "Median", yv12, { { "sync", AVSValue(3) }, { "synccache", AVSValue(path) } });
+  }
+  catch (const AvisynthError& e)
+  {
+    report("Median synccache with other sync", false, e.msg);
+  }
+
+  remove(path);
+
+  // Fields of 3 clips take as many entries as 6 clips without
+  std::vector<PClip> tall;
+
+  for (unsigned int i = 0; i < 6; i++)
+    tall.push_back(new SyntheticClip(make_video_info(VideoInfo::CS_YV12, WIDTH, 40, FRAMES), { 1000u + i, 0, 6, 20 }));
+
+  try
+  {
+    invoke(env, "Median", { tall[0], tall[1], tall[2] }, { { "sync", AVSValue(1) }, { "fields", AVSValue(true) }, { "synccache", AVSValue(path) } })->GetFrame(0, &env);
+    test_error(env, "MedianBlend synccache of Median fields", "MedianBlend", tall, { { "sync", AVSValue(1) }, { "synccache", AVSValue(path) } });
+  }
+  catch (const AvisynthError& e)
+  {
+    report("MedianBlend synccache of Median fields", false, e.msg);
+  }
+
+  remove(path);
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Timings
+//////////////////////////////////////////////////////////////////////////////
+static void benchmark(ScriptEnvironment& env, const char* function, int count, const Named& named)
+{
+  const int frames = 50;
+  std::vector<PClip> clips;
+
+  for (int i = 0; i < count; i++)
+  {
+    SyntheticParams params = { 2000u + i, 0, 6, 20 };
+    clips.push_back(new SyntheticClip(make_video_info(VideoInfo::CS_YV12, 720, 576, frames), params));
+  }
+
+  PClip filter = invoke(env, function, clips, named);
+
+  // Generate the sources up front, so only the filter is timed
+  for (int n = 0; n < frames; n++)
+    for (const PClip& clip : clips)
+      clip->GetFrame(n, &env);
+
+  auto start = std::chrono::steady_clock::now();
+
+  for (int n = 0; n < frames; n++)
+    filter->GetFrame(n, &env);
+
+  const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  printf("%-48s %.3f ms/frame\n", (std::string(function) + " 720x576 YV12 " + std::to_string(count) + " clips").c_str(), 1000.0 * seconds / frames);
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Entry point
+//////////////////////////////////////////////////////////////////////////////
+int main(int argc, char** argv)
+{
+  const char* plugin = argc > 1 ? argv[1] : AJKMEDIAN_PLUGIN;
+
+  ScriptEnvironment env;
+  std::string error;
+
+  if (!env.LoadPlugin(plugin, error))
+  {
+    fprintf(stderr, "hosttest: %s\n", error.c_str());
+    return 1;
+  }
+
+  for (const char* function : { "Median", "MedianBlend", "TemporalMedian", "MedianReplay" })
+    report(std::string(function) + " registered", env.FunctionExists(function));
+
+  for (const Format& format : formats)
+  {
+    test_output(env, format, "Median", 3, 1, 1, true, 0);
+    test_output(env, format, "Median", 5, 2, 2, false, 0);
+    test_output(env, format, "MedianBlend", 5, 1, 2, true, 0);
+    test_output(env, format, "MedianBlend", 3, 0, 0, true, 0);
+    test_output(env, format, "TemporalMedian", 1, 0, 0, true, 2);
+    test_output(env, format, "Median", 7, 3, 3, true, 0, true);
+    test_output(env, format, "MedianBlend", 9, 2, 3, false, 0, true);
+  }
+
+  // Deep stacks up to MAX_DEPTH
+  for (const Format& format : formats)
+  {
+    if (strcmp(format.name, "YV12") && strcmp(format.name, "YUV444P16") && strcmp(format.name, "YUV420PS") && strcmp(format.name, "RGB64"))
+      continue;
+
+    test_output(env, format, "Median", 41, 20, 20, true, 0);
+    test_output(env, format, "Median", (MAX_DEPTH - 1) | 1, (MAX_DEPTH - 1) / 2, (MAX_DEPTH - 1) / 2, false, 0);
+    test_output(env, format, "MedianBlend", MAX_DEPTH, 10, 12, true, 0);
+    test_output(env, format, "TemporalMedian", 1, 0, 0, true, (MAX_DEPTH - 1) / 2);
+  }
+
+  test_sync(env, 1);
+  test_sync(env, 4);
+  test_synccache(env);
+  test_passthrough(env);
+  test_lazy(env, 0);
+  test_lazy(env, 3);
+  test_adaptive(env, formats[0], true);
+  test_adaptive(env, formats[6], true);
+  test_adaptive(env, formats[11], false);
+  test_exclude(env, formats[0], { 5, 6 });
+  test_exclude(env, formats[0], { 0, 3 });
+  test_exclude(env, formats[0], {});
+  test_exclude(env, formats[5], { 2, 5 });
+  test_exclude(env, formats[6], { 1, 4 });
+  test_exclude(env, formats[8], { 0, 1 });
+  test_planes(env, formats[0], "Median", 3, 2, 1);
+  test_planes(env, formats[0], "Median", 2, 3, 3);
+  test_planes(env, formats[5], "MedianBlend", 3, 1, 2);
+  test_planes(env, formats[7], "Median", 1, 3, 2);
+  test_argmedian(env, formats[0], "Median");
+  test_argmedian(env, formats[1], "Median");
+  test_argmedian(env, formats[5], "Median");
+  test_argmedian(env, formats[6], "Median");
+  test_argmedian(env, formats[7], "Median");
+  test_argmedian(env, formats[4], "TemporalMedian");
+  test_chroma(env, formats[2], { "Median", 7, { { "chromaclips", AVSValue(3) } }, 3, 3, 1, 1, { 0, 1, 2 }, {}, {}, true });
+  test_chroma(env, formats[0], { "Median", 5, { { "chromaclips", AVSValue(3) }, { "sync", AVSValue(3) } }, 2, 2, 1, 1, { 0, 1, 3 }, { 6, 6, 40, 6, 40 }, { 0, 2, -1, 1, -2 }, false });
+  test_chroma(env, formats[7], { "MedianBlend", 7, { { "low", AVSValue(2) }, { "high", AVSValue(1) }, { "chromaclips", AVSValue(5) }, { "chromalow", AVSValue(1) }, { "chromahigh", AVSValue(2) } }, 2, 1, 1, 2, { 0, 1, 2, 3, 4 }, {}, {}, false });
+  test_chroma(env, formats[6], { "TemporalMedian", 7, { { "radius", AVSValue(3) }, { "chromaradius", AVSValue(1) } }, 3, 3, 1, 1, { -1, 0, 1 }, {}, {}, true });
+  test_fields(env, formats[0], "Median", false, false, 1);
+  test_fields(env, formats[0], "Median", false, false, 3);
+  test_fields(env, formats[2], "Median", false, true, 1);
+  test_fields(env, formats[8], "Median", false, false, 1);
+  test_fields(env, formats[4], "MedianBlend", true, false, 1);
+  test_map(env, formats[0], {});
+  test_map(env, formats[4], {});
+  test_map(env, formats[6], { 0, 3 });
+  test_map(env, formats[7], {});
+  test_replay(env, formats[0], false);
+  test_replay(env, formats[5], false);
+  test_replay(env, formats[0], true);
+  test_inplace(env, formats[0], "Median", 5, Named());
+  test_inplace(env, formats[5], "Median", 7, Named());
+  test_inplace(env, formats[6], "MedianBlend", 5, { { "low", AVSValue(1) }, { "high", AVSValue(1) } });
+  test_inplace(env, formats[8], "Median", 3, Named());
+  test_inplace(env, formats[2], "Median", 5, { { "fields", AVSValue(true) } });
+  test_inplace(env, formats[11], "Median", 9, Named());
+  test_inplace(env, formats[0], "TemporalMedian", 1, { { "radius", AVSValue(2) } });
+  test_errors(env);
+
+  report("frame buffers released", ScriptEnvironment::GetMemoryUsed() == 0, std::to_string(ScriptEnvironment::GetMemoryUsed()) + " bytes");
+
+  benchmark(env, "Median", 5, Named());
+  benchmark(env, "MedianBlend", 5, Named());
+  benchmark(env, "TemporalMedian", 1, { { "radius", AVSValue(2) } });
+
+  if (failures)
+    printf("%d tests failed\n", failures);
+
+  return failures ? 1 : 0;
+}
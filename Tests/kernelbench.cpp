@@ -0,0 +1,511 @@
+//////////////////////////////////////////////////////////////////////////////
+// Kernel microbenchmark
+//
+// Times the median and blend kernels of mediancore in isolation on seeded
+// synthetic stacks: the per pixel kernels (opt_med3..9/25 and the sorting
+// fallback) and the plane loop as used by the filter with every kernel
+// MedianProcessor offers, for every depth and sample type. Reports megapixels per second and TSC cycles per pixel.
+// Plane loops run with and without the check for blocks where all sources
+// agree ("noskip"), the letterbox workload has black bars that agree. With
+// -adaptive medians are also timed with the adaptive median of 3. "stream"
+// writes the output with non-temporal stores even when it fits the cache.
+//
+//   kernelbench [-seed n] [-size WxH] [-time seconds] [-depth 3,5,...]
+//               [-workload noise|dropouts|clipped|letterbox|all] [-adaptive t]
+//               [-csv] [-quick]
+//////////////////////////////////////////////////////////////////////////////
+
+#include "mediancore.h"
+#include "opt_med.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <utility>
+#include <chrono>
+#include <algorithm>
+#include <type_traits>
+
+#ifdef INTEL_INTRINSICS
+#include <x86intrin.h>
+#endif
+
+struct Options
+{
+  uint32_t seed;
+  int width;
+  int height;
+  double seconds;
+  std::vector<int> depths;
+  std::vector<std::string> workloads;
+  double adaptive;
+  bool csv;
+};
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Synthetic stacks
+//
+// A smooth image shared by all layers, plus per layer noise. "dropouts"
+// replaces some samples with black or white like tape dropouts, "clipped"
+// pushes a part of the image into the limits, which creates long runs of
+// equal values.
+//////////////////////////////////////////////////////////////////////////////
+struct Random
+{
+  uint64_t state;
+
+  explicit Random(uint64_t seed) : state(seed * 0x9E3779B97F4A7C15ull + 1) {}
+
+  uint32_t Next()
+  {
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return (uint32_t)((state * 0x2545F4914F6CDD1Dull) >> 32);
+  }
+};
+
+template<typename T>
+static T sample_max()
+{
+  if constexpr (std::is_same<T, float>::value)
+    return 1.0f;
+  else
+    return (T)~(T)0;
+}
+
+// Returns depth layers of width * height samples
+template<typename T>
+static std::vector<std::vector<T>> generate(const Options& options, int depth, const std::string& workload)
+{
+  const double maximum = sample_max<T>();
+  std::vector<std::vector<T>> layers(depth);
+
+  for (int i = 0; i < depth; i++)
+  {
+    Random random(options.seed * 1000003u + i);
+    std::vector<T>& layer = layers[i];
+
+    layer.resize((size_t)options.width * options.height);
+
+    for (int y = 0; y < options.height; y++)
+    {
+      for (int x = 0; x < options.width; x++)
+      {
+        const uint32_t r = random.Next();
+
+        double value = (double)((x * 7 + y * 3) & 255) / 255.0;
+        value += ((double)(r & 0xFF) - 127.5) / 255.0 * 0.06;
+
+        // 2.39:1 inside 16:9, bars are the same black in every capture
+        if (workload == "letterbox" && (y < options.height / 8 || y >= options.height - options.height / 8))
+          value = 0.0;
+        else if (workload == "dropouts" && (r >> 8) % 1000 < 30)
+          value = (r >> 20) & 1 ? 1.0 : 0.0;
+        else if (workload == "clipped")
+          value = value * 1.6 - 0.3;
+
+        value = std::min(std::max(value, 0.0), 1.0) * maximum;
+        layer[(size_t)y * options.width + x] = std::is_same<T, float>::value ? (T)value : (T)(value + 0.5);
+      }
+    }
+  }
+
+  return layers;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Measurement
+//////////////////////////////////////////////////////////////////////////////
+static uint64_t read_cycles()
+{
+#ifdef INTEL_INTRINSICS
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+struct Result
+{
+  double pixels_per_second;
+  double cycles_per_pixel;
+};
+
+// Runs the kernel until the time is used up, at least twice (one warm up)
+template<typename F>
+static Result measure(F&& run, double pixels, double seconds)
+{
+  run();
+
+  int64_t runs = 0;
+  const auto start = std::chrono::steady_clock::now();
+  const uint64_t cycles = read_cycles();
+  double elapsed;
+
+  do
+  {
+    run();
+    runs++;
+    elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  }
+  while (elapsed < seconds);
+
+  const double total = pixels * runs;
+  return Result{ total / std::max(elapsed, 1e-9), (double)(read_cycles() - cycles) / total };
+}
+
+static void print_header(const Options& options)
+{
+  if (options.csv)
+    printf("kernel,isa,type,depth,low,high,workload,mpx_per_s,cycles_per_px\n");
+  else
+    printf("%-24s %-7s %-6s %5s %4s %4s %-9s %10s %10s\n", "kernel", "isa", "type", "depth", "low", "high", "workload", "Mpx/s", "cycles/px");
+}
+
+static void print_result(const Options& options, const char* kernel, const char* type, int depth, int low, int high, const std::string& workload, const Result& result)
+{
+  if (options.csv)
+    printf("%s,scalar,%s,%d,%d,%d,%s,%.3f,%.3f\n", kernel, type, depth, low, high, workload.c_str(), result.pixels_per_second / 1e6, result.cycles_per_pixel);
+  else
+    printf("%-24s %-7s %-6s %5d %4d %4d %-9s %10.2f %10.2f\n", kernel, "scalar", type, depth, low, high, workload.c_str(), result.pixels_per_second / 1e6, result.cycles_per_pixel);
+
+  fflush(stdout);
+}
+
+// Keeps the results alive, so the kernels can't be optimized away
+static volatile double sink;
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Pixel kernels
+//
+// Values are stored pixel by pixel, every call gets a fresh copy of its
+// stack, like the plane loop gathers them.
+//////////////////////////////////////////////////////////////////////////////
+template<typename T>
+static T sort_kernel(T* values, int depth, int low, int high)
+{
+  const int blend = depth - low - high;
+
+  if (blend != depth)
+    std::sort(values, values + depth);
+
+  if constexpr (std::is_same<T, float>::value)
+  {
+    float sum = 0.0f;
+
+    for (int i = low; i < low + blend; i++)
+      sum += values[i];
+
+    return sum / blend;
+  }
+  else
+  {
+    unsigned int sum = 0;
+
+    for (int i = low; i < low + blend; i++)
+      sum += values[i];
+
+    return (T)(sum / blend);
+  }
+}
+
+template<typename T, typename K>
+static Result run_pixel_kernel(const Options& options, const std::vector<std::vector<T>>& layers, K kernel)
+{
+  const int depth = (int)layers.size();
+  const size_t pixels = layers[0].size();
+
+  std::vector<T> stack(pixels * depth);
+  std::vector<T> output(pixels);
+
+  for (size_t p = 0; p < pixels; p++)
+    for (int i = 0; i < depth; i++)
+      stack[p * depth + i] = layers[i][p];
+
+  auto run = [&]()
+  {
+    T values[MAX_DEPTH];
+
+    for (size_t p = 0; p < pixels; p++)
+    {
+      memcpy(values, &stack[p * depth], depth * sizeof(T));
+      output[p] = kernel(values);
+    }
+
+    sink = sink + (double)output[pixels / 2];
+  };
+
+  return measure(run, (double)pixels, options.seconds);
+}
+
+template<typename T>
+static void bench_pixel_kernels(const Options& options, const char* type)
+{
+  for (const std::string& workload : options.workloads)
+  {
+    for (int depth : options.depths)
+    {
+      const std::vector<std::vector<T>> layers = generate<T>(options, depth, workload);
+      const int median = (depth - 1) / 2;
+      const int band = depth / 4;
+
+      if constexpr (std::is_same<T, unsigned char>::value)
+      {
+        unsigned char (*fast)(unsigned char*) = nullptr;
+        const char* name = nullptr;
+
+        switch (depth)
+        {
+        case 3: fast = opt_med3; name = "opt_med3"; break;
+        case 5: fast = opt_med5; name = "opt_med5"; break;
+        case 7: fast = opt_med7; name = "opt_med7"; break;
+        case 9: fast = opt_med9; name = "opt_med9"; break;
+        case 25: fast = opt_med25; name = "opt_med25"; break;
+        }
+
+        if (fast)
+          print_result(options, name, type, depth, median, median, workload, run_pixel_kernel(options, layers, fast));
+      }
+
+      if (depth % 2)
+      {
+        print_result(options, "sort median", type, depth, median, median, workload,
+          run_pixel_kernel(options, layers, [=](T* values) { return sort_kernel(values, depth, median, median); }));
+      }
+
+      if (band > 0)
+      {
+        print_result(options, "sort blend", type, depth, band, band, workload,
+          run_pixel_kernel(options, layers, [=](T* values) { return sort_kernel(values, depth, band, band); }));
+      }
+    }
+  }
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Plane kernels, MedianProcessor::ProcessPlane as called by the filter
+//////////////////////////////////////////////////////////////////////////////
+template<typename T>
+static void bench_plane_kernels(const Options& options, MedianFormat format, const char* type)
+{
+  for (const std::string& workload : options.workloads)
+  {
+    for (int depth : options.depths)
+    {
+      const std::vector<std::vector<T>> layers = generate<T>(options, depth, workload);
+      std::vector<T> output(layers[0].size());
+
+      const unsigned char* srcp[MAX_DEPTH];
+      int src_pitch[MAX_DEPTH];
+
+      for (int i = 0; i < depth; i++)
+      {
+        srcp[i] = reinterpret_cast<const unsigned char*>(layers[i].data());
+        src_pitch[i] = options.width * (int)sizeof(T);
+      }
+
+      const int median = (depth - 1) / 2;
+      const int band = depth / 4;
+
+      const std::pair<int, int> limits[] = { { median, median }, { band, band } };
+
+      for (const auto& limit : limits)
+      {
+        if ((limit.first == median && depth % 2 == 0) || limit.first == 0)
+          continue;
+
+        MedianProcessor processor(depth, limit.first, limit.second);
+
+        for (int k = 0; k < MEDIAN_KERNEL_COUNT; k++)
+        {
+          if (!processor.IsAvailable((MedianKernel)k, format))
+            continue;
+
+          processor.SetKernel(format, (MedianKernel)k);
+
+          // Default, without the agreement check, adaptive median of 3,
+          // non-temporal output stores regardless of the cache size
+          for (int variant = 0; variant < 4; variant++)
+          {
+            if (variant == 2 && (options.adaptive <= 0.0 || limit.first != median || depth < 5))
+              continue;
+
+            processor.SetSkipEqual(variant != 1);
+            processor.SetAdaptive(variant == 2 ? options.adaptive * sample_max<T>() / 255.0 : 0.0);
+            processor.SetStreamBytes(variant == 3 ? 0 : last_level_cache());
+
+            auto run = [&]()
+            {
+              processor.ProcessPlane(format, srcp, src_pitch, reinterpret_cast<unsigned char*>(output.data()), options.width * (int)sizeof(T), options.width, options.height);
+              sink = sink + (double)output[output.size() / 2];
+            };
+
+            static const char* suffix[] = { "", " noskip", " adaptive", " stream" };
+            const std::string name = std::string("plane ") + kernel_name((MedianKernel)k) + suffix[variant];
+            print_result(options, name.c_str(), type, depth, limit.first, limit.second, workload, measure(run, (double)options.width * options.height, options.seconds));
+          }
+        }
+      }
+    }
+  }
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Processor information
+//////////////////////////////////////////////////////////////////////////////
+static void print_cpu(const Options& options)
+{
+  if (options.csv)
+    return;
+
+  std::string isa;
+
+#if defined(INTEL_INTRINSICS) && (defined(__GNUC__) || defined(__clang__))
+  __builtin_cpu_init();
+
+  if (__builtin_cpu_supports("sse2")) isa += " sse2";
+  if (__builtin_cpu_supports("ssse3")) isa += " ssse3";
+  if (__builtin_cpu_supports("sse4.1")) isa += " sse4.1";
+  if (__builtin_cpu_supports("avx")) isa += " avx";
+  if (__builtin_cpu_supports("avx2")) isa += " avx2";
+  if (__builtin_cpu_supports("avx512f")) isa += " avx512f";
+  if (__builtin_cpu_supports("avx512bw")) isa += " avx512bw";
+#endif
+
+  printf("cpu:%s\n", isa.empty() ? " unknown" : isa.c_str());
+  printf("cpu signature: %s\n", cpu_signature());
+  printf("kernels: scalar\n");
+  printf("frame: %dx%d, seed %u, %.2f s per measurement\n\n", options.width, options.height, options.seed, options.seconds);
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Entry point
+//////////////////////////////////////////////////////////////////////////////
+static void usage()
+{
+  fprintf(stderr,
+    "Usage: kernelbench [options]\n"
+    "\n"
+    "Options:\n"
+    "  -seed <n>        generator seed (default 1)\n"
+    "  -size <WxH>      samples per layer (default 1920x1080)\n"
+    "  -time <seconds>  time per measurement (default 0.2)\n"
+    "  -depth <list>    comma separated depths (default 3,5,...,25)\n"
+    "  -workload <name> noise, dropouts, clipped, letterbox or all (default noise)\n"
+    "  -adaptive <t>    also time medians with the adaptive median of 3, threshold in 8 bit steps\n"
+    "  -csv             comma separated output\n"
+    "  -quick           tiny run that only checks everything works\n");
+}
+
+static std::vector<int> parse_depths(const char* text)
+{
+  std::vector<int> depths;
+
+  for (const char* p = text; *p;)
+  {
+    char* end;
+    long value = strtol(p, &end, 10);
+
+    if (end == p || value < 3 || value > (long)MAX_DEPTH)
+      return std::vector<int>();
+
+    depths.push_back((int)value);
+    p = *end == ',' ? end + 1 : end;
+  }
+
+  return depths;
+}
+
+int main(int argc, char** argv)
+{
+  Options options;
+  options.seed = 1;
+  options.width = 1920;
+  options.height = 1080;
+  options.seconds = 0.2;
+  options.workloads = { "noise" };
+  options.adaptive = 0.0;
+  options.csv = false;
+
+  for (int depth = 3; depth <= (int)MAX_DEPTH; depth += 2)
+    options.depths.push_back(depth);
+
+  for (int i = 1; i < argc; i++)
+  {
+    const char* arg = argv[i];
+    const bool more = i + 1 < argc;
+
+    if (strcmp(arg, "-seed") == 0 && more) options.seed = (uint32_t)strtoul(argv[++i], nullptr, 10);
+    else if (strcmp(arg, "-time") == 0 && more) options.seconds = atof(argv[++i]);
+    else if (strcmp(arg, "-csv") == 0) options.csv = true;
+    else if (strcmp(arg, "-adaptive") == 0 && more) options.adaptive = atof(argv[++i]);
+    else if (strcmp(arg, "-size") == 0 && more)
+    {
+      if (sscanf(argv[++i], "%dx%d", &options.width, &options.height) != 2 || options.width < 1 || options.height < 1)
+      {
+        usage();
+        return 1;
+      }
+    }
+    else if (strcmp(arg, "-depth") == 0 && more)
+    {
+      options.depths = parse_depths(argv[++i]);
+
+      if (options.depths.empty())
+      {
+        usage();
+        return 1;
+      }
+    }
+    else if (strcmp(arg, "-workload") == 0 && more)
+    {
+      std::string workload = argv[++i];
+
+      if (workload == "all")
+        options.workloads = { "noise", "dropouts", "clipped", "letterbox" };
+      else if (workload == "noise" || workload == "dropouts" || workload == "clipped" || workload == "letterbox")
+        options.workloads = { workload };
+      else
+      {
+        usage();
+        return 1;
+      }
+    }
+    else if (strcmp(arg, "-quick") == 0)
+    {
+      options.width = 64;
+      options.height = 16;
+      options.seconds = 0.0;
+      options.depths = { 3, 9, 25 };
+      options.workloads = { "noise", "dropouts", "clipped", "letterbox" };
+      options.adaptive = 8.0;
+    }
+    else
+    {
+      usage();
+      return 1;
+    }
+  }
+
+  print_cpu(options);
+  print_header(options);
+
+  bench_pixel_kernels<unsigned char>(options, "8");
+  bench_pixel_kernels<uint16_t>(options, "16");
+  bench_pixel_kernels<float>(options, "float");
+
+  bench_plane_kernels<unsigned char>(options, MEDIAN_PLANE_8BIT, "8");
+  bench_plane_kernels<uint16_t>(options, MEDIAN_PLANE_16BIT, "16");
+  bench_plane_kernels<float>(options, MEDIAN_PLANE_FLOAT, "float");
+
+  return 0;
+}
@@ -0,0 +1,543 @@
+//////////////////////////////////////////////////////////////////////////////
+// Differential test of the median core
+//
+// Compares MedianProcessor output of every kernel, sample format and depth
+// with a plain std::sort reference. Inputs are random and adversarial
+// (equal values, extremes, few distinct values, presorted stacks, row blocks
+// that agree in all sources next to ones that don't) on odd widths with
+// unaligned pitches and buffer starts. Every kernel runs with and without the
+// agreement check and medians of 5 or more also with the adaptive median of
+// 3, with cached and non-temporal output stores, into a separate buffer and
+// in place over one of the sources, medians also with the index of the source
+// they came from, alternating per case. Bytes around the
+// destination rows are checked as well, so kernels that write past the row
+// end are caught.
+//
+// Every case draws its data from its own seed, a failure prints the command
+// line that reruns just that case.
+//
+//   kerneltest [-seed n] [-case n] [-verbose]
+//////////////////////////////////////////////////////////////////////////////
+
+#include "mediancore.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+static const unsigned char GUARD = 0xA5;
+static const int MAX_REPORTS = 20;
+
+struct Format
+{
+  const char* name;
+  MedianFormat format;
+  int channels;    // samples per pixel
+  int bytes;       // bytes per sample
+  bool is_float;
+  int passthrough; // channel copied from the first source without processchroma, -1 for none
+};
+
+static const Format formats[] =
+{
+  { "8 bit", MEDIAN_PLANE_8BIT, 1, 1, false, -1 },
+  { "16 bit", MEDIAN_PLANE_16BIT, 1, 2, false, -1 },
+  { "float", MEDIAN_PLANE_FLOAT, 1, 4, true, -1 },
+  { "YUY2", MEDIAN_YUY2, 2, 1, false, 1 },
+  { "BGR24", MEDIAN_BGR24, 3, 1, false, -1 },
+  { "BGR32", MEDIAN_BGR32, 4, 1, false, 3 },
+  { "BGR64", MEDIAN_BGR64, 4, 2, false, 3 },
+};
+
+enum Pattern
+{
+  PATTERN_RANDOM,    // uniform over the whole range
+  PATTERN_NOISE,     // small noise around a smooth image, some dropouts
+  PATTERN_EQUAL,     // all sources the same value
+  PATTERN_EXTREME,   // only the minimum and maximum
+  PATTERN_FEW,       // three distinct values, many ties
+  PATTERN_ASCENDING, // sources already sorted
+  PATTERN_DESCENDING,
+  PATTERN_PATCHY,    // row blocks alternate between equal and random
+  PATTERN_COUNT
+};
+
+static const char* pattern_names[PATTERN_COUNT] = { "random", "noise", "equal", "extreme", "few", "ascending", "descending", "patchy" };
+
+static const int widths[] = { 1, 2, 7, 33, 67 };
+static const int heights[] = { 1, 3, 5 };
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Random numbers
+//////////////////////////////////////////////////////////////////////////////
+struct Random
+{
+  uint64_t state;
+
+  explicit Random(uint64_t seed) : state(seed * 0x9E3779B97F4A7C15ull + 0x632BE59BD9B4E019ull) {}
+
+  uint32_t Next()
+  {
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return (uint32_t)((state * 0x2545F4914F6CDD1Dull) >> 32);
+  }
+
+  int Range(int count) { return (int)(Next() % (uint32_t)count); }
+};
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Sample access, values are handled as double for all formats
+//////////////////////////////////////////////////////////////////////////////
+static double load(const Format& format, const unsigned char* p)
+{
+  if (format.is_float)
+  {
+    float value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+  }
+
+  if (format.bytes == 2)
+    return p[0] | (p[1] << 8);
+
+  return p[0];
+}
+
+static void store(const Format& format, unsigned char* p, double value)
+{
+  if (format.is_float)
+  {
+    const float sample = (float)value;
+    memcpy(p, &sample, sizeof(sample));
+  }
+  else if (format.bytes == 2)
+  {
+    const unsigned int sample = (unsigned int)value;
+    p[0] = (unsigned char)sample;
+    p[1] = (unsigned char)(sample >> 8);
+  }
+  else
+    p[0] = (unsigned char)value;
+}
+
+static double maximum(const Format& format)
+{
+  return format.is_float ? 1.0 : format.bytes == 2 ? 65535.0 : 255.0;
+}
+
+static double draw(const Format& format, double fraction)
+{
+  if (format.is_float)
+    return fraction;
+
+  return floor(fraction * maximum(format) + 0.5);
+}
+
+// Value of source i at one sample position
+static double generate(const Format& format, Pattern pattern, Random& random, int i, int depth, double base)
+{
+  const double unit = random.Next() / 4294967296.0;
+
+  switch (pattern)
+  {
+  case PATTERN_RANDOM:
+    // Floats also get values outside 0..1, AviSynth doesn't clamp them
+    return format.is_float ? (unit - 0.25) * 2.0 : draw(format, unit);
+
+  case PATTERN_NOISE:
+    if (random.Range(100) < 5)
+      return random.Range(2) ? maximum(format) : 0.0;
+    return draw(format, std::min(std::max(base + (unit - 0.5) * 0.05, 0.0), 1.0));
+
+  case PATTERN_EQUAL:
+    return draw(format, base);
+
+  case PATTERN_EXTREME:
+    return random.Range(2) ? maximum(format) : 0.0;
+
+  case PATTERN_FEW:
+    return draw(format, random.Range(3) / 2.0);
+
+  case PATTERN_ASCENDING:
+    return draw(format, (i + base) / (depth + 1));
+
+  default:
+    return draw(format, (depth - i + base) / (depth + 1));
+  }
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Reference
+//////////////////////////////////////////////////////////////////////////////
+static double reference(const Format& format, std::vector<double> values, unsigned int low, unsigned int high)
+{
+  const unsigned int blend = (unsigned int)values.size() - low - high;
+
+  std::sort(values.begin(), values.end());
+
+  double sum = 0.0;
+
+  for (unsigned int i = low; i < low + blend; i++)
+    sum += values[i];
+
+  return format.is_float ? sum / blend : floor(sum / blend);
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Single case
+//////////////////////////////////////////////////////////////////////////////
+struct Case
+{
+  const Format* format;
+  unsigned int depth;
+  unsigned int low;
+  unsigned int high;
+  Pattern pattern;
+  bool processchroma;
+  int width;
+  int height;
+};
+
+static std::string describe(const Case& c)
+{
+  char text[256];
+  snprintf(text, sizeof(text), "%s depth %u low %u high %u %s%s %dx%d", c.format->name, c.depth, c.low, c.high,
+    pattern_names[c.pattern], c.format->passthrough >= 0 && !c.processchroma ? " nochroma" : "", c.width, c.height);
+  return text;
+}
+
+static int reports = 0;
+
+static bool run_case(const Case& c, uint32_t seed, int number)
+{
+  const Format& format = *c.format;
+  Random random(seed ^ (uint64_t)number << 32);
+
+  const int rowsize = c.width * format.channels * format.bytes;
+
+  // Pitches are whole samples, but neither aligned nor equal between sources
+  std::vector<std::vector<unsigned char>> sources(c.depth);
+  std::vector<const unsigned char*> srcp(c.depth);
+  std::vector<int> src_pitch(c.depth);
+
+  for (unsigned int i = 0; i < c.depth; i++)
+  {
+    const int offset = random.Range(8) * format.bytes;
+    src_pitch[i] = rowsize + (2 * random.Range(8) + 1) * format.bytes;
+
+    sources[i].assign(offset + (size_t)src_pitch[i] * c.height, GUARD);
+    srcp[i] = sources[i].data() + offset;
+  }
+
+  const int dst_offset = random.Range(8) * format.bytes + format.bytes;
+  const int dst_pitch = rowsize + (2 * random.Range(8) + 1) * format.bytes;
+  std::vector<unsigned char> destination(dst_offset + (size_t)dst_pitch * c.height + 16, GUARD);
+  unsigned char* dstp = destination.data() + dst_offset;
+
+  // Sources
+  std::vector<double> values(c.depth);
+
+  for (int y = 0; y < c.height; y++)
+  {
+    for (int x = 0; x < c.width * format.channels; x++)
+    {
+      const double base = random.Next() / 4294967296.0;
+
+      Pattern pattern = c.pattern;
+
+      if (pattern == PATTERN_PATCHY)
+        pattern = (x / format.channels / SKIP_BLOCK + y) % 2 == 0 ? PATTERN_EQUAL : PATTERN_RANDOM;
+
+      for (unsigned int i = 0; i < c.depth; i++)
+        store(format, const_cast<unsigned char*>(srcp[i]) + (size_t)y * src_pitch[i] + x * format.bytes, generate(format, pattern, random, i, c.depth, base));
+    }
+  }
+
+  // Expected output, and with the adaptive median of 3 for medians of 5 or more
+  std::vector<double> expected((size_t)c.width * format.channels * c.height);
+  std::vector<double> adapted(expected.size());
+
+  const bool adaptive = format.format <= MEDIAN_PLANE_FLOAT && c.depth >= 5 && c.low == c.high && c.low + c.high + 1 == c.depth;
+  const double threshold = format.is_float ? (double)0.05f : floor(maximum(format) * 0.05);
+
+  for (int y = 0; y < c.height; y++)
+  {
+    for (int x = 0; x < c.width * format.channels; x++)
+    {
+      for (unsigned int i = 0; i < c.depth; i++)
+        values[i] = load(format, srcp[i] + (size_t)y * src_pitch[i] + x * format.bytes);
+
+      const bool passthrough = x % format.channels == format.passthrough && !c.processchroma;
+      expected[(size_t)y * c.width * format.channels + x] = passthrough ? values[0] : reference(format, values, c.low, c.high);
+
+      // Adaptive: median of the first three where they are close enough
+      if (adaptive)
+      {
+        const double lo = std::min(std::min(values[0], values[1]), values[2]);
+        const double hi = std::max(std::max(values[0], values[1]), values[2]);
+        const double spread = format.is_float ? (double)((float)hi - (float)lo) : hi - lo;
+        const double median3 = values[0] + values[1] + values[2] - lo - hi;
+
+        adapted[(size_t)y * c.width * format.channels + x] = spread > threshold ? expected[(size_t)y * c.width * format.channels + x] : median3;
+      }
+    }
+  }
+
+  // Every kernel the processor can use for this case
+  MedianProcessor processor(c.depth, c.low, c.high);
+  bool ok = true;
+
+  for (int k = 0; k < MEDIAN_KERNEL_COUNT && ok; k++)
+  {
+    const MedianKernel kernel = (MedianKernel)k;
+
+    if (!processor.IsAvailable(kernel, format.format))
+      continue;
+
+    processor.SetKernel(format.format, kernel);
+    processor.SetSkipEqual((k + number) % 2 == 0);
+    processor.SetAdaptive(adaptive && (k + number / 2) % 2 == 0 ? threshold : 0.0);
+    processor.SetStreamBytes((k + number / 4) % 2 == 0 ? 0 : SIZE_MAX);
+    std::fill(destination.begin(), destination.end(), GUARD);
+
+    // In place: one of the sources is copied to the destination and read from there
+    const bool inplace = (k + number / 8) % 2 == 0;
+    std::vector<const unsigned char*> inputp(srcp);
+    std::vector<int> input_pitch(src_pitch);
+
+    if (inplace)
+    {
+      const unsigned int source = number % c.depth;
+
+      for (int y = 0; y < c.height; y++)
+        memcpy(dstp + (size_t)y * dst_pitch, srcp[source] + (size_t)y * src_pitch[source], rowsize);
+
+      inputp[source] = dstp;
+      input_pitch[source] = dst_pitch;
+    }
+
+    // Medians of planes also with the index of the source holding them
+    const bool indexed = format.format <= MEDIAN_PLANE_FLOAT && c.low + c.high + 1 == c.depth && (k + number / 16) % 2 == 0;
+    std::vector<unsigned char> index((size_t)c.width * c.height, 0xFF);
+
+    if (indexed)
+      processor.ProcessPlaneIndexed(format.format, inputp.data(), input_pitch.data(), dstp, dst_pitch, index.data(), c.width, c.width, c.height);
+    else if (format.format <= MEDIAN_PLANE_FLOAT)
+      processor.ProcessPlane(format.format, inputp.data(), input_pitch.data(), dstp, dst_pitch, c.width, c.height);
+    else
+      processor.ProcessInterleaved(format.format, inputp.data(), input_pitch.data(), dstp, dst_pitch, c.width, c.height, c.processchroma);
+
+    const std::string name = describe(c) + " " + kernel_name(kernel) + (processor.GetSkipEqual() ? "" : " noskip") + (processor.GetAdaptive() > 0.0 ? " adaptive" : "") + (processor.GetStreamBytes() == 0 ? " stream" : "") + (inplace ? " inplace" : "") + (indexed ? " indexed" : "");
+    const std::vector<double>& reference = processor.GetAdaptive() > 0.0 ? adapted : expected;
+
+    // Compare
+    for (int y = 0; y < c.height && ok; y++)
+    {
+      for (int x = 0; x < c.width * format.channels && ok; x++)
+      {
+        const double wanted = reference[(size_t)y * c.width * format.channels + x];
+        const double actual = load(format, dstp + (size_t)y * dst_pitch + x * format.bytes);
+
+        // Floats may be summed in a different order
+        const double tolerance = format.is_float ? 1e-6 * c.depth : 0.0;
+
+        if (fabs(actual - wanted) > tolerance)
+        {
+          ok = false;
+
+          if (reports++ < MAX_REPORTS)
+            printf("case %d, %s: sample %d,%d is %g, expected %g\n", number, name.c_str(), x, y, actual, wanted);
+        }
+
+        // The lowest source that has the median
+        if (indexed && ok)
+        {
+          unsigned int first = 0;
+
+          while (first < c.depth && load(format, srcp[first] + (size_t)y * src_pitch[first] + x * format.bytes) != actual)
+            first++;
+
+          if (index[(size_t)y * c.width + x] != first)
+          {
+            ok = false;
+
+            if (reports++ < MAX_REPORTS)
+              printf("case %d, %s: index %d,%d is %d, expected %u\n", number, name.c_str(), x, y, index[(size_t)y * c.width + x], first);
+          }
+        }
+      }
+
+      // Nothing written outside the rows
+      for (int x = rowsize; x < dst_pitch && ok; x++)
+      {
+        if (dstp[(size_t)y * dst_pitch + x] != GUARD)
+        {
+          ok = false;
+
+          if (reports++ < MAX_REPORTS)
+            printf("case %d, %s: byte %d of row %d written past the row end\n", number, name.c_str(), x, y);
+        }
+      }
+    }
+
+    for (int x = 0; x < dst_offset && ok; x++)
+    {
+      if (destination[x] != GUARD)
+      {
+        ok = false;
+
+        if (reports++ < MAX_REPORTS)
+          printf("case %d, %s: written before the destination\n", number, name.c_str());
+      }
+    }
+
+    // The agreement check must not change a single bit, float blends round
+    // their sums so the kernel result is checked against itself
+    if (ok && !inplace && processor.GetSkipEqual() && format.format <= MEDIAN_PLANE_FLOAT)
+    {
+      std::vector<unsigned char> unskipped((size_t)dst_pitch * c.height);
+
+      processor.SetSkipEqual(false);
+      processor.ProcessPlane(format.format, inputp.data(), input_pitch.data(), unskipped.data(), dst_pitch, c.width, c.height);
+      processor.SetSkipEqual(true);
+
+      for (int y = 0; y < c.height && ok; y++)
+      {
+        if (memcmp(dstp + (size_t)y * dst_pitch, unskipped.data() + (size_t)y * dst_pitch, rowsize) != 0)
+        {
+          ok = false;
+
+          if (reports++ < MAX_REPORTS)
+            printf("case %d, %s: row %d differs from the unskipped one\n", number, name.c_str(), y);
+        }
+      }
+    }
+  }
+
+  if (!ok && reports <= MAX_REPORTS)
+    printf("  rerun with: kerneltest -seed %u -case %d\n", seed, number);
+
+  return ok;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// All cases
+//
+// Depths up to MAX_DEPTH with a regular median (odd depths), symmetric and
+// asymmetric blends, a plain average and the extremes (minimum, maximum).
+// Above 26 only depths around multiples of 32 and the largest ones are run.
+//////////////////////////////////////////////////////////////////////////////
+static std::vector<Case> make_cases()
+{
+  std::vector<Case> cases;
+  int geometry = 0;
+
+  for (const Format& format : formats)
+  {
+    for (unsigned int depth = 3; depth <= MAX_DEPTH; depth++)
+    {
+      // Every depth of the classic 25 clip range, then a sample of deep stacks
+      if (depth > 26 && depth % 32 > 1 && depth < MAX_DEPTH - 1)
+        continue;
+
+      std::vector<std::pair<unsigned int, unsigned int>> limits;
+
+      if (depth % 2)
+        limits.push_back({ (depth - 1) / 2, (depth - 1) / 2 });
+
+      limits.push_back({ depth / 4, depth / 4 });
+      limits.push_back({ 1, depth / 2 });
+      limits.push_back({ 0, 0 });
+      limits.push_back({ 0, depth - 1 });
+      limits.push_back({ depth - 1, 0 });
+
+      for (const auto& limit : limits)
+      {
+        if (limit.first + limit.second >= depth)
+          continue;
+
+        for (int pattern = 0; pattern < PATTERN_COUNT; pattern++)
+        {
+          for (int chroma = format.passthrough >= 0 ? 0 : 1; chroma < 2; chroma++)
+          {
+            Case c;
+            c.format = &format;
+            c.depth = depth;
+            c.low = limit.first;
+            c.high = limit.second;
+            c.pattern = (Pattern)pattern;
+            c.processchroma = chroma == 1;
+            c.width = widths[geometry % (sizeof(widths) / sizeof(widths[0]))];
+            c.height = heights[geometry / 3 % (sizeof(heights) / sizeof(heights[0]))];
+            cases.push_back(c);
+
+            geometry++;
+          }
+        }
+      }
+    }
+  }
+
+  return cases;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Entry point
+//////////////////////////////////////////////////////////////////////////////
+int main(int argc, char** argv)
+{
+  uint32_t seed = 1;
+  int only = -1;
+  bool verbose = false;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "-seed") == 0 && i + 1 < argc) seed = (uint32_t)strtoul(argv[++i], nullptr, 10);
+    else if (strcmp(argv[i], "-case") == 0 && i + 1 < argc) only = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-verbose") == 0) verbose = true;
+    else
+    {
+      fprintf(stderr, "Usage: kerneltest [-seed n] [-case n] [-verbose]\n");
+      return 1;
+    }
+  }
+
+  const std::vector<Case> cases = make_cases();
+  int failures = 0;
+
+  if (only >= (int)cases.size())
+  {
+    fprintf(stderr, "kerneltest: there are only %d cases\n", (int)cases.size());
+    return 1;
+  }
+
+  for (int number = 0; number < (int)cases.size(); number++)
+  {
+    if (only >= 0 && number != only)
+      continue;
+
+    const bool ok = run_case(cases[number], seed, number);
+
+    if (verbose)
+      printf("case %d, %s: %s\n", number, describe(cases[number]).c_str(), ok ? "ok" : "FAIL");
+
+    if (!ok)
+      failures++;
+  }
+
+  printf("seed %u: %d cases, %d failed\n", seed, only >= 0 ? 1 : (int)cases.size(), failures);
+
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,1426 @@
+#include "mockhost.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <atomic>
+#include <algorithm>
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <malloc.h>
+#else
+#include <dlfcn.h>
+#endif
+
+//////////////////////////////////////////////////////////////////////////////
+// Helpers
+//////////////////////////////////////////////////////////////////////////////
+static long atomic_increment(volatile long* value)
+{
+  return __atomic_add_fetch(value, 1, __ATOMIC_ACQ_REL);
+}
+
+static long atomic_decrement(volatile long* value)
+{
+  return __atomic_sub_fetch(value, 1, __ATOMIC_ACQ_REL);
+}
+
+static void* aligned_malloc(size_t size, size_t alignment)
+{
+#ifdef _WIN32
+  return _aligned_malloc(size, alignment);
+#else
+  void* ptr = nullptr;
+  return posix_memalign(&ptr, alignment, size ? size : 1) == 0 ? ptr : nullptr;
+#endif
+}
+
+static void aligned_free(void* ptr)
+{
+#ifdef _WIN32
+  _aligned_free(ptr);
+#else
+  free(ptr);
+#endif
+}
+
+static int align_up(int value, int alignment)
+{
+  return (value + alignment - 1) & ~(alignment - 1);
+}
+
+static bool same_name(const char* a, const char* b)
+{
+  while (*a && tolower((unsigned char)*a) == tolower((unsigned char)*b))
+  {
+    a++;
+    b++;
+  }
+
+  return *a == 0 && *b == 0;
+}
+
+static bool is_chroma_plane(int plane)
+{
+  plane &= ~PLANAR_ALIGNED;
+  return plane == PLANAR_U || plane == PLANAR_V || plane == PLANAR_B || plane == PLANAR_R;
+}
+
+static bool is_alpha_plane(int plane)
+{
+  return (plane & ~PLANAR_ALIGNED) == PLANAR_A;
+}
+
+// Frame buffer memory statistics
+static std::atomic<int64_t> memory_used(0);
+static std::atomic<int64_t> memory_peak(0);
+
+static void track_memory(int64_t bytes)
+{
+  const int64_t used = memory_used += bytes;
+  int64_t peak = memory_peak;
+
+  while (used > peak && !memory_peak.compare_exchange_weak(peak, used));
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// VideoInfo
+//////////////////////////////////////////////////////////////////////////////
+bool VideoInfo::HasVideo() const { return width != 0; }
+bool VideoInfo::HasAudio() const { return audio_samples_per_second != 0; }
+bool VideoInfo::IsRGB() const { return !!(pixel_type & CS_BGR); }
+bool VideoInfo::IsRGB24() const { return (pixel_type & CS_BGR24) == CS_BGR24 && (pixel_type & CS_Sample_Bits_Mask) == CS_Sample_Bits_8; }
+bool VideoInfo::IsRGB32() const { return (pixel_type & CS_BGR32) == CS_BGR32 && (pixel_type & CS_Sample_Bits_Mask) == CS_Sample_Bits_8; }
+bool VideoInfo::IsYUV() const { return !!(pixel_type & CS_YUV); }
+bool VideoInfo::IsYUY2() const { return (pixel_type & CS_YUY2) == CS_YUY2; }
+bool VideoInfo::IsYV24() const { return (pixel_type & CS_PLANAR_MASK) == (CS_YV24 & CS_PLANAR_FILTER); }
+bool VideoInfo::IsYV16() const { return (pixel_type & CS_PLANAR_MASK) == (CS_YV16 & CS_PLANAR_FILTER); }
+bool VideoInfo::IsYV12() const { return (pixel_type & CS_PLANAR_MASK) == (CS_YV12 & CS_PLANAR_FILTER); }
+bool VideoInfo::IsYV411() const { return (pixel_type & CS_PLANAR_MASK) == (CS_YV411 & CS_PLANAR_FILTER); }
+bool VideoInfo::IsY8() const { return (pixel_type & CS_PLANAR_MASK) == (CS_Y8 & CS_PLANAR_FILTER); }
+
+bool VideoInfo::IsColorSpace(int c_space) const
+{
+  return IsPlanar() ? (pixel_type & CS_PLANAR_MASK) == (c_space & CS_PLANAR_FILTER) : (pixel_type & c_space) == c_space;
+}
+
+bool VideoInfo::Is(int property) const { return (image_type & property) == property; }
+bool VideoInfo::IsPlanar() const { return !!(pixel_type & CS_PLANAR); }
+bool VideoInfo::IsFieldBased() const { return !!(image_type & IT_FIELDBASED); }
+bool VideoInfo::IsParityKnown() const { return (image_type & IT_FIELDBASED) && (image_type & (IT_BFF | IT_TFF)); }
+bool VideoInfo::IsBFF() const { return !!(image_type & IT_BFF); }
+bool VideoInfo::IsTFF() const { return !!(image_type & IT_TFF); }
+bool VideoInfo::IsVPlaneFirst() const { return IsPlanar() && !IsY() && (pixel_type & CS_VPlaneFirst); }
+
+int VideoInfo::BytesFromPixels(int pixels) const
+{
+  return IsPlanar() ? pixels * ComponentSize() : pixels * (BitsPerPixel() >> 3);
+}
+
+int VideoInfo::RowSize(int plane) const
+{
+  int rowsize = BytesFromPixels(width);
+
+  if (IsPlanar() && is_chroma_plane(plane))
+    rowsize = IsY() ? 0 : rowsize >> GetPlaneWidthSubsampling(plane);
+  else if (is_alpha_plane(plane))
+    rowsize = IsYUVA() || IsPlanarRGBA() ? rowsize : 0;
+
+  return plane & PLANAR_ALIGNED ? align_up(rowsize, FRAME_ALIGN) : rowsize;
+}
+
+int VideoInfo::BMPSize() const
+{
+  if (!IsPlanar())
+    return align_up(BytesFromPixels(width), 4) * height;
+
+  int size = align_up(RowSize(PLANAR_Y), 4) * height;
+
+  if (!IsY())
+    size += 2 * align_up(RowSize(PLANAR_U), 4) * (height >> GetPlaneHeightSubsampling(PLANAR_U));
+
+  if (IsYUVA() || IsPlanarRGBA())
+    size += align_up(RowSize(PLANAR_A), 4) * height;
+
+  return size;
+}
+
+int64_t VideoInfo::AudioSamplesFromFrames(int frames) const
+{
+  return fps_numerator && HasVideo() ? (int64_t)frames * audio_samples_per_second * fps_denominator / fps_numerator : 0;
+}
+
+int VideoInfo::FramesFromAudioSamples(int64_t samples) const
+{
+  return fps_denominator && HasAudio() ? (int)(samples * fps_numerator / fps_denominator / audio_samples_per_second) : 0;
+}
+
+int64_t VideoInfo::AudioSamplesFromBytes(int64_t bytes) const { return HasAudio() ? bytes / BytesPerAudioSample() : 0; }
+int64_t VideoInfo::BytesFromAudioSamples(int64_t samples) const { return samples * BytesPerAudioSample(); }
+int VideoInfo::AudioChannels() const { return HasAudio() ? nchannels : 0; }
+int VideoInfo::SampleType() const { return sample_type; }
+bool VideoInfo::IsSampleType(int testtype) const { return !!(sample_type & testtype); }
+int VideoInfo::SamplesPerSecond() const { return audio_samples_per_second; }
+int VideoInfo::BytesPerAudioSample() const { return nchannels * BytesPerChannelSample(); }
+
+void VideoInfo::SetFieldBased(bool isfieldbased)
+{
+  if (isfieldbased)
+    image_type |= IT_FIELDBASED;
+  else
+    image_type &= ~IT_FIELDBASED;
+}
+
+void VideoInfo::Set(int property) { image_type |= property; }
+void VideoInfo::Clear(int property) { image_type &= ~property; }
+
+int VideoInfo::GetPlaneWidthSubsampling(int plane) const
+{
+  if (IsYUY2() && is_chroma_plane(plane))
+    return 1;
+
+  if (!IsPlanar() || IsRGB() || IsY() || !is_chroma_plane(plane))
+    return 0;
+
+  return ((pixel_type >> CS_Shift_Sub_Width) + 1) & 3;
+}
+
+int VideoInfo::GetPlaneHeightSubsampling(int plane) const
+{
+  if (!IsPlanar() || IsRGB() || IsY() || !is_chroma_plane(plane))
+    return 0;
+
+  return ((pixel_type >> CS_Shift_Sub_Height) + 1) & 3;
+}
+
+int VideoInfo::BitsPerPixel() const
+{
+  if (!IsPlanar())
+  {
+    const int bits = 8 * ComponentSize();
+
+    if (IsYUY2()) return 16;
+    if (pixel_type & CS_RGBA_TYPE) return 4 * bits;
+    if (pixel_type & CS_RGB_TYPE) return 3 * bits;
+    return 0;
+  }
+
+  const int bits = 8 * ComponentSize();
+  int total = bits;
+
+  if (!IsY())
+    total += (2 * bits) >> (GetPlaneWidthSubsampling(PLANAR_U) + GetPlaneHeightSubsampling(PLANAR_U));
+
+  if (IsYUVA() || IsPlanarRGBA())
+    total += bits;
+
+  return total;
+}
+
+int VideoInfo::BytesPerChannelSample() const
+{
+  switch (sample_type)
+  {
+  case SAMPLE_INT8: return 1;
+  case SAMPLE_INT16: return 2;
+  case SAMPLE_INT24: return 3;
+  case SAMPLE_INT32: return 4;
+  case SAMPLE_FLOAT: return 4;
+  default: return 0;
+  }
+}
+
+void VideoInfo::SetFPS(unsigned numerator, unsigned denominator)
+{
+  unsigned a = numerator;
+  unsigned b = denominator;
+
+  while (b)
+  {
+    unsigned t = a % b;
+    a = b;
+    b = t;
+  }
+
+  fps_numerator = a ? numerator / a : numerator;
+  fps_denominator = a ? denominator / a : denominator;
+}
+
+void VideoInfo::MulDivFPS(unsigned multiplier, unsigned divisor)
+{
+  uint64_t numerator = (uint64_t)fps_numerator * multiplier;
+  uint64_t denominator = (uint64_t)fps_denominator * divisor;
+
+  while (numerator > 0xFFFFFFFFu || denominator > 0xFFFFFFFFu)
+  {
+    numerator >>= 1;
+    denominator >>= 1;
+  }
+
+  SetFPS((unsigned)numerator, (unsigned)denominator);
+}
+
+bool VideoInfo::IsSameColorspace(const VideoInfo& vi) const
+{
+  return vi.pixel_type == pixel_type || (IsYV12() && vi.IsYV12());
+}
+
+int VideoInfo::NumComponents() const
+{
+  if (IsYUY2()) return 3;
+  if (!IsPlanar()) return pixel_type & CS_RGBA_TYPE ? 4 : 3;
+  if (IsY()) return 1;
+  return IsYUVA() || IsPlanarRGBA() ? 4 : 3;
+}
+
+int VideoInfo::ComponentSize() const
+{
+  switch (pixel_type & CS_Sample_Bits_Mask)
+  {
+  case CS_Sample_Bits_8: return 1;
+  case CS_Sample_Bits_32: return 4;
+  default: return 2;
+  }
+}
+
+int VideoInfo::BitsPerComponent() const
+{
+  switch (pixel_type & CS_Sample_Bits_Mask)
+  {
+  case CS_Sample_Bits_10: return 10;
+  case CS_Sample_Bits_12: return 12;
+  case CS_Sample_Bits_14: return 14;
+  case CS_Sample_Bits_16: return 16;
+  case CS_Sample_Bits_32: return 32;
+  default: return 8;
+  }
+}
+
+static const int PLANAR_LAYOUT_MASK = VideoInfo::CS_PLANAR_MASK & ~VideoInfo::CS_Sample_Bits_Mask;
+
+static bool is_layout(int pixel_type, int layout)
+{
+  return (pixel_type & PLANAR_LAYOUT_MASK) == (layout & VideoInfo::CS_PLANAR_FILTER & PLANAR_LAYOUT_MASK);
+}
+
+bool VideoInfo::Is444() const { return is_layout(pixel_type, CS_GENERIC_YUV444) || is_layout(pixel_type, CS_GENERIC_YUVA444); }
+bool VideoInfo::Is422() const { return is_layout(pixel_type, CS_GENERIC_YUV422) || is_layout(pixel_type, CS_GENERIC_YUVA422); }
+bool VideoInfo::Is420() const { return is_layout(pixel_type, CS_GENERIC_YUV420) || is_layout(pixel_type, CS_GENERIC_YUVA420); }
+bool VideoInfo::IsY() const { return is_layout(pixel_type, CS_GENERIC_Y); }
+bool VideoInfo::IsRGB48() const { return (pixel_type & CS_BGR24) == CS_BGR24 && (pixel_type & CS_Sample_Bits_Mask) == CS_Sample_Bits_16; }
+bool VideoInfo::IsRGB64() const { return (pixel_type & CS_BGR32) == CS_BGR32 && (pixel_type & CS_Sample_Bits_Mask) == CS_Sample_Bits_16; }
+bool VideoInfo::IsYUVA() const { return (pixel_type & CS_YUVA) == CS_YUVA; }
+bool VideoInfo::IsPlanarRGB() const { return IsPlanar() && IsRGB() && (pixel_type & CS_RGB_TYPE); }
+bool VideoInfo::IsPlanarRGBA() const { return IsPlanar() && IsRGB() && (pixel_type & CS_RGBA_TYPE); }
+
+
+//////////////////////////////////////////////////////////////////////////////
+// VideoFrameBuffer
+//////////////////////////////////////////////////////////////////////////////
+VideoFrameBuffer::VideoFrameBuffer(int size, int margin, Device* _device) :
+  data((BYTE*)aligned_malloc(size + margin, FRAME_ALIGN)), data_size(size), sequence_number(0), refcount(0), device(_device)
+{
+  track_memory(data_size);
+}
+
+VideoFrameBuffer::VideoFrameBuffer() :
+  data(nullptr), data_size(0), sequence_number(0), refcount(0), device(nullptr)
+{
+}
+
+VideoFrameBuffer::~VideoFrameBuffer()
+{
+  track_memory(-data_size);
+  aligned_free(data);
+}
+
+const BYTE* VideoFrameBuffer::GetReadPtr() const { return data; }
+BYTE* VideoFrameBuffer::GetWritePtr() { atomic_increment(&sequence_number); return data; }
+int VideoFrameBuffer::GetDataSize() const { return data_size; }
+int VideoFrameBuffer::GetSequenceNumber() const { return sequence_number; }
+int VideoFrameBuffer::GetRefcount() const { return refcount; }
+
+
+//////////////////////////////////////////////////////////////////////////////
+// VideoFrame
+//////////////////////////////////////////////////////////////////////////////
+VideoFrame::VideoFrame(VideoFrameBuffer* _vfb, AVSMap* avsmap, int _offset, int _pitch, int _row_size, int _height) :
+  VideoFrame(_vfb, avsmap, _offset, _pitch, _row_size, _height, _offset, _offset, 0, 0, 0)
+{
+}
+
+VideoFrame::VideoFrame(VideoFrameBuffer* _vfb, AVSMap* avsmap, int _offset, int _pitch, int _row_size, int _height, int _offsetU, int _offsetV, int _pitchUV, int _row_sizeUV, int _heightUV) :
+  refcount(0), vfb(_vfb), offset(_offset), pitch(_pitch), row_size(_row_size), height(_height),
+  offsetU(_offsetU), offsetV(_offsetV), pitchUV(_pitchUV), row_sizeUV(_row_sizeUV), heightUV(_heightUV),
+  offsetA(0), pitchA(0), row_sizeA(0), properties(avsmap)
+{
+  atomic_increment(&vfb->refcount);
+}
+
+VideoFrame::VideoFrame(VideoFrameBuffer* _vfb, AVSMap* avsmap, int _offset, int _pitch, int _row_size, int _height, int _offsetU, int _offsetV, int _pitchUV, int _row_sizeUV, int _heightUV, int _offsetA) :
+  VideoFrame(_vfb, avsmap, _offset, _pitch, _row_size, _height, _offsetU, _offsetV, _pitchUV, _row_sizeUV, _heightUV)
+{
+  offsetA = _offsetA;
+  pitchA = _pitch;
+  row_sizeA = _row_size;
+}
+
+void* VideoFrame::operator new(size_t size)
+{
+  return ::operator new(size);
+}
+
+void VideoFrame::AddRef()
+{
+  atomic_increment(&refcount);
+}
+
+void VideoFrame::Release()
+{
+  if (atomic_decrement(&refcount) == 0)
+    delete this;
+}
+
+VideoFrame::~VideoFrame()
+{
+  DESTRUCTOR();
+}
+
+void VideoFrame::DESTRUCTOR()
+{
+  if (vfb && atomic_decrement(&vfb->refcount) == 0)
+    delete vfb;
+
+  vfb = nullptr;
+}
+
+int VideoFrame::GetPitch(int plane) const
+{
+  if (is_chroma_plane(plane)) return pitchUV;
+  if (is_alpha_plane(plane)) return pitchA;
+  return pitch;
+}
+
+int VideoFrame::GetRowSize(int plane) const
+{
+  int rowsize = row_size;
+
+  if (is_chroma_plane(plane))
+    rowsize = pitchUV ? row_sizeUV : 0;
+  else if (is_alpha_plane(plane))
+    rowsize = pitchA ? row_sizeA : 0;
+
+  // Aligned row sizes may be used if they still fit into the pitch
+  if (plane & PLANAR_ALIGNED)
+  {
+    const int aligned = align_up(rowsize, FRAME_ALIGN);
+
+    if (aligned <= GetPitch(plane))
+      return aligned;
+  }
+
+  return rowsize;
+}
+
+int VideoFrame::GetHeight(int plane) const
+{
+  if (is_chroma_plane(plane)) return pitchUV ? heightUV : 0;
+  if (is_alpha_plane(plane)) return pitchA ? height : 0;
+  return height;
+}
+
+VideoFrameBuffer* VideoFrame::GetFrameBuffer() const { return vfb; }
+
+int VideoFrame::GetOffset(int plane) const
+{
+  switch (plane & ~PLANAR_ALIGNED)
+  {
+  case PLANAR_U: case PLANAR_B: return offsetU;
+  case PLANAR_V: case PLANAR_R: return offsetV;
+  case PLANAR_A: return offsetA;
+  default: return offset;
+  }
+}
+
+const BYTE* VideoFrame::GetReadPtr(int plane) const
+{
+  return vfb->GetReadPtr() + GetOffset(plane);
+}
+
+bool VideoFrame::IsWritable() const
+{
+  return refcount == 1 && vfb->refcount == 1;
+}
+
+BYTE* VideoFrame::GetWritePtr(int plane) const
+{
+  // Like AviSynth only the first plane is checked for being writable
+  if (!plane || (plane & ~PLANAR_ALIGNED) == PLANAR_Y || (plane & ~PLANAR_ALIGNED) == PLANAR_G)
+    return IsWritable() ? vfb->GetWritePtr() + GetOffset(plane) : nullptr;
+
+  return vfb->data + GetOffset(plane);
+}
+
+bool VideoFrame::IsPropertyWritable() const
+{
+  return refcount == 1;
+}
+
+VideoFrame* VideoFrame::Subframe(int rel_offset, int new_pitch, int new_row_size, int new_height) const
+{
+  return new VideoFrame(vfb, nullptr, offset + rel_offset, new_pitch, new_row_size, new_height);
+}
+
+VideoFrame* VideoFrame::Subframe(int rel_offset, int new_pitch, int new_row_size, int new_height, int rel_offsetU, int rel_offsetV, int new_pitchUV) const
+{
+  const int new_row_sizeUV = row_size ? (int)((int64_t)new_row_size * row_sizeUV / row_size) : 0;
+  const int new_heightUV = height ? (int)((int64_t)new_height * heightUV / height) : 0;
+
+  return new VideoFrame(vfb, nullptr, offset + rel_offset, new_pitch, new_row_size, new_height,
+    offsetU + rel_offsetU, offsetV + rel_offsetV, new_pitchUV, new_row_sizeUV, new_heightUV);
+}
+
+VideoFrame* VideoFrame::Subframe(int rel_offset, int new_pitch, int new_row_size, int new_height, int rel_offsetU, int rel_offsetV, int new_pitchUV, int rel_offsetA) const
+{
+  const int new_row_sizeUV = row_size ? (int)((int64_t)new_row_size * row_sizeUV / row_size) : 0;
+  const int new_heightUV = height ? (int)((int64_t)new_height * heightUV / height) : 0;
+
+  return new VideoFrame(vfb, nullptr, offset + rel_offset, new_pitch, new_row_size, new_height,
+    offsetU + rel_offsetU, offsetV + rel_offsetV, new_pitchUV, new_row_sizeUV, new_heightUV, offsetA + rel_offsetA);
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// IClip, PClip and PVideoFrame reference counting
+//////////////////////////////////////////////////////////////////////////////
+void IClip::AddRef()
+{
+  atomic_increment(&refcnt);
+}
+
+void IClip::Release()
+{
+  if (atomic_decrement(&refcnt) == 0)
+    delete this;
+}
+
+IClip* PClip::GetPointerWithAddRef() const { if (p) p->AddRef(); return p; }
+void PClip::Init(IClip* x) { if (x) x->AddRef(); p = x; }
+void PClip::Set(IClip* x) { if (x) x->AddRef(); if (p) p->Release(); p = x; }
+
+void PClip::CONSTRUCTOR0() { p = nullptr; }
+void PClip::CONSTRUCTOR1(const PClip& x) { Init(x.p); }
+void PClip::CONSTRUCTOR2(IClip* x) { Init(x); }
+void PClip::OPERATOR_ASSIGN0(IClip* x) { Set(x); }
+void PClip::OPERATOR_ASSIGN1(const PClip& x) { Set(x.p); }
+void PClip::DESTRUCTOR() { if (p) p->Release(); }
+
+PClip::PClip() { CONSTRUCTOR0(); }
+PClip::PClip(const PClip& x) { CONSTRUCTOR1(x); }
+PClip::PClip(IClip* x) { CONSTRUCTOR2(x); }
+void PClip::operator=(IClip* x) { OPERATOR_ASSIGN0(x); }
+void PClip::operator=(const PClip& x) { OPERATOR_ASSIGN1(x); }
+PClip::~PClip() { DESTRUCTOR(); }
+
+void PVideoFrame::Init(VideoFrame* x) { if (x) x->AddRef(); p = x; }
+void PVideoFrame::Set(VideoFrame* x) { if (x) x->AddRef(); if (p) p->Release(); p = x; }
+
+void PVideoFrame::CONSTRUCTOR0() { p = nullptr; }
+void PVideoFrame::CONSTRUCTOR1(const PVideoFrame& x) { Init(x.p); }
+void PVideoFrame::CONSTRUCTOR2(VideoFrame* x) { Init(x); }
+void PVideoFrame::OPERATOR_ASSIGN0(VideoFrame* x) { Set(x); }
+void PVideoFrame::OPERATOR_ASSIGN1(const PVideoFrame& x) { Set(x.p); }
+void PVideoFrame::DESTRUCTOR() { if (p) p->Release(); }
+
+PVideoFrame::PVideoFrame() { CONSTRUCTOR0(); }
+PVideoFrame::PVideoFrame(const PVideoFrame& x) { CONSTRUCTOR1(x); }
+PVideoFrame::PVideoFrame(VideoFrame* x) { CONSTRUCTOR2(x); }
+void PVideoFrame::operator=(VideoFrame* x) { OPERATOR_ASSIGN0(x); }
+void PVideoFrame::operator=(const PVideoFrame& x) { OPERATOR_ASSIGN1(x); }
+PVideoFrame::~PVideoFrame() { DESTRUCTOR(); }
+
+
+//////////////////////////////////////////////////////////////////////////////
+// AVSValue
+//
+// Arrays are deep copies, strings are owned by the environment.
+//////////////////////////////////////////////////////////////////////////////
+void AVSValue::CONSTRUCTOR0() { type = 'v'; array_size = 0; clip = nullptr; }
+void AVSValue::CONSTRUCTOR1(IClip* c) { type = 'c'; array_size = 0; clip = c; if (c) c->AddRef(); }
+void AVSValue::CONSTRUCTOR2(const PClip& c) { type = 'c'; array_size = 0; clip = c.GetPointerWithAddRef(); }
+void AVSValue::CONSTRUCTOR3(bool b) { type = 'b'; array_size = 0; clip = nullptr; boolean = b; }
+void AVSValue::CONSTRUCTOR4(int i) { type = 'i'; array_size = 0; clip = nullptr; integer = i; }
+void AVSValue::CONSTRUCTOR5(float f) { type = 'f'; array_size = 0; clip = nullptr; floating_pt = f; }
+void AVSValue::CONSTRUCTOR6(double f) { type = 'f'; array_size = 0; clip = nullptr; floating_pt = (float)f; }
+void AVSValue::CONSTRUCTOR7(const char* s) { type = 's'; array_size = 0; string = s; }
+
+void AVSValue::CONSTRUCTOR8(const AVSValue* a, int size)
+{
+  type = 'a';
+  array_size = (short)size;
+
+  AVSValue* copy = size > 0 ? new AVSValue[size] : nullptr;
+
+  for (int i = 0; i < size; i++)
+    copy[i] = a[i];
+
+  array = copy;
+}
+
+void AVSValue::CONSTRUCTOR9(const AVSValue& v) { Assign(&v, true); }
+
+void AVSValue::DESTRUCTOR()
+{
+  if (IsClip() && clip)
+    clip->Release();
+
+  if (IsArray())
+    delete[] array;
+}
+
+AVSValue& AVSValue::OPERATOR_ASSIGN(const AVSValue& v)
+{
+  Assign(&v, false);
+  return *this;
+}
+
+const AVSValue& AVSValue::OPERATOR_INDEX(int index) const
+{
+  return IsArray() && index >= 0 && index < array_size ? array[index] : *this;
+}
+
+void AVSValue::Assign(const AVSValue* src, bool init)
+{
+  // Take the new references first, src may live inside this value
+  if (src->IsClip() && src->clip)
+    src->clip->AddRef();
+
+  AVSValue* copy = nullptr;
+
+  if (src->IsArray() && src->array_size > 0)
+  {
+    copy = new AVSValue[src->array_size];
+
+    for (int i = 0; i < src->array_size; i++)
+      copy[i] = src->array[i];
+  }
+
+  if (!init)
+    DESTRUCTOR();
+
+  type = src->type;
+  array_size = src->array_size;
+
+  switch (type)
+  {
+  case 'c': clip = src->clip; break;
+  case 'b': boolean = src->boolean; break;
+  case 'i': integer = src->integer; break;
+  case 'f': floating_pt = src->floating_pt; break;
+  case 's': string = src->string; break;
+  case 'a': array = copy; break;
+  default: clip = nullptr; break;
+  }
+}
+
+AVSValue::AVSValue() { CONSTRUCTOR0(); }
+AVSValue::AVSValue(IClip* c) { CONSTRUCTOR1(c); }
+AVSValue::AVSValue(const PClip& c) { CONSTRUCTOR2(c); }
+AVSValue::AVSValue(bool b) { CONSTRUCTOR3(b); }
+AVSValue::AVSValue(int i) { CONSTRUCTOR4(i); }
+AVSValue::AVSValue(float f) { CONSTRUCTOR5(f); }
+AVSValue::AVSValue(double f) { CONSTRUCTOR6(f); }
+AVSValue::AVSValue(const char* s) { CONSTRUCTOR7(s); }
+AVSValue::AVSValue(const AVSValue* a, int size) { CONSTRUCTOR8(a, size); }
+AVSValue::AVSValue(const AVSValue& a, int size) { CONSTRUCTOR8(&a, size); }
+AVSValue::AVSValue(const AVSValue& v) { CONSTRUCTOR9(v); }
+AVSValue::~AVSValue() { DESTRUCTOR(); }
+AVSValue& AVSValue::operator=(const AVSValue& v) { return OPERATOR_ASSIGN(v); }
+const AVSValue& AVSValue::operator[](int index) const { return OPERATOR_INDEX(index); }
+
+bool AVSValue::Defined() const { return type != 'v'; }
+bool AVSValue::IsClip() const { return type == 'c'; }
+bool AVSValue::IsBool() const { return type == 'b'; }
+bool AVSValue::IsInt() const { return type == 'i'; }
+bool AVSValue::IsFloat() const { return type == 'f' || type == 'i'; }
+bool AVSValue::IsString() const { return type == 's'; }
+bool AVSValue::IsArray() const { return type == 'a'; }
+bool AVSValue::IsFunction() const { return type == 'n'; }
+
+PClip AVSValue::AsClip() const { return IsClip() ? clip : nullptr; }
+bool AVSValue::AsBool1() const { return IsBool() && boolean; }
+int AVSValue::AsInt1() const { return IsInt() ? integer : 0; }
+const char* AVSValue::AsString1() const { return IsString() ? string : nullptr; }
+double AVSValue::AsFloat1() const { return IsInt() ? integer : IsFloat() ? floating_pt : 0.0; }
+bool AVSValue::AsBool2(bool def) const { return IsBool() ? boolean : def; }
+int AVSValue::AsInt2(int def) const { return IsInt() ? integer : def; }
+double AVSValue::AsDblDef(double def) const { return IsInt() ? integer : IsFloat() ? floating_pt : def; }
+double AVSValue::AsFloat2(float def) const { return IsInt() ? integer : IsFloat() ? floating_pt : def; }
+const char* AVSValue::AsString2(const char* def) const { return IsString() ? string : def; }
+int AVSValue::ArraySize() const { return IsArray() ? array_size : 1; }
+
+bool AVSValue::AsBool() const { return AsBool1(); }
+int AVSValue::AsInt() const { return AsInt1(); }
+const char* AVSValue::AsString() const { return AsString1(); }
+double AVSValue::AsFloat() const { return AsFloat1(); }
+float AVSValue::AsFloatf() const { return (float)AsFloat1(); }
+bool AVSValue::AsBool(bool def) const { return AsBool2(def); }
+int AVSValue::AsInt(int def) const { return AsInt2(def); }
+double AVSValue::AsFloat(float def) const { return AsFloat2(def); }
+float AVSValue::AsFloatf(float def) const { return (float)AsFloat2(def); }
+const char* AVSValue::AsString(const char* def) const { return AsString2(def); }
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Linkage table handed to plugins
+//////////////////////////////////////////////////////////////////////////////
+static const AVS_Linkage* get_linkage()
+{
+  static AVS_Linkage linkage = {};
+
+  if (linkage.Size)
+    return &linkage;
+
+  linkage.HasVideo = &VideoInfo::HasVideo;
+  linkage.HasAudio = &VideoInfo::HasAudio;
+  linkage.IsRGB = &VideoInfo::IsRGB;
+  linkage.IsRGB24 = &VideoInfo::IsRGB24;
+  linkage.IsRGB32 = &VideoInfo::IsRGB32;
+  linkage.IsYUV = &VideoInfo::IsYUV;
+  linkage.IsYUY2 = &VideoInfo::IsYUY2;
+  linkage.IsYV24 = &VideoInfo::IsYV24;
+  linkage.IsYV16 = &VideoInfo::IsYV16;
+  linkage.IsYV12 = &VideoInfo::IsYV12;
+  linkage.IsYV411 = &VideoInfo::IsYV411;
+  linkage.IsY8 = &VideoInfo::IsY8;
+  linkage.IsColorSpace = &VideoInfo::IsColorSpace;
+  linkage.Is = &VideoInfo::Is;
+  linkage.IsPlanar = &VideoInfo::IsPlanar;
+  linkage.IsFieldBased = &VideoInfo::IsFieldBased;
+  linkage.IsParityKnown = &VideoInfo::IsParityKnown;
+  linkage.IsBFF = &VideoInfo::IsBFF;
+  linkage.IsTFF = &VideoInfo::IsTFF;
+  linkage.IsVPlaneFirst = &VideoInfo::IsVPlaneFirst;
+  linkage.BytesFromPixels = &VideoInfo::BytesFromPixels;
+  linkage.RowSize = &VideoInfo::RowSize;
+  linkage.BMPSize = &VideoInfo::BMPSize;
+  linkage.AudioSamplesFromFrames = &VideoInfo::AudioSamplesFromFrames;
+  linkage.FramesFromAudioSamples = &VideoInfo::FramesFromAudioSamples;
+  linkage.AudioSamplesFromBytes = &VideoInfo::AudioSamplesFromBytes;
+  linkage.BytesFromAudioSamples = &VideoInfo::BytesFromAudioSamples;
+  linkage.AudioChannels = &VideoInfo::AudioChannels;
+  linkage.SampleType = &VideoInfo::SampleType;
+  linkage.IsSampleType = &VideoInfo::IsSampleType;
+  linkage.SamplesPerSecond = &VideoInfo::SamplesPerSecond;
+  linkage.BytesPerAudioSample = &VideoInfo::BytesPerAudioSample;
+  linkage.SetFieldBased = &VideoInfo::SetFieldBased;
+  linkage.Set = &VideoInfo::Set;
+  linkage.Clear = &VideoInfo::Clear;
+  linkage.GetPlaneWidthSubsampling = &VideoInfo::GetPlaneWidthSubsampling;
+  linkage.GetPlaneHeightSubsampling = &VideoInfo::GetPlaneHeightSubsampling;
+  linkage.BitsPerPixel = &VideoInfo::BitsPerPixel;
+  linkage.BytesPerChannelSample = &VideoInfo::BytesPerChannelSample;
+  linkage.SetFPS = &VideoInfo::SetFPS;
+  linkage.MulDivFPS = &VideoInfo::MulDivFPS;
+  linkage.IsSameColorspace = &VideoInfo::IsSameColorspace;
+
+  linkage.VFBGetReadPtr = &VideoFrameBuffer::GetReadPtr;
+  linkage.VFBGetWritePtr = &VideoFrameBuffer::GetWritePtr;
+  linkage.GetDataSize = &VideoFrameBuffer::GetDataSize;
+  linkage.GetSequenceNumber = &VideoFrameBuffer::GetSequenceNumber;
+  linkage.GetRefcount = &VideoFrameBuffer::GetRefcount;
+
+  linkage.GetPitch = &VideoFrame::GetPitch;
+  linkage.GetRowSize = &VideoFrame::GetRowSize;
+  linkage.GetHeight = &VideoFrame::GetHeight;
+  linkage.GetFrameBuffer = &VideoFrame::GetFrameBuffer;
+  linkage.GetOffset = &VideoFrame::GetOffset;
+  linkage.VFGetReadPtr = &VideoFrame::GetReadPtr;
+  linkage.IsWritable = &VideoFrame::IsWritable;
+  linkage.VFGetWritePtr = &VideoFrame::GetWritePtr;
+  linkage.VideoFrame_DESTRUCTOR = &VideoFrame::DESTRUCTOR;
+
+  linkage.PClip_CONSTRUCTOR0 = &PClip::CONSTRUCTOR0;
+  linkage.PClip_CONSTRUCTOR1 = &PClip::CONSTRUCTOR1;
+  linkage.PClip_CONSTRUCTOR2 = &PClip::CONSTRUCTOR2;
+  linkage.PClip_OPERATOR_ASSIGN0 = &PClip::OPERATOR_ASSIGN0;
+  linkage.PClip_OPERATOR_ASSIGN1 = &PClip::OPERATOR_ASSIGN1;
+  linkage.PClip_DESTRUCTOR = &PClip::DESTRUCTOR;
+
+  linkage.PVideoFrame_CONSTRUCTOR0 = &PVideoFrame::CONSTRUCTOR0;
+  linkage.PVideoFrame_CONSTRUCTOR1 = &PVideoFrame::CONSTRUCTOR1;
+  linkage.PVideoFrame_CONSTRUCTOR2 = &PVideoFrame::CONSTRUCTOR2;
+  linkage.PVideoFrame_OPERATOR_ASSIGN0 = &PVideoFrame::OPERATOR_ASSIGN0;
+  linkage.PVideoFrame_OPERATOR_ASSIGN1 = &PVideoFrame::OPERATOR_ASSIGN1;
+  linkage.PVideoFrame_DESTRUCTOR = &PVideoFrame::DESTRUCTOR;
+
+  linkage.AVSValue_CONSTRUCTOR0 = &AVSValue::CONSTRUCTOR0;
+  linkage.AVSValue_CONSTRUCTOR1 = &AVSValue::CONSTRUCTOR1;
+  linkage.AVSValue_CONSTRUCTOR2 = &AVSValue::CONSTRUCTOR2;
+  linkage.AVSValue_CONSTRUCTOR3 = &AVSValue::CONSTRUCTOR3;
+  linkage.AVSValue_CONSTRUCTOR4 = &AVSValue::CONSTRUCTOR4;
+  linkage.AVSValue_CONSTRUCTOR5 = &AVSValue::CONSTRUCTOR5;
+  linkage.AVSValue_CONSTRUCTOR6 = &AVSValue::CONSTRUCTOR6;
+  linkage.AVSValue_CONSTRUCTOR7 = &AVSValue::CONSTRUCTOR7;
+  linkage.AVSValue_CONSTRUCTOR8 = &AVSValue::CONSTRUCTOR8;
+  linkage.AVSValue_CONSTRUCTOR9 = &AVSValue::CONSTRUCTOR9;
+  linkage.AVSValue_DESTRUCTOR = &AVSValue::DESTRUCTOR;
+  linkage.AVSValue_OPERATOR_ASSIGN = &AVSValue::OPERATOR_ASSIGN;
+  linkage.AVSValue_OPERATOR_INDEX = &AVSValue::OPERATOR_INDEX;
+  linkage.Defined = &AVSValue::Defined;
+  linkage.IsClip = &AVSValue::IsClip;
+  linkage.IsBool = &AVSValue::IsBool;
+  linkage.IsInt = &AVSValue::IsInt;
+  linkage.IsFloat = &AVSValue::IsFloat;
+  linkage.IsString = &AVSValue::IsString;
+  linkage.IsArray = &AVSValue::IsArray;
+  linkage.AsClip = &AVSValue::AsClip;
+  linkage.AsBool1 = &AVSValue::AsBool1;
+  linkage.AsInt1 = &AVSValue::AsInt1;
+  linkage.AsString1 = &AVSValue::AsString1;
+  linkage.AsFloat1 = &AVSValue::AsFloat1;
+  linkage.AsBool2 = &AVSValue::AsBool2;
+  linkage.AsInt2 = &AVSValue::AsInt2;
+  linkage.AsDblDef = &AVSValue::AsDblDef;
+  linkage.AsFloat2 = &AVSValue::AsFloat2;
+  linkage.AsString2 = &AVSValue::AsString2;
+  linkage.ArraySize = &AVSValue::ArraySize;
+
+  linkage.NumComponents = &VideoInfo::NumComponents;
+  linkage.ComponentSize = &VideoInfo::ComponentSize;
+  linkage.BitsPerComponent = &VideoInfo::BitsPerComponent;
+  linkage.Is444 = &VideoInfo::Is444;
+  linkage.Is422 = &VideoInfo::Is422;
+  linkage.Is420 = &VideoInfo::Is420;
+  linkage.IsY = &VideoInfo::IsY;
+  linkage.IsRGB48 = &VideoInfo::IsRGB48;
+  linkage.IsRGB64 = &VideoInfo::IsRGB64;
+  linkage.IsYUVA = &VideoInfo::IsYUVA;
+  linkage.IsPlanarRGB = &VideoInfo::IsPlanarRGB;
+  linkage.IsPlanarRGBA = &VideoInfo::IsPlanarRGBA;
+
+  linkage.IsFunction = &AVSValue::IsFunction;
+  linkage.IsPropertyWritable = &VideoFrame::IsPropertyWritable;
+
+  // Frame properties, functions and devices are not provided, the table ends
+  // before the Neo entries so plugins see no INeoEnv
+  linkage.Size = (int)offsetof(AVS_Linkage, GetNeoEnv);
+
+  return &linkage;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Environment
+//////////////////////////////////////////////////////////////////////////////
+ScriptEnvironment::ScriptEnvironment()
+{
+}
+
+ScriptEnvironment::~ScriptEnvironment()
+{
+  for (auto it = shutdown.rbegin(); it != shutdown.rend(); ++it)
+    it->first(it->second, this);
+}
+
+bool ScriptEnvironment::LoadPlugin(const char* path, std::string& error)
+{
+  typedef const char* (__stdcall *InitFunc)(IScriptEnvironment* env, const AVS_Linkage* const vectors);
+
+#ifdef _WIN32
+  HMODULE plugin = LoadLibraryA(path);
+  InitFunc init = plugin ? (InitFunc)(void*)GetProcAddress(plugin, "AvisynthPluginInit3") : nullptr;
+#else
+  void* plugin = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+  InitFunc init = plugin ? (InitFunc)dlsym(plugin, "AvisynthPluginInit3") : nullptr;
+#endif
+
+  if (!plugin)
+  {
+    error = std::string("cannot load ") + path;
+#ifndef _WIN32
+    error = dlerror();
+#endif
+    return false;
+  }
+
+  if (!init)
+  {
+    error = std::string(path) + " has no AvisynthPluginInit3";
+    return false;
+  }
+
+  try
+  {
+    init(this, get_linkage());
+  }
+  catch (const AvisynthError& e)
+  {
+    error = e.msg;
+    return false;
+  }
+
+  return true;
+}
+
+int64_t ScriptEnvironment::GetMemoryUsed() { return memory_used; }
+int64_t ScriptEnvironment::GetMemoryPeak() { return memory_peak; }
+void ScriptEnvironment::ResetMemoryPeak() { memory_peak = (int64_t)memory_used; }
+
+int __stdcall ScriptEnvironment::GetCPUFlags()
+{
+  return 0;
+}
+
+char* __stdcall ScriptEnvironment::SaveString(const char* s, int length)
+{
+  std::lock_guard<std::mutex> guard(lock);
+
+  strings.emplace_back(s, length < 0 ? strlen(s) : (size_t)length);
+  return &strings.back()[0];
+}
+
+char* ScriptEnvironment::Sprintf(const char* fmt, ...)
+{
+  va_list args;
+  va_start(args, fmt);
+  char* result = VSprintf(fmt, args);
+  va_end(args);
+
+  return result;
+}
+
+char* __stdcall ScriptEnvironment::VSprintf(const char* fmt, va_list val)
+{
+  char buffer[4096];
+  vsnprintf(buffer, sizeof(buffer), fmt, val);
+
+  return SaveString(buffer);
+}
+
+void ScriptEnvironment::ThrowError(const char* fmt, ...)
+{
+  va_list args;
+  va_start(args, fmt);
+  char* message = VSprintf(fmt, args);
+  va_end(args);
+
+  throw AvisynthError(message);
+}
+
+void __stdcall ScriptEnvironment::AddFunction(const char* name, const char* params, ApplyFunc apply, void* user_data)
+{
+  std::string key(name);
+
+  for (auto& c : key)
+    c = (char)tolower((unsigned char)c);
+
+  std::lock_guard<std::mutex> guard(lock);
+  functions[key] = Function{ params, apply, user_data };
+}
+
+const ScriptEnvironment::Function* ScriptEnvironment::FindFunction(const char* name)
+{
+  std::string key(name);
+
+  for (auto& c : key)
+    c = (char)tolower((unsigned char)c);
+
+  std::lock_guard<std::mutex> guard(lock);
+  auto it = functions.find(key);
+
+  return it != functions.end() ? &it->second : nullptr;
+}
+
+bool __stdcall ScriptEnvironment::FunctionExists(const char* name)
+{
+  return FindFunction(name) != nullptr;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Calls a registered function
+//
+// Unnamed arguments fill the parameters in order, a "+" or "*" parameter
+// takes all following unnamed values of its type. Named arguments are
+// matched against the [NAME] of optional parameters, case insensitive.
+//////////////////////////////////////////////////////////////////////////////
+AVSValue __stdcall ScriptEnvironment::Invoke(const char* name, const AVSValue args, const char* const* arg_names)
+{
+  const Function* function = FindFunction(name);
+
+  if (!function)
+    throw NotFound();
+
+  struct Param
+  {
+    std::string name;
+    char type;
+    bool repeat;
+  };
+
+  std::vector<Param> params;
+
+  for (const char* p = function->params.c_str(); *p;)
+  {
+    Param param;
+
+    if (*p == '[')
+    {
+      const char* end = strchr(p, ']');
+
+      if (!end)
+        ThrowError("Invoke: malformed parameter list of %s", name);
+
+      param.name.assign(p + 1, end);
+      p = end + 1;
+    }
+
+    param.type = *p++;
+    param.repeat = *p == '+' || *p == '*';
+
+    if (param.repeat)
+      p++;
+
+    params.push_back(param);
+  }
+
+  auto matches = [](char type, const AVSValue& value)
+  {
+    switch (type)
+    {
+    case 'c': return value.IsClip();
+    case 'i': return value.IsInt();
+    case 'f': return value.IsFloat();
+    case 'b': return value.IsBool();
+    case 's': return value.IsString();
+    default: return true;
+    }
+  };
+
+  const int count = args.IsArray() ? args.ArraySize() : (args.Defined() ? 1 : 0);
+  std::vector<AVSValue> values(params.size());
+  size_t next = 0;
+
+  for (int i = 0; i < count; i++)
+  {
+    const AVSValue& value = args.IsArray() ? args[i] : args;
+
+    if (arg_names && arg_names[i])
+    {
+      size_t j = 0;
+
+      while (j < params.size() && !same_name(params[j].name.c_str(), arg_names[i]))
+        j++;
+
+      if (j == params.size() || !matches(params[j].type, value))
+        ThrowError("Invoke: invalid argument %s to %s", arg_names[i], name);
+
+      values[j] = value;
+      continue;
+    }
+
+    if (next >= params.size())
+      ThrowError("Invoke: too many arguments to %s", name);
+
+    const Param& param = params[next];
+
+    if (param.repeat && !value.IsArray())
+    {
+      // Collect the run of values of this type
+      std::vector<AVSValue> run;
+
+      while (i < count && !(arg_names && arg_names[i]) && matches(param.type, args.IsArray() ? args[i] : args))
+        run.push_back(args.IsArray() ? args[i++] : args);
+
+      i--;
+      values[next++] = AVSValue(run.data(), (int)run.size());
+    }
+    else
+    {
+      if (!param.repeat && !matches(param.type, value))
+        ThrowError("Invoke: invalid argument %d to %s", i + 1, name);
+
+      values[next++] = value;
+    }
+  }
+
+  for (size_t j = 0; j < params.size(); j++)
+  {
+    if (params[j].name.empty() && !values[j].Defined())
+    {
+      if (params[j].repeat)
+        values[j] = AVSValue((const AVSValue*)nullptr, 0);
+      else
+        ThrowError("Invoke: missing argument %d to %s", (int)j + 1, name);
+    }
+  }
+
+  return function->apply(AVSValue(values.data(), (int)values.size()), function->user_data, this);
+}
+
+AVSValue __stdcall ScriptEnvironment::GetVar(const char* name)
+{
+  std::lock_guard<std::mutex> guard(lock);
+  auto it = vars.find(name);
+
+  if (it == vars.end())
+    throw NotFound();
+
+  return it->second;
+}
+
+bool __stdcall ScriptEnvironment::SetVar(const char* name, const AVSValue& val)
+{
+  std::lock_guard<std::mutex> guard(lock);
+  vars[name] = val;
+  return true;
+}
+
+bool __stdcall ScriptEnvironment::SetGlobalVar(const char* name, const AVSValue& val)
+{
+  return SetVar(name, val);
+}
+
+void __stdcall ScriptEnvironment::PushContext(int level)
+{
+}
+
+void __stdcall ScriptEnvironment::PopContext()
+{
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Frame allocation, planes are stored one after another with aligned pitches
+//////////////////////////////////////////////////////////////////////////////
+PVideoFrame __stdcall ScriptEnvironment::NewVideoFrame(const VideoInfo& vi, int align)
+{
+  const int alignment = std::max(align, (int)FRAME_ALIGN);
+
+  const int row_size = vi.RowSize(PLANAR_Y);
+  const int pitch = align_up(row_size, alignment);
+  const int height = vi.height;
+
+  int row_sizeUV = 0;
+  int pitchUV = 0;
+  int heightUV = 0;
+
+  if (vi.IsPlanar() && !vi.IsY())
+  {
+    row_sizeUV = vi.RowSize(PLANAR_U);
+    pitchUV = align_up(row_sizeUV, alignment);
+    heightUV = height >> vi.GetPlaneHeightSubsampling(PLANAR_U);
+  }
+
+  const bool alpha = vi.IsYUVA() || vi.IsPlanarRGBA();
+
+  const int offsetU = pitch * height;
+  const int offsetV = offsetU + pitchUV * heightUV;
+  const int offsetA = offsetV + pitchUV * heightUV;
+  const int size = offsetA + (alpha ? pitch * height : 0);
+
+  VideoFrameBuffer* vfb = new VideoFrameBuffer(size, alignment, nullptr);
+
+  if (alpha)
+    return new VideoFrame(vfb, nullptr, 0, pitch, row_size, height, offsetU, offsetV, pitchUV, row_sizeUV, heightUV, offsetA);
+  else if (pitchUV)
+    return new VideoFrame(vfb, nullptr, 0, pitch, row_size, height, offsetU, offsetV, pitchUV, row_sizeUV, heightUV);
+  else
+    return new VideoFrame(vfb, nullptr, 0, pitch, row_size, height);
+}
+
+bool __stdcall ScriptEnvironment::MakeWritable(PVideoFrame* pvf)
+{
+  const PVideoFrame& frame = *pvf;
+
+  if (frame->IsWritable())
+    return false;
+
+  // Copy the whole buffer, offsets and pitches stay the same
+  VideoFrameBuffer* source = frame->vfb;
+  VideoFrameBuffer* vfb = new VideoFrameBuffer(source->data_size, FRAME_ALIGN, nullptr);
+
+  memcpy(vfb->data, source->data, source->data_size);
+
+  VideoFrame* copy = new VideoFrame(vfb, nullptr, frame->offset, frame->pitch, frame->row_size, frame->height,
+    frame->offsetU, frame->offsetV, frame->pitchUV, frame->row_sizeUV, frame->heightUV);
+
+  copy->offsetA = frame->offsetA;
+  copy->pitchA = frame->pitchA;
+  copy->row_sizeA = frame->row_sizeA;
+
+  *pvf = copy;
+  return true;
+}
+
+void __stdcall ScriptEnvironment::BitBlt(BYTE* dstp, int dst_pitch, const BYTE* srcp, int src_pitch, int row_size, int height)
+{
+  if (height == 1 || (dst_pitch == src_pitch && src_pitch == row_size))
+  {
+    memcpy(dstp, srcp, (size_t)row_size * height);
+    return;
+  }
+
+  for (int y = 0; y < height; y++)
+  {
+    memcpy(dstp, srcp, row_size);
+
+    dstp += dst_pitch;
+    srcp += src_pitch;
+  }
+}
+
+void __stdcall ScriptEnvironment::AtExit(ShutdownFunc function, void* user_data)
+{
+  std::lock_guard<std::mutex> guard(lock);
+  shutdown.emplace_back(function, user_data);
+}
+
+void __stdcall ScriptEnvironment::CheckVersion(int version)
+{
+  if (version > AVISYNTH_INTERFACE_VERSION)
+    ThrowError("Plugin was designed for a later version of Avisynth (%d)", version);
+}
+
+PVideoFrame __stdcall ScriptEnvironment::Subframe(PVideoFrame src, int rel_offset, int new_pitch, int new_row_size, int new_height)
+{
+  return src->Subframe(rel_offset, new_pitch, new_row_size, new_height);
+}
+
+int __stdcall ScriptEnvironment::SetMemoryMax(int mem)
+{
+  return 0;
+}
+
+int __stdcall ScriptEnvironment::SetWorkingDir(const char* newdir)
+{
+  return -1;
+}
+
+void* __stdcall ScriptEnvironment::ManageCache(int key, void* data)
+{
+  return nullptr;
+}
+
+bool __stdcall ScriptEnvironment::PlanarChromaAlignment(PlanarChromaAlignmentMode key)
+{
+  return true;
+}
+
+PVideoFrame __stdcall ScriptEnvironment::SubframePlanar(PVideoFrame src, int rel_offset, int new_pitch, int new_row_size,
+                                                        int new_height, int rel_offsetU, int rel_offsetV, int new_pitchUV)
+{
+  return src->Subframe(rel_offset, new_pitch, new_row_size, new_height, rel_offsetU, rel_offsetV, new_pitchUV);
+}
+
+void __stdcall ScriptEnvironment::DeleteScriptEnvironment()
+{
+  // Owned by the caller
+}
+
+void __stdcall ScriptEnvironment::ApplyMessage(PVideoFrame* frame, const VideoInfo& vi, const char* message, int size,
+                                               int textcolor, int halocolor, int bgcolor)
+{
+}
+
+const AVS_Linkage* __stdcall ScriptEnvironment::GetAVSLinkage()
+{
+  return get_linkage();
+}
+
+AVSValue __stdcall ScriptEnvironment::GetVarDef(const char* name, const AVSValue& def)
+{
+  AVSValue value;
+  return GetVarTry(name, &value) ? value : def;
+}
+
+PVideoFrame __stdcall ScriptEnvironment::SubframePlanarA(PVideoFrame src, int rel_offset, int new_pitch, int new_row_size,
+                                                         int new_height, int rel_offsetU, int rel_offsetV, int new_pitchUV, int rel_offsetA)
+{
+  return src->Subframe(rel_offset, new_pitch, new_row_size, new_height, rel_offsetU, rel_offsetV, new_pitchUV, rel_offsetA);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Frame properties are not stored, frames behave as if they had none
+//////////////////////////////////////////////////////////////////////////////
+void __stdcall ScriptEnvironment::copyFrameProps(const PVideoFrame& src, PVideoFrame& dst) {}
+const AVSMap* __stdcall ScriptEnvironment::getFramePropsRO(const PVideoFrame& frame) { return nullptr; }
+AVSMap* __stdcall ScriptEnvironment::getFramePropsRW(PVideoFrame& frame) { return nullptr; }
+int __stdcall ScriptEnvironment::propNumKeys(const AVSMap* map) { return 0; }
+const char* __stdcall ScriptEnvironment::propGetKey(const AVSMap* map, int index) { return nullptr; }
+int __stdcall ScriptEnvironment::propNumElements(const AVSMap* map, const char* key) { return -1; }
+char __stdcall ScriptEnvironment::propGetType(const AVSMap* map, const char* key) { return PROPTYPE_UNSET; }
+
+int64_t __stdcall ScriptEnvironment::propGetInt(const AVSMap* map, const char* key, int index, int* error)
+{
+  if (error) *error = GETPROPERROR_UNSET;
+  return 0;
+}
+
+double __stdcall ScriptEnvironment::propGetFloat(const AVSMap* map, const char* key, int index, int* error)
+{
+  if (error) *error = GETPROPERROR_UNSET;
+  return 0.0;
+}
+
+const char* __stdcall ScriptEnvironment::propGetData(const AVSMap* map, const char* key, int index, int* error)
+{
+  if (error) *error = GETPROPERROR_UNSET;
+  return nullptr;
+}
+
+int __stdcall ScriptEnvironment::propGetDataSize(const AVSMap* map, const char* key, int index, int* error)
+{
+  if (error) *error = GETPROPERROR_UNSET;
+  return 0;
+}
+
+PClip __stdcall ScriptEnvironment::propGetClip(const AVSMap* map, const char* key, int index, int* error)
+{
+  if (error) *error = GETPROPERROR_UNSET;
+  return nullptr;
+}
+
+const PVideoFrame __stdcall ScriptEnvironment::propGetFrame(const AVSMap* map, const char* key, int index, int* error)
+{
+  if (error) *error = GETPROPERROR_UNSET;
+  return nullptr;
+}
+
+int __stdcall ScriptEnvironment::propDeleteKey(AVSMap* map, const char* key) { return 0; }
+int __stdcall ScriptEnvironment::propSetInt(AVSMap* map, const char* key, int64_t i, int append) { return 1; }
+int __stdcall ScriptEnvironment::propSetFloat(AVSMap* map, const char* key, double d, int append) { return 1; }
+int __stdcall ScriptEnvironment::propSetData(AVSMap* map, const char* key, const char* d, int length, int append) { return 1; }
+int __stdcall ScriptEnvironment::propSetClip(AVSMap* map, const char* key, PClip& clip, int append) { return 1; }
+int __stdcall ScriptEnvironment::propSetFrame(AVSMap* map, const char* key, const PVideoFrame& frame, int append) { return 1; }
+
+const int64_t* __stdcall ScriptEnvironment::propGetIntArray(const AVSMap* map, const char* key, int* error)
+{
+  if (error) *error = GETPROPERROR_UNSET;
+  return nullptr;
+}
+
+const double* __stdcall ScriptEnvironment::propGetFloatArray(const AVSMap* map, const char* key, int* error)
+{
+  if (error) *error = GETPROPERROR_UNSET;
+  return nullptr;
+}
+
+int __stdcall ScriptEnvironment::propSetIntArray(AVSMap* map, const char* key, const int64_t* i, int size) { return 1; }
+int __stdcall ScriptEnvironment::propSetFloatArray(AVSMap* map, const char* key, const double* d, int size) { return 1; }
+AVSMap* __stdcall ScriptEnvironment::createMap() { return nullptr; }
+void __stdcall ScriptEnvironment::freeMap(AVSMap* map) {}
+void __stdcall ScriptEnvironment::clearMap(AVSMap* map) {}
+
+PVideoFrame __stdcall ScriptEnvironment::NewVideoFrameP(const VideoInfo& vi, PVideoFrame* propSrc, int align)
+{
+  return NewVideoFrame(vi, align);
+}
+
+size_t __stdcall ScriptEnvironment::GetEnvProperty(AvsEnvProperty prop)
+{
+  switch (prop)
+  {
+  case AEP_PHYSICAL_CPUS:
+  case AEP_LOGICAL_CPUS: return std::max(1U, std::thread::hardware_concurrency());
+  case AEP_THREADPOOL_THREADS: return 1;
+  case AEP_FILTERCHAIN_THREADS: return 1;
+  case AEP_INTERFACE_VERSION: return AVISYNTH_INTERFACE_VERSION;
+  case AEP_FRAME_ALIGN: return FRAME_ALIGN;
+  case AEP_PLANE_ALIGN: return FRAME_ALIGN;
+  default: return 0;
+  }
+}
+
+void* __stdcall ScriptEnvironment::Allocate(size_t nBytes, size_t alignment, AvsAllocType type)
+{
+  return aligned_malloc(nBytes, std::max(alignment, sizeof(void*)));
+}
+
+void __stdcall ScriptEnvironment::Free(void* ptr)
+{
+  aligned_free(ptr);
+}
+
+bool __stdcall ScriptEnvironment::GetVarTry(const char* name, AVSValue* val) const
+{
+  std::lock_guard<std::mutex> guard(lock);
+  auto it = vars.find(name);
+
+  if (it == vars.end())
+    return false;
+
+  *val = it->second;
+  return true;
+}
+
+bool __stdcall ScriptEnvironment::GetVarBool(const char* name, bool def) const
+{
+  AVSValue value;
+  return GetVarTry(name, &value) ? value.AsBool(def) : def;
+}
+
+int __stdcall ScriptEnvironment::GetVarInt(const char* name, int def) const
+{
+  AVSValue value;
+  return GetVarTry(name, &value) ? value.AsInt(def) : def;
+}
+
+double __stdcall ScriptEnvironment::GetVarDouble(const char* name, double def) const
+{
+  AVSValue value;
+  return GetVarTry(name, &value) ? value.AsDblDef(def) : def;
+}
+
+const char* __stdcall ScriptEnvironment::GetVarString(const char* name, const char* def) const
+{
+  AVSValue value;
+  return GetVarTry(name, &value) ? value.AsString(def) : def;
+}
+
+int64_t __stdcall ScriptEnvironment::GetVarLong(const char* name, int64_t def) const
+{
+  AVSValue value;
+  return GetVarTry(name, &value) && value.IsInt() ? value.AsInt() : def;
+}
+
+bool __stdcall ScriptEnvironment::InvokeTry(AVSValue* result, const char* name, const AVSValue& args, const char* const* arg_names)
+{
+  try
+  {
+    *result = Invoke(name, args, arg_names);
+    return true;
+  }
+  catch (const NotFound&)
+  {
+    return false;
+  }
+}
+
+AVSValue __stdcall ScriptEnvironment::Invoke2(const AVSValue& implicit_last, const char* name, const AVSValue args, const char* const* arg_names)
+{
+  return Invoke(name, args, arg_names);
+}
+
+bool __stdcall ScriptEnvironment::Invoke2Try(AVSValue* result, const AVSValue& implicit_last, const char* name, const AVSValue args, const char* const* arg_names)
+{
+  return InvokeTry(result, name, args, arg_names);
+}
+
+AVSValue __stdcall ScriptEnvironment::Invoke3(const AVSValue& implicit_last, const PFunction& func, const AVSValue args, const char* const* arg_names)
+{
+  throw NotFound();
+}
+
+bool __stdcall ScriptEnvironment::Invoke3Try(AVSValue* result, const AVSValue& implicit_last, const PFunction& func, const AVSValue args, const char* const* arg_names)
+{
+  return false;
+}
+
+bool __stdcall ScriptEnvironment::MakePropertyWritable(PVideoFrame* pvf)
+{
+  return false;
+}
@@ -0,0 +1,137 @@
+#ifndef MOCKHOST_H
+#define MOCKHOST_H
+
+//////////////////////////////////////////////////////////////////////////////
+// Headless AviSynth host for tests and benchmarks
+//
+// Implements the part of IScriptEnvironment and of the AVS_Linkage functions
+// (VideoInfo, VideoFrame, PClip, PVideoFrame, AVSValue) that filters need, so
+// the plugin can be loaded through AvisynthPluginInit3, filters created with
+// Invoke and frames requested with GetFrame without an AviSynth+ install.
+//
+// Everything including this header is compiled with BUILDING_AVSCORE and
+// calls the implementations below directly, the plugin calls them through
+// the linkage table. The environment has to be named ScriptEnvironment, as
+// that is the class VideoFrame and VideoFrameBuffer grant construction to.
+//////////////////////////////////////////////////////////////////////////////
+
+#include "avisynth.h"
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <deque>
+#include <mutex>
+
+class ScriptEnvironment : public IScriptEnvironment
+{
+public:
+  ScriptEnvironment();
+  ~ScriptEnvironment();
+
+  ScriptEnvironment(const ScriptEnvironment&) = delete;
+  ScriptEnvironment& operator=(const ScriptEnvironment&) = delete;
+
+  // Loads a plugin and runs its AvisynthPluginInit3. Plugins stay loaded until
+  // the process exits, so clips may outlive the environment.
+  bool LoadPlugin(const char* path, std::string& error);
+
+  // Frame buffer memory currently allocated and the highest value seen
+  static int64_t GetMemoryUsed();
+  static int64_t GetMemoryPeak();
+  static void ResetMemoryPeak();
+
+  // IScriptEnvironment
+  int __stdcall GetCPUFlags() override;
+  char* __stdcall SaveString(const char* s, int length = -1) override;
+  char* Sprintf(const char* fmt, ...) override;
+  char* __stdcall VSprintf(const char* fmt, va_list val) override;
+  void ThrowError(const char* fmt, ...) override;
+  void __stdcall AddFunction(const char* name, const char* params, ApplyFunc apply, void* user_data) override;
+  bool __stdcall FunctionExists(const char* name) override;
+  AVSValue __stdcall Invoke(const char* name, const AVSValue args, const char* const* arg_names = 0) override;
+  AVSValue __stdcall GetVar(const char* name) override;
+  bool __stdcall SetVar(const char* name, const AVSValue& val) override;
+  bool __stdcall SetGlobalVar(const char* name, const AVSValue& val) override;
+  void __stdcall PushContext(int level = 0) override;
+  void __stdcall PopContext() override;
+  PVideoFrame __stdcall NewVideoFrame(const VideoInfo& vi, int align = FRAME_ALIGN) override;
+  bool __stdcall MakeWritable(PVideoFrame* pvf) override;
+  void __stdcall BitBlt(BYTE* dstp, int dst_pitch, const BYTE* srcp, int src_pitch, int row_size, int height) override;
+  void __stdcall AtExit(ShutdownFunc function, void* user_data) override;
+  void __stdcall CheckVersion(int version = AVISYNTH_INTERFACE_VERSION) override;
+  PVideoFrame __stdcall Subframe(PVideoFrame src, int rel_offset, int new_pitch, int new_row_size, int new_height) override;
+  int __stdcall SetMemoryMax(int mem) override;
+  int __stdcall SetWorkingDir(const char* newdir) override;
+  void* __stdcall ManageCache(int key, void* data) override;
+  bool __stdcall PlanarChromaAlignment(PlanarChromaAlignmentMode key) override;
+  PVideoFrame __stdcall SubframePlanar(PVideoFrame src, int rel_offset, int new_pitch, int new_row_size,
+                                       int new_height, int rel_offsetU, int rel_offsetV, int new_pitchUV) override;
+  void __stdcall DeleteScriptEnvironment() override;
+  void __stdcall ApplyMessage(PVideoFrame* frame, const VideoInfo& vi, const char* message, int size,
+                              int textcolor, int halocolor, int bgcolor) override;
+  const AVS_Linkage* __stdcall GetAVSLinkage() override;
+  AVSValue __stdcall GetVarDef(const char* name, const AVSValue& def = AVSValue()) override;
+  PVideoFrame __stdcall SubframePlanarA(PVideoFrame src, int rel_offset, int new_pitch, int new_row_size,
+                                        int new_height, int rel_offsetU, int rel_offsetV, int new_pitchUV, int rel_offsetA) override;
+  void __stdcall copyFrameProps(const PVideoFrame& src, PVideoFrame& dst) override;
+  const AVSMap* __stdcall getFramePropsRO(const PVideoFrame& frame) override;
+  AVSMap* __stdcall getFramePropsRW(PVideoFrame& frame) override;
+  int __stdcall propNumKeys(const AVSMap* map) override;
+  const char* __stdcall propGetKey(const AVSMap* map, int index) override;
+  int __stdcall propNumElements(const AVSMap* map, const char* key) override;
+  char __stdcall propGetType(const AVSMap* map, const char* key) override;
+  int64_t __stdcall propGetInt(const AVSMap* map, const char* key, int index, int* error) override;
+  double __stdcall propGetFloat(const AVSMap* map, const char* key, int index, int* error) override;
+  const char* __stdcall propGetData(const AVSMap* map, const char* key, int index, int* error) override;
+  int __stdcall propGetDataSize(const AVSMap* map, const char* key, int index, int* error) override;
+  PClip __stdcall propGetClip(const AVSMap* map, const char* key, int index, int* error) override;
+  const PVideoFrame __stdcall propGetFrame(const AVSMap* map, const char* key, int index, int* error) override;
+  int __stdcall propDeleteKey(AVSMap* map, const char* key) override;
+  int __stdcall propSetInt(AVSMap* map, const char* key, int64_t i, int append) override;
+  int __stdcall propSetFloat(AVSMap* map, const char* key, double d, int append) override;
+  int __stdcall propSetData(AVSMap* map, const char* key, const char* d, int length, int append) override;
+  int __stdcall propSetClip(AVSMap* map, const char* key, PClip& clip, int append) override;
+  int __stdcall propSetFrame(AVSMap* map, const char* key, const PVideoFrame& frame, int append) override;
+  const int64_t* __stdcall propGetIntArray(const AVSMap* map, const char* key, int* error) override;
+  const double* __stdcall propGetFloatArray(const AVSMap* map, const char* key, int* error) override;
+  int __stdcall propSetIntArray(AVSMap* map, const char* key, const int64_t* i, int size) override;
+  int __stdcall propSetFloatArray(AVSMap* map, const char* key, const double* d, int size) override;
+  AVSMap* __stdcall createMap() override;
+  void __stdcall freeMap(AVSMap* map) override;
+  void __stdcall clearMap(AVSMap* map) override;
+  PVideoFrame __stdcall NewVideoFrameP(const VideoInfo& vi, PVideoFrame* propSrc, int align = FRAME_ALIGN) override;
+  size_t __stdcall GetEnvProperty(AvsEnvProperty prop) override;
+  void* __stdcall Allocate(size_t nBytes, size_t alignment, AvsAllocType type) override;
+  void __stdcall Free(void* ptr) override;
+  bool __stdcall GetVarTry(const char* name, AVSValue* val) const override;
+  bool __stdcall GetVarBool(const char* name, bool def) const override;
+  int __stdcall GetVarInt(const char* name, int def) const override;
+  double __stdcall GetVarDouble(const char* name, double def) const override;
+  const char* __stdcall GetVarString(const char* name, const char* def) const override;
+  int64_t __stdcall GetVarLong(const char* name, int64_t def) const override;
+  bool __stdcall InvokeTry(AVSValue* result, const char* name, const AVSValue& args, const char* const* arg_names = 0) override;
+  AVSValue __stdcall Invoke2(const AVSValue& implicit_last, const char* name, const AVSValue args, const char* const* arg_names = 0) override;
+  bool __stdcall Invoke2Try(AVSValue* result, const AVSValue& implicit_last, const char* name, const AVSValue args, const char* const* arg_names = 0) override;
+  AVSValue __stdcall Invoke3(const AVSValue& implicit_last, const PFunction& func, const AVSValue args, const char* const* arg_names = 0) override;
+  bool __stdcall Invoke3Try(AVSValue* result, const AVSValue& implicit_last, const PFunction& func, const AVSValue args, const char* const* arg_names = 0) override;
+  bool __stdcall MakePropertyWritable(PVideoFrame* pvf) override;
+
+private:
+  struct Function
+  {
+    std::string params;
+    ApplyFunc apply;
+    void* user_data;
+  };
+
+  mutable std::mutex lock;
+  std::map<std::string, Function> functions; // lower case names
+  std::map<std::string, AVSValue> vars;
+  std::deque<std::string> strings;
+  std::vector<std::pair<ShutdownFunc, void*>> shutdown;
+
+  const Function* FindFunction(const char* name);
+};
+
+#endif // MOCKHOST_H
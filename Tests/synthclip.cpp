@@ -0,0 +1,142 @@
+#include "synthclip.h"
+#include <string.h>
+#include <algorithm>
+
+static const size_t CACHE_FRAMES = 16;
+
+//////////////////////////////////////////////////////////////////////////////
+// Constructor
+//////////////////////////////////////////////////////////////////////////////
+SyntheticClip::SyntheticClip(const VideoInfo& _vi, const SyntheticParams& _params) :
+  vi(_vi), params(_params), requests(0)
+{
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Frame access, frame numbers outside the clip are clamped
+//////////////////////////////////////////////////////////////////////////////
+PVideoFrame __stdcall SyntheticClip::GetFrame(int n, IScriptEnvironment* env)
+{
+  requests++;
+
+  n = std::min(std::max(n, 0), vi.num_frames - 1);
+
+  if (!params.fresh)
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    auto it = cache.find(n);
+
+    if (it != cache.end())
+      return it->second;
+  }
+
+  const int scene = n + params.offset;
+
+  PVideoFrame frame = env->NewVideoFrame(vi);
+
+  static const int planes_yuv[] = { PLANAR_Y, PLANAR_U, PLANAR_V, PLANAR_A };
+  static const int planes_rgb[] = { PLANAR_G, PLANAR_B, PLANAR_R, PLANAR_A };
+
+  const int count = vi.IsPlanar() ? vi.NumComponents() : 1;
+
+  for (int p = 0; p < count; p++)
+  {
+    const int plane = vi.IsPlanar() ? (vi.IsRGB() ? planes_rgb[p] : planes_yuv[p]) : 0;
+
+    Generate(scene, frame->GetWritePtr(plane), frame->GetPitch(plane), frame->GetRowSize(plane), frame->GetHeight(plane), p);
+  }
+
+  if (params.fresh)
+    return frame;
+
+  std::lock_guard<std::mutex> guard(lock);
+
+  if (cache.size() >= CACHE_FRAMES)
+    cache.erase(cache.begin());
+
+  cache[n] = frame;
+
+  return frame;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Pattern generation
+//////////////////////////////////////////////////////////////////////////////
+static uint32_t hash(uint32_t a, uint32_t b, uint32_t c, uint32_t d)
+{
+  uint32_t h = a * 0x9E3779B1u ^ b * 0x85EBCA77u ^ c * 0xC2B2AE3Du ^ d * 0x27D4EB2Fu;
+
+  h ^= h >> 15;
+  h *= 0x2C1B3C6Du;
+  h ^= h >> 12;
+  h *= 0x297A2D39u;
+  h ^= h >> 15;
+
+  return h;
+}
+
+void SyntheticClip::Generate(int scene, unsigned char* dstp, int pitch, int rowsize, int height, int plane)
+{
+  const int component = vi.IsRGB64() || vi.IsRGB48() ? 2 : vi.ComponentSize();
+  const int width = rowsize / component;
+  const int bits = vi.IsRGB64() || vi.IsRGB48() ? 16 : vi.BitsPerComponent();
+  const int maximum = bits == 32 ? 255 : (1 << bits) - 1;
+  const int scale = bits == 32 ? 1 : 1 << (bits - 8);
+
+  for (int y = 0; y < height; y++)
+  {
+    const int field = y & 1 ? scene + params.bottom : scene;
+
+    for (int x = 0; x < width; x++)
+    {
+      // Diagonal bands that move by a few samples per frame
+      int value = ((x + 3 * field) * 5 + y * 3 + plane * 64) & 255;
+      value = value * scale + (x & (scale - 1));
+
+      const uint32_t h = hash(params.seed, field, plane, (uint32_t)(y * 65536 + x));
+
+      if (params.noise)
+        value += ((int)(h % (2 * params.noise + 1)) - params.noise) * scale;
+
+      if ((int)((h >> 16) % 1000) < params.dropouts)
+        value = h & 0x100 ? maximum : 0;
+
+      if (params.blank)
+        value = params.blank * scale;
+
+      value = std::min(std::max(value, 0), maximum);
+
+      if (bits == 32)
+        reinterpret_cast<float*>(dstp)[x] = value / 255.0f;
+      else if (component == 2)
+        reinterpret_cast<uint16_t*>(dstp)[x] = (uint16_t)value;
+      else
+        dstp[x] = (unsigned char)value;
+    }
+
+    // Defined padding, the sync search reads across it
+    memset(dstp + rowsize, 0, pitch - rowsize);
+
+    dstp += pitch;
+  }
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Helpers
+//////////////////////////////////////////////////////////////////////////////
+VideoInfo make_video_info(int pixel_type, int width, int height, int frames)
+{
+  VideoInfo vi;
+  memset(&vi, 0, sizeof(vi));
+
+  vi.width = width;
+  vi.height = height;
+  vi.pixel_type = pixel_type;
+  vi.num_frames = frames;
+  vi.SetFPS(25, 1);
+
+  return vi;
+}
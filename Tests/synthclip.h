@@ -0,0 +1,58 @@
+#ifndef SYNTHCLIP_H
+#define SYNTHCLIP_H
+
+#include "mockhost.h"
+#include <stdint.h>
+#include <map>
+#include <mutex>
+#include <atomic>
+
+//////////////////////////////////////////////////////////////////////////////
+// Synthetic capture of a generated scene
+//
+// All clips show the same moving pattern, each capture adds its own noise
+// and dropouts (samples replaced by black or white). A capture with offset o
+// shows scene frame n + o as its frame n, which emulates captures that are
+// out of sync. Frames are reproducible from the seed and frame number.
+//////////////////////////////////////////////////////////////////////////////
+struct SyntheticParams
+{
+  uint32_t seed;
+  int offset;   // frame n shows scene frame n + offset
+  int noise;    // noise amplitude in 8 bit steps
+  int dropouts; // samples per 1000 replaced by black or white
+  int blank;    // nonzero: flat frames at this 8 bit level, a capture without signal
+  bool fresh;   // no cache, every request gets a new frame nobody else holds
+  int bottom;   // bottom field (odd rows of every plane) shows scene frame n + offset + bottom
+};
+
+class SyntheticClip : public IClip
+{
+public:
+  SyntheticClip(const VideoInfo& _vi, const SyntheticParams& _params);
+
+  PVideoFrame __stdcall GetFrame(int n, IScriptEnvironment* env) override;
+  bool __stdcall GetParity(int n) override { return false; }
+  void __stdcall GetAudio(void* buf, int64_t start, int64_t count, IScriptEnvironment* env) override {}
+  int __stdcall SetCacheHints(int cachehints, int frame_range) override { return 0; }
+  const VideoInfo& __stdcall GetVideoInfo() override { return vi; }
+
+  // Number of GetFrame calls so far
+  long GetRequests() const { return requests; }
+
+private:
+  VideoInfo vi;
+  SyntheticParams params;
+  std::atomic<long> requests;
+
+  // Recently generated frames, like the cache AviSynth puts after a source
+  std::mutex lock;
+  std::map<int, PVideoFrame> cache;
+
+  void Generate(int scene, unsigned char* dstp, int pitch, int rowsize, int height, int plane);
+};
+
+// Clip description with 25 fps and no audio
+VideoInfo make_video_info(int pixel_type, int width, int height, int frames);
+
+#endif // SYNTHCLIP_H